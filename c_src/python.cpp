@@ -17,6 +17,8 @@ namespace pythonx::python {
   }
 
 DEF_SYMBOL(PyBool_FromLong)
+DEF_SYMBOL(PyBuffer_FillInfo)
+DEF_SYMBOL(PyBuffer_Release)
 DEF_SYMBOL(PyBytes_AsStringAndSize)
 DEF_SYMBOL(PyBytes_FromStringAndSize)
 DEF_SYMBOL(PyDict_Copy)
@@ -46,18 +48,25 @@ DEF_SYMBOL(PyList_New)
 DEF_SYMBOL(PyList_SetItem)
 DEF_SYMBOL(PyList_Size)
 DEF_SYMBOL(PyLong_AsLongLongAndOverflow)
+DEF_SYMBOL(PyLong_AsUnsignedLongLong)
 DEF_SYMBOL(PyLong_FromLongLong)
-DEF_SYMBOL(PyLong_FromString)
 DEF_SYMBOL(PyLong_FromUnsignedLongLong)
+DEF_SYMBOL(PyMemoryView_FromMemory)
+DEF_SYMBOL(PyMemoryView_FromObject)
 DEF_SYMBOL(PyModule_GetDict)
 DEF_SYMBOL(PyObject_Call)
 DEF_SYMBOL(PyObject_CallNoArgs)
+DEF_SYMBOL(PyObject_CheckBuffer)
+DEF_SYMBOL(PyObject_GetAttr)
+DEF_SYMBOL(PyObject_GetBuffer)
 DEF_SYMBOL(PyObject_GetAttrString)
 DEF_SYMBOL(PyObject_GetIter)
 DEF_SYMBOL(PyObject_IsInstance)
 DEF_SYMBOL(PyObject_Repr)
 DEF_SYMBOL(PyObject_SetAttrString)
+DEF_SYMBOL(PyObject_Size)
 DEF_SYMBOL(PyObject_Str)
+DEF_SYMBOL(PyObject_Type)
 DEF_SYMBOL(PySet_Add)
 DEF_SYMBOL(PySet_New)
 DEF_SYMBOL(PySet_Size)
@@ -67,8 +76,12 @@ DEF_SYMBOL(PyTuple_New)
 DEF_SYMBOL(PyTuple_Pack)
 DEF_SYMBOL(PyTuple_SetItem)
 DEF_SYMBOL(PyTuple_Size)
+DEF_SYMBOL(PyType_FromSpec)
+DEF_SYMBOL(PyType_GetSlot)
 DEF_SYMBOL(PyUnicode_AsUTF8AndSize)
 DEF_SYMBOL(PyUnicode_FromStringAndSize)
+DEF_SYMBOL(PyUnicode_InternFromString)
+DEF_SYMBOL(PyUnicode_InternInPlace)
 DEF_SYMBOL(Py_BuildValue)
 DEF_SYMBOL(Py_CompileString)
 DEF_SYMBOL(Py_DecRef)
@@ -92,6 +105,8 @@ void load_python_library(std::string path) {
   }
 
   LOAD_SYMBOL(python_library, PyBool_FromLong)
+  LOAD_SYMBOL(python_library, PyBuffer_FillInfo)
+  LOAD_SYMBOL(python_library, PyBuffer_Release)
   LOAD_SYMBOL(python_library, PyBytes_AsStringAndSize)
   LOAD_SYMBOL(python_library, PyBytes_FromStringAndSize)
   LOAD_SYMBOL(python_library, PyDict_Copy)
@@ -121,18 +136,25 @@ void load_python_library(std::string path) {
   LOAD_SYMBOL(python_library, PyList_SetItem)
   LOAD_SYMBOL(python_library, PyList_Size)
   LOAD_SYMBOL(python_library, PyLong_AsLongLongAndOverflow)
+  LOAD_SYMBOL(python_library, PyLong_AsUnsignedLongLong)
   LOAD_SYMBOL(python_library, PyLong_FromLongLong)
-  LOAD_SYMBOL(python_library, PyLong_FromString)
   LOAD_SYMBOL(python_library, PyLong_FromUnsignedLongLong)
+  LOAD_SYMBOL(python_library, PyMemoryView_FromMemory)
+  LOAD_SYMBOL(python_library, PyMemoryView_FromObject)
   LOAD_SYMBOL(python_library, PyModule_GetDict)
   LOAD_SYMBOL(python_library, PyObject_Call)
   LOAD_SYMBOL(python_library, PyObject_CallNoArgs)
+  LOAD_SYMBOL(python_library, PyObject_CheckBuffer)
+  LOAD_SYMBOL(python_library, PyObject_GetAttr)
+  LOAD_SYMBOL(python_library, PyObject_GetBuffer)
   LOAD_SYMBOL(python_library, PyObject_GetAttrString)
   LOAD_SYMBOL(python_library, PyObject_GetIter)
   LOAD_SYMBOL(python_library, PyObject_IsInstance)
   LOAD_SYMBOL(python_library, PyObject_Repr)
   LOAD_SYMBOL(python_library, PyObject_SetAttrString)
+  LOAD_SYMBOL(python_library, PyObject_Size)
   LOAD_SYMBOL(python_library, PyObject_Str)
+  LOAD_SYMBOL(python_library, PyObject_Type)
   LOAD_SYMBOL(python_library, PySet_Add)
   LOAD_SYMBOL(python_library, PySet_New)
   LOAD_SYMBOL(python_library, PySet_Size)
@@ -142,8 +164,12 @@ void load_python_library(std::string path) {
   LOAD_SYMBOL(python_library, PyTuple_Pack)
   LOAD_SYMBOL(python_library, PyTuple_SetItem)
   LOAD_SYMBOL(python_library, PyTuple_Size)
+  LOAD_SYMBOL(python_library, PyType_FromSpec)
+  LOAD_SYMBOL(python_library, PyType_GetSlot)
   LOAD_SYMBOL(python_library, PyUnicode_AsUTF8AndSize)
   LOAD_SYMBOL(python_library, PyUnicode_FromStringAndSize)
+  LOAD_SYMBOL(python_library, PyUnicode_InternFromString)
+  LOAD_SYMBOL(python_library, PyUnicode_InternInPlace)
   LOAD_SYMBOL(python_library, Py_BuildValue)
   LOAD_SYMBOL(python_library, Py_CompileString)
   LOAD_SYMBOL(python_library, Py_DecRef)
@@ -67,9 +67,68 @@ using PyObjectPtr = void *;
 using PyThreadStatePtr = void *;
 using Py_ssize_t = ssize_t;
 
+// Structs
+
+// Py_buffer is part of the Limited API since Python 3.11, however its
+// layout has not changed since Python 3.3, so we also use it on 3.10,
+// where the corresponding functions are available in the library.
+struct Py_buffer {
+  void *buf;
+  PyObjectPtr obj;
+  Py_ssize_t len;
+  Py_ssize_t itemsize;
+  int readonly;
+  int ndim;
+  char *format;
+  Py_ssize_t *shape;
+  Py_ssize_t *strides;
+  Py_ssize_t *suboffsets;
+  void *internal;
+};
+
+struct PyType_Slot {
+  int slot;
+  void *pfunc;
+};
+
+struct PyType_Spec {
+  const char *name;
+  int basicsize;
+  int itemsize;
+  unsigned int flags;
+  PyType_Slot *slots;
+};
+
+// Constants
+
+// Requests a contiguous buffer without any shape information
+constexpr int PyBUF_SIMPLE = 0;
+// Requests the buffer item format
+constexpr int PyBUF_FORMAT = 0x0004;
+// Requests a buffer with shape and strides, without suboffsets
+constexpr int PyBUF_STRIDES = 0x0018;
+// Requests a C-contiguous buffer with shape and strides
+constexpr int PyBUF_C_CONTIGUOUS = 0x0038;
+// Read-only access for PyMemoryView_FromMemory
+constexpr int PyBUF_READ = 0x100;
+
+// Slot ids for PyType_Slot, see typeslots.h
+constexpr int Py_bf_getbuffer = 1;
+constexpr int Py_tp_alloc = 47;
+constexpr int Py_tp_dealloc = 52;
+constexpr int Py_tp_free = 74;
+
+// Default type flags, that is, Py_TPFLAGS_HAVE_VERSION_TAG
+constexpr unsigned int Py_TPFLAGS_DEFAULT = 1 << 18;
+// Prevents creating instances of the type from Python
+constexpr unsigned int Py_TPFLAGS_DISALLOW_INSTANTIATION = 1 << 7;
+
 // Functions
 
 extern PyObjectPtr (*PyBool_FromLong)(long int);
+extern int (*PyBuffer_FillInfo)(Py_buffer *, PyObjectPtr, void *, Py_ssize_t,
+                                int, int);
+extern void (*PyBuffer_Release)(Py_buffer *);
 extern int (*PyBytes_AsStringAndSize)(PyObjectPtr, char **, Py_ssize_t *);
 extern PyObjectPtr (*PyBytes_FromStringAndSize)(const char *, Py_ssize_t);
 extern PyObjectPtr (*PyDict_Copy)(PyObjectPtr);
@@ -100,18 +159,25 @@ extern PyObjectPtr (*PyList_New)(Py_ssize_t);
 extern Py_ssize_t (*PyList_Size)(PyObjectPtr);
 extern int (*PyList_SetItem)(PyObjectPtr, Py_ssize_t, PyObjectPtr);
 extern long long (*PyLong_AsLongLongAndOverflow)(PyObjectPtr, int *);
+extern unsigned long long (*PyLong_AsUnsignedLongLong)(PyObjectPtr);
 extern PyObjectPtr (*PyLong_FromLongLong)(long long);
-extern PyObjectPtr (*PyLong_FromString)(const char *, char **, int);
 extern PyObjectPtr (*PyLong_FromUnsignedLongLong)(unsigned long long);
+extern PyObjectPtr (*PyMemoryView_FromMemory)(char *, Py_ssize_t, int);
+extern PyObjectPtr (*PyMemoryView_FromObject)(PyObjectPtr);
 extern PyObjectPtr (*PyModule_GetDict)(PyObjectPtr);
 extern PyObjectPtr (*PyObject_Call)(PyObjectPtr, PyObjectPtr, PyObjectPtr);
 extern PyObjectPtr (*PyObject_CallNoArgs)(PyObjectPtr);
+extern int (*PyObject_CheckBuffer)(PyObjectPtr);
+extern PyObjectPtr (*PyObject_GetAttr)(PyObjectPtr, PyObjectPtr);
+extern int (*PyObject_GetBuffer)(PyObjectPtr, Py_buffer *, int);
 extern PyObjectPtr (*PyObject_GetAttrString)(PyObjectPtr, const char *);
 extern PyObjectPtr (*PyObject_GetIter)(PyObjectPtr);
 extern int (*PyObject_IsInstance)(PyObjectPtr, PyObjectPtr);
 extern PyObjectPtr (*PyObject_Repr)(PyObjectPtr);
 extern int (*PyObject_SetAttrString)(PyObjectPtr, const char *, PyObjectPtr);
+extern Py_ssize_t (*PyObject_Size)(PyObjectPtr);
 extern PyObjectPtr (*PyObject_Str)(PyObjectPtr);
+extern PyObjectPtr (*PyObject_Type)(PyObjectPtr);
 extern int (*PySet_Add)(PyObjectPtr, PyObjectPtr);
 extern PyObjectPtr (*PySet_New)(PyObjectPtr);
 extern Py_ssize_t (*PySet_Size)(PyObjectPtr);
@@ -121,8 +187,12 @@ extern PyObjectPtr (*PyTuple_New)(Py_ssize_t);
 extern PyObjectPtr (*PyTuple_Pack)(Py_ssize_t, ...);
 extern int (*PyTuple_SetItem)(PyObjectPtr, Py_ssize_t, PyObjectPtr);
 extern Py_ssize_t (*PyTuple_Size)(PyObjectPtr);
+extern PyObjectPtr (*PyType_FromSpec)(PyType_Spec *);
+extern void *(*PyType_GetSlot)(PyObjectPtr, int);
 extern const char *(*PyUnicode_AsUTF8AndSize)(PyObjectPtr, Py_ssize_t *);
 extern PyObjectPtr (*PyUnicode_FromStringAndSize)(const char *, Py_ssize_t);
+extern PyObjectPtr (*PyUnicode_InternFromString)(const char *);
+extern void (*PyUnicode_InternInPlace)(PyObjectPtr *);
 extern PyObjectPtr (*Py_BuildValue)(const char *, ...);
 extern PyObjectPtr (*Py_CompileString)(const char *, const char *, int);
 extern void (*Py_DecRef)(PyObjectPtr);
@@ -1,14 +1,24 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstring>
 #include <erl_nif.h>
 #include <fine.hpp>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <variant>
 
 #include "python.hpp"
@@ -21,6 +31,14 @@ pythonx_handle_send_tagged_object(const char *pid_bytes, const char *tag,
                                   pythonx::python::PyObjectPtr *py_object,
                                   const char *eval_info_bytes);
 
+extern "C" void pythonx_handle_free_env(void *env);
+
+extern "C" int pythonx_handle_source_pull(void *channel, uint64_t size,
+                                          const char *eval_info_bytes);
+
+extern "C" int
+pythonx_handle_source_take(void *channel, pythonx::python::PyObjectPtr py_list);
+
 namespace pythonx {
 
 using namespace python;
@@ -125,6 +143,36 @@ public:
   }
 };
 
+// Temporarily releases the GIL held by the current thread, for the
+// lifetime of the guard object. This is the equivalent of the
+// `Py_BEGIN_ALLOW_THREADS` and `Py_END_ALLOW_THREADS` macros.
+//
+// Note that no Python API may be used while the guard is alive.
+class PyAllowThreadsGuard {
+  PyThreadStatePtr state;
+
+public:
+  PyAllowThreadsGuard() : state(PyEval_SaveThread()) {}
+
+  ~PyAllowThreadsGuard() { PyEval_RestoreThread(this->state); }
+};
+
+// Copies smaller than this are done with the GIL held, since releasing
+// and reacquiring the GIL would cost more than the copy itself.
+const size_t allow_threads_min_size = 1024 * 1024;
+
+// Copies memory between buffers, releasing the GIL if the copy is
+// large. The caller must hold the GIL and make sure both buffers stay
+// valid without it, for example by holding a buffer export.
+void copy_allow_threads(void *dest, const void *src, size_t size) {
+  if (size >= allow_threads_min_size) {
+    auto allow_threads_guard = PyAllowThreadsGuard();
+    std::memcpy(dest, src, size);
+  } else {
+    std::memcpy(dest, src, size);
+  }
+}
+
 void ensure_initialized() {
   auto init_guard = std::lock_guard<std::mutex>(init_mutex);
 
@@ -137,23 +185,198 @@ namespace atoms {
 auto ElixirPythonxError = fine::Atom("Elixir.Pythonx.Error");
 auto ElixirPythonxJanitor = fine::Atom("Elixir.Pythonx.Janitor");
 auto ElixirPythonxObject = fine::Atom("Elixir.Pythonx.Object");
+auto __struct__ = fine::Atom("__struct__");
 auto decref = fine::Atom("decref");
-auto integer = fine::Atom("integer");
+auto decref_many = fine::Atom("decref_many");
+auto handle = fine::Atom("handle");
+auto keep = fine::Atom("keep");
 auto lines = fine::Atom("lines");
 auto list = fine::Atom("list");
 auto map = fine::Atom("map");
 auto map_set = fine::Atom("map_set");
+auto memory_pressure = fine::Atom("memory_pressure");
 auto output = fine::Atom("output");
+auto pythonx_source_pull = fine::Atom("pythonx_source_pull");
 auto remote_info = fine::Atom("remote_info");
 auto resource = fine::Atom("resource");
+auto struct_ = fine::Atom("struct");
+auto summary = fine::Atom("summary");
 auto traceback = fine::Atom("traceback");
 auto tuple = fine::Atom("tuple");
 auto type = fine::Atom("type");
 auto value = fine::Atom("value");
 } // namespace atoms
 
+void send_to_janitor(ErlNifEnv *env, ErlNifEnv *msg_env, ERL_NIF_TERM msg) {
+  auto janitor_name = fine::encode(env, atoms::ElixirPythonxJanitor);
+  ErlNifPid janitor_pid;
+  if (enif_whereis_pid(env, janitor_name, &janitor_pid)) {
+    enif_send(env, &janitor_pid, msg_env, msg);
+  } else {
+    std::cerr << "[pythonx] whereis(Pythonx.Janitor) failed. This is "
+                 "unexpected and a Python object will not be deallocated"
+              << std::endl;
+  }
+}
+
+// Information about a live Python object referenced from Elixir.
+struct TrackedObject {
+  std::string type;
+  size_t bytes;
+  std::optional<std::string> tag;
+  std::chrono::steady_clock::time_point created_at;
+};
+
+struct TrackedStats {
+  uint64_t objects = 0;
+  uint64_t bytes = 0;
+};
+
+// Tracked objects aggregated per type and tag, see
+// Pythonx.memory_stats/1.
+struct TrackedSummary {
+  TrackedStats total;
+  std::unordered_map<std::string, TrackedStats> by_type;
+  std::unordered_map<std::optional<std::string>, TrackedStats> by_tag;
+  std::vector<TrackedObject> long_lived;
+};
+
+// Optional registry of live Python objects referenced from Elixir,
+// used by Pythonx.memory_stats/1. It is disabled by default, because
+// inspecting every object that crosses the boundary has a cost.
+//
+// Objects owned by a PyObjectResource are keyed by the resource
+// pointer, while objects owned by a group are keyed by their handle.
+class ObjectRegistry {
+public:
+  bool is_enabled() { return this->enabled; }
+
+  void set_enabled(bool enabled) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    this->enabled = enabled;
+
+    if (!enabled) {
+      this->resources.clear();
+      this->handles.clear();
+    }
+  }
+
+  void track_resource(const void *resource, TrackedObject object) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    if (this->enabled) {
+      this->resources.insert_or_assign(resource, std::move(object));
+    }
+  }
+
+  void track_handle(uint64_t handle, TrackedObject object) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    if (this->enabled) {
+      this->handles.insert_or_assign(handle, std::move(object));
+    }
+  }
+
+  void untrack_resource(const void *resource) {
+    if (!this->enabled) {
+      return;
+    }
+
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+    this->resources.erase(resource);
+  }
+
+  void untrack_handles(const std::vector<uint64_t> &handles) {
+    if (!this->enabled) {
+      return;
+    }
+
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+    for (auto handle : handles) {
+      this->handles.erase(handle);
+    }
+  }
+
+  std::optional<std::string> resource_tag(const void *resource) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    auto it = this->resources.find(resource);
+    return it == this->resources.end() ? std::nullopt : it->second.tag;
+  }
+
+  std::optional<std::string> handle_tag(uint64_t handle) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    auto it = this->handles.find(handle);
+    return it == this->handles.end() ? std::nullopt : it->second.tag;
+  }
+
+  // Aggregates the tracked objects. Only objects older than the given
+  // age are copied, so the summary size is proportional to the number
+  // of types and tags, rather than objects.
+  TrackedSummary summary(std::chrono::milliseconds long_lived_after) {
+    auto now = std::chrono::steady_clock::now();
+
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    auto summary = TrackedSummary();
+
+    auto add = [&](const TrackedObject &object) {
+      for (auto stats : {&summary.total, &summary.by_type[object.type],
+                         &summary.by_tag[object.tag]}) {
+        stats->objects++;
+        stats->bytes += object.bytes;
+      }
+
+      if (now - object.created_at >= long_lived_after) {
+        summary.long_lived.push_back(object);
+      }
+    };
+
+    for (const auto &[_, object] : this->resources) {
+      add(object);
+    }
+
+    for (const auto &[_, object] : this->handles) {
+      add(object);
+    }
+
+    return summary;
+  }
+
+private:
+  std::atomic<bool> enabled = false;
+  std::unordered_map<const void *, TrackedObject> resources;
+  std::unordered_map<uint64_t, TrackedObject> handles;
+  std::mutex mutex;
+};
+
+ObjectRegistry object_registry;
+
+// Tag assigned to tracked objects created by the current NIF call,
+// see ObjectTagGuard.
+thread_local std::optional<std::string> current_object_tag;
+
+// Sets the tag for tracked objects created within the guard scope.
+class ObjectTagGuard {
+public:
+  ObjectTagGuard(std::optional<std::string> tag) {
+    this->previous_tag = std::move(current_object_tag);
+    current_object_tag = std::move(tag);
+  }
+
+  ~ObjectTagGuard() { current_object_tag = std::move(this->previous_tag); }
+
+private:
+  std::optional<std::string> previous_tag;
+};
+
 struct PyObjectResource {
   PyObjectPtr py_object;
+  // Pinned resources are shared across many %Pythonx.Object{} structs
+  // (see PinnedObjects), so they are never released explicitly
+  bool pinned = false;
 
   PyObjectResource(PyObjectPtr py_object) : py_object(py_object) {}
 
@@ -164,30 +387,216 @@ struct PyObjectResource {
     //
     // [1]:https://erlangforums.com/t/how-to-deal-with-destructors-that-can-take-a-while-to-run-and-possibly-block-the-scheduler/4290
 
+    object_registry.untrack_resource(this);
+
     if (!is_initialized) {
       // If we allow multiple initializations, we need to add a counter
       // and check that py_object comes from the current initialization
       return;
     }
 
+    if (this->py_object == nullptr) {
+      // The object has already been released explicitly
+      return;
+    }
+
     auto ptr = reinterpret_cast<uint64_t>(this->py_object);
 
-    auto janitor_name = fine::encode(env, atoms::ElixirPythonxJanitor);
-    ErlNifPid janitor_pid;
-    if (enif_whereis_pid(env, janitor_name, &janitor_pid)) {
-      auto msg_env = enif_alloc_env();
-      auto msg = fine::encode(msg_env, std::make_tuple(atoms::decref, ptr));
-      enif_send(env, &janitor_pid, msg_env, msg);
-      enif_free_env(msg_env);
+    auto msg_env = enif_alloc_env();
+    auto msg = fine::encode(msg_env, std::make_tuple(atoms::decref, ptr));
+    send_to_janitor(env, msg_env, msg);
+    enif_free_env(msg_env);
+  }
+};
+
+FINE_RESOURCE(PyObjectResource);
+
+// A slab of Python objects addressed by handles.
+//
+// Container items returned by decode_once are not wrapped in individual
+// resources. Instead, they are stored in this table and owned by a
+// single PyObjectGroupResource, which releases all of them at once.
+// This way decoding a large container allocates a single resource,
+// rather than one per item.
+//
+// A handle packs the slot index and the slot generation. Generation
+// is bumped whenever a slot is freed, so that a stale handle (such
+// as one of an explicitly released object) is detected, instead of
+// pointing to whatever object reuses the slot.
+//
+// Each slot also records the group owning the object. Handles are
+// plain integers in %Pythonx.Object{}, so a struct could pair a group
+// with a handle of another group. Lookups check the owner, so that
+// such handle is treated the same as a stale one, rather than giving
+// access to an object the group does not keep alive.
+//
+// Freed slots are reused, so the table grows up to the peak number of
+// live items and never shrinks. All operations take a single mutex,
+// however they only do constant-time bookkeeping and never call into
+// Python, and groups insert and remove their items in batches.
+struct PyObjectGroupResource;
+
+class HandleTable {
+public:
+  // Stores the object and returns its handle. Steals the reference.
+  uint64_t insert(PyObjectPtr py_object, const PyObjectGroupResource *owner) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    uint32_t index;
+    if (this->free_indices.empty()) {
+      if (this->slots.size() > max_index) {
+        throw std::runtime_error("too many live Python objects");
+      }
+
+      index = static_cast<uint32_t>(this->slots.size());
+      this->slots.push_back(Slot{nullptr, nullptr, 0});
     } else {
-      std::cerr << "[pythonx] whereis(Pythonx.Janitor) failed. This is "
-                   "unexpected and a Python object will not be deallocated"
-                << std::endl;
+      index = this->free_indices.back();
+      this->free_indices.pop_back();
+    }
+
+    auto &slot = this->slots[index];
+    slot.py_object = py_object;
+    slot.owner = owner;
+
+    return make_handle(index, slot.generation);
+  }
+
+  // Returns the object for the given handle, or nullptr if the handle
+  // is stale or does not belong to the owner.
+  PyObjectPtr get(uint64_t handle, const PyObjectGroupResource *owner) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    auto slot = this->find_slot(handle, owner);
+    return slot == nullptr ? nullptr : slot->py_object;
+  }
+
+  // Removes the object from the table and returns it, or nullptr if
+  // the handle is stale or does not belong to the owner. The caller
+  // is responsible for decrementing the refcount.
+  PyObjectPtr take(uint64_t handle, const PyObjectGroupResource *owner) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+    return this->take_locked(handle, owner);
+  }
+
+  // Same as take, but for a batch of handles. Stale handles are
+  // skipped.
+  std::vector<PyObjectPtr> take_many(const std::vector<uint64_t> &handles,
+                                     const PyObjectGroupResource *owner) {
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    auto py_objects = std::vector<PyObjectPtr>();
+    py_objects.reserve(handles.size());
+
+    for (auto handle : handles) {
+      auto py_object = this->take_locked(handle, owner);
+      if (py_object != nullptr) {
+        py_objects.push_back(py_object);
+      }
+    }
+
+    return py_objects;
+  }
+
+private:
+  struct Slot {
+    PyObjectPtr py_object;
+    const PyObjectGroupResource *owner;
+    uint32_t generation;
+  };
+
+  // We keep handles within 56 bits, so that they are represented as
+  // small integers on the BEAM.
+  static constexpr uint32_t generation_mask = (1 << 24) - 1;
+  static constexpr uint32_t max_index = UINT32_MAX;
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> free_indices;
+  std::mutex mutex;
+
+  static uint64_t make_handle(uint32_t index, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | index;
+  }
+
+  Slot *find_slot(uint64_t handle, const PyObjectGroupResource *owner) {
+    auto index = static_cast<uint32_t>(handle);
+    auto generation = static_cast<uint32_t>(handle >> 32);
+
+    if (index >= this->slots.size()) {
+      return nullptr;
+    }
+
+    auto &slot = this->slots[index];
+    if (slot.generation != generation || slot.py_object == nullptr ||
+        slot.owner != owner) {
+      return nullptr;
+    }
+
+    return &slot;
+  }
+
+  PyObjectPtr take_locked(uint64_t handle,
+                          const PyObjectGroupResource *owner) {
+    auto slot = this->find_slot(handle, owner);
+    if (slot == nullptr) {
+      return nullptr;
     }
+
+    auto py_object = slot->py_object;
+    slot->py_object = nullptr;
+    slot->owner = nullptr;
+    slot->generation = (slot->generation + 1) & generation_mask;
+
+    // Once the generation wraps around, stale handles would match the
+    // slot again, so we retire it instead. This happens only after the
+    // slot has been reused 2^24 times, so the retired slots are a tiny
+    // fraction of the table.
+    if (slot->generation != 0) {
+      this->free_indices.push_back(static_cast<uint32_t>(handle));
+    }
+
+    return py_object;
   }
 };
 
-FINE_RESOURCE(PyObjectResource);
+HandleTable handle_table;
+
+// A resource owning a group of Python objects stored in the handle
+// table.
+struct PyObjectGroupResource {
+  std::vector<uint64_t> handles;
+
+  void destructor(ErlNifEnv *env) {
+    object_registry.untrack_handles(this->handles);
+
+    if (!is_initialized) {
+      return;
+    }
+
+    // Removing objects from the table does not require GIL, so we do
+    // it right away and send all the pointers to the janitor in a
+    // single message.
+    auto py_objects = handle_table.take_many(this->handles, this);
+    if (py_objects.empty()) {
+      return;
+    }
+
+    auto msg_env = enif_alloc_env();
+
+    auto size = py_objects.size() * sizeof(PyObjectPtr);
+    ERL_NIF_TERM ptrs;
+    auto data = enif_make_new_binary(msg_env, size, &ptrs);
+    std::memcpy(data, py_objects.data(), size);
+
+    auto msg =
+        fine::encode(msg_env, std::make_tuple(atoms::decref_many,
+                                              fine::Term(ptrs)));
+    send_to_janitor(env, msg_env, msg);
+    enif_free_env(msg_env);
+  }
+};
+
+FINE_RESOURCE(PyObjectGroupResource);
 
 // A resource that notifies the given process upon garbage collection.
 struct GCNotifier {
@@ -206,31 +615,253 @@ struct GCNotifier {
 
 FINE_RESOURCE(GCNotifier);
 
+// A channel through which Python pulls data from an Elixir process,
+// see Pythonx.Source.
+//
+// Python sends a pull request to the process and blocks, with the
+// GIL released, until the process replies via source_reply, or closes
+// the channel.
+struct SourceChannelResource {
+  enum class Reply { data, done, error };
+
+  ErlNifPid pid;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool closed = false;
+  bool has_reply = false;
+  Reply reply = Reply::done;
+  ErlNifEnv *reply_env;
+  ERL_NIF_TERM reply_term;
+
+  SourceChannelResource(ErlNifPid pid)
+      : pid(pid), reply_env(enif_alloc_env()) {}
+
+  void destructor(ErlNifEnv *env) { enif_free_env(this->reply_env); }
+};
+
+FINE_RESOURCE(SourceChannelResource);
+
+using ExObjectResource = std::variant<fine::ResourcePtr<PyObjectResource>,
+                                      fine::ResourcePtr<PyObjectGroupResource>>;
+
 struct ExObject {
-  fine::ResourcePtr<PyObjectResource> resource;
+  // Either a resource owning a single Python object, or a group
+  // resource, in which case handle identifies the object within
+  // the group. A group object without handle refers to the whole
+  // group and is only used internally.
+  ExObjectResource resource;
+  std::optional<uint64_t> handle;
   std::optional<fine::Term> remote_info;
 
   ExObject() {}
-  ExObject(fine::ResourcePtr<PyObjectResource> resource) : resource(resource) {}
+  ExObject(ExObjectResource resource,
+           std::optional<uint64_t> handle = std::nullopt)
+      : resource(resource), handle(handle) {}
+
+  // Returns the underlying Python object.
+  //
+  // Raises if the object has been explicitly released. Note that
+  // releasing requires the GIL, so the check is only meaningful
+  // when the GIL is held.
+  PyObjectPtr py_object() const {
+    PyObjectPtr py_object = nullptr;
+
+    if (auto resource =
+            std::get_if<fine::ResourcePtr<PyObjectResource>>(&this->resource)) {
+      py_object = (*resource)->py_object;
+    } else if (this->handle) {
+      auto group = std::get<fine::ResourcePtr<PyObjectGroupResource>>(
+          this->resource);
+      py_object = handle_table.get(*this->handle, group.get());
+    }
+
+    if (py_object == nullptr) {
+      throw std::invalid_argument(
+          "the Python object has already been released");
+    }
+
+    return py_object;
+  }
+
+  // Decrements the refcount of the underlying Python object and marks
+  // it as released. Releasing an object multiple times is a no-op.
+  //
+  // Requires GIL.
+  void release() const {
+    if (auto resource =
+            std::get_if<fine::ResourcePtr<PyObjectResource>>(&this->resource)) {
+      auto py_object = (*resource)->py_object;
+      if (py_object != nullptr && !(*resource)->pinned) {
+        (*resource)->py_object = nullptr;
+        object_registry.untrack_resource(resource->get());
+        Py_DecRef(py_object);
+      }
+    } else {
+      auto group = std::get<fine::ResourcePtr<PyObjectGroupResource>>(
+          this->resource);
+
+      auto handles =
+          this->handle ? std::vector<uint64_t>{*this->handle} : group->handles;
+
+      auto py_objects = handle_table.take_many(handles, group.get());
+
+      // Handles of other groups are not ours to untrack
+      if (!py_objects.empty()) {
+        object_registry.untrack_handles(handles);
+      }
+
+      for (auto py_object : py_objects) {
+        Py_DecRef(py_object);
+      }
+    }
+  }
+
+  // Returns the tag of the object, if tracked.
+  std::optional<std::string> tag() const {
+    if (auto resource =
+            std::get_if<fine::ResourcePtr<PyObjectResource>>(&this->resource)) {
+      return object_registry.resource_tag(resource->get());
+    } else if (this->handle) {
+      // Same as in py_object, the handle may belong to another group
+      auto group = std::get<fine::ResourcePtr<PyObjectGroupResource>>(
+          this->resource);
+      if (handle_table.get(*this->handle, group.get()) == nullptr) {
+        return std::nullopt;
+      }
+
+      return object_registry.handle_tag(*this->handle);
+    } else {
+      return std::nullopt;
+    }
+  }
 
   static constexpr auto module = &atoms::ElixirPythonxObject;
 
   static constexpr auto fields() {
     return std::make_tuple(
         std::make_tuple(&ExObject::resource, &atoms::resource),
+        std::make_tuple(&ExObject::handle, &atoms::handle),
         std::make_tuple(&ExObject::remote_info, &atoms::remote_info));
   }
 };
 
+// Objects created while a scope is open (see Pythonx.with_scope/1)
+// are collected in the scope and released once the scope ends. Each
+// process has its own stack of scopes, keyed by the PID bytes.
+using Scope = std::vector<ExObject>;
+std::map<std::string, std::vector<Scope>> process_scopes;
+std::mutex process_scopes_mutex;
+std::atomic<size_t> process_scopes_count = 0;
+
+std::string pid_key(ErlNifPid pid) {
+  return std::string(reinterpret_cast<const char *>(&pid), sizeof(ErlNifPid));
+}
+
+// Adds the object to the innermost scope of the calling process, if
+// any, see Pythonx.with_scope/1.
+void register_in_scope(ErlNifEnv *env, ExObject ex_object) {
+  // Most of the time there are no open scopes, so we check the count
+  // upfront to avoid locking.
+  if (process_scopes_count > 0 && env != nullptr) {
+    ErlNifPid pid;
+    if (enif_self(env, &pid) != NULL) {
+      auto guard = std::lock_guard<std::mutex>(process_scopes_mutex);
+
+      auto it = process_scopes.find(pid_key(pid));
+      if (it != process_scopes.end()) {
+        it->second.back().push_back(ex_object);
+      }
+    }
+  }
+}
+
+TrackedObject make_tracked_object(PyObjectPtr py_object);
+
+// Creates a new %Pythonx.Object{} for the given Python object.
+//
+// Note that this steals the reference, so the caller should incref
+// the object beforehand, if it is a borrowed reference.
+ExObject make_ex_object(ErlNifEnv *env, PyObjectPtr py_object) {
+  auto resource = fine::make_resource<PyObjectResource>(py_object);
+
+  if (object_registry.is_enabled()) {
+    object_registry.track_resource(resource.get(),
+                                   make_tracked_object(py_object));
+  }
+
+  auto ex_object = ExObject(resource);
+  register_in_scope(env, ex_object);
+  return ex_object;
+}
+
+// Creates a new group resource, see HandleTable.
+fine::ResourcePtr<PyObjectGroupResource> make_group(ErlNifEnv *env) {
+  auto group = fine::make_resource<PyObjectGroupResource>();
+  register_in_scope(env, ExObject(group));
+  return group;
+}
+
+// Creates a new %Pythonx.Object{} for the given Python object, owned
+// by the given group.
+//
+// Note that this steals the reference, same as make_ex_object.
+ExObject make_group_ex_object(fine::ResourcePtr<PyObjectGroupResource> group,
+                              PyObjectPtr py_object) {
+  auto handle = handle_table.insert(py_object, group.get());
+  group->handles.push_back(handle);
+
+  if (object_registry.is_enabled()) {
+    object_registry.track_handle(handle, make_tracked_object(py_object));
+  }
+
+  return ExObject(group, handle);
+}
+
+// Creates a new %Pythonx.Object{} that is never released, see
+// PyObjectResource::pinned. Pinned objects are meant to be shared, so
+// they are neither tracked nor registered in scopes.
+//
+// Note that this steals the reference, same as make_ex_object.
+ExObject make_pinned_ex_object(PyObjectPtr py_object) {
+  auto resource = fine::make_resource<PyObjectResource>(py_object);
+  resource->pinned = true;
+  return ExObject(resource);
+}
+
+// Preallocated objects for None, True, False and small integers. All
+// of them are immutable, so a single resource can be shared, instead
+// of allocating a new one for every encoded value.
+//
+// Created once the interpreter is initialized and never freed.
+struct PinnedObjects {
+  static constexpr int64_t min_small_int = -5;
+  static constexpr int64_t max_small_int = 256;
+
+  ExObject none;
+  ExObject true_;
+  ExObject false_;
+  std::vector<ExObject> small_ints;
+
+  std::optional<ExObject> small_int(int64_t number) const {
+    if (number < min_small_int || number > max_small_int) {
+      return std::nullopt;
+    }
+
+    return this->small_ints[number - min_small_int];
+  }
+};
+
+PinnedObjects *pinned_objects = nullptr;
+
 struct ExError {
-  std::vector<fine::Term> lines;
+  std::optional<std::vector<fine::Term>> lines;
   ExObject type;
   ExObject value;
   ExObject traceback;
 
   ExError() {}
-  ExError(std::vector<fine::Term> lines, ExObject type, ExObject value,
-          ExObject traceback)
+  ExError(std::optional<std::vector<fine::Term>> lines, ExObject type,
+          ExObject value, ExObject traceback)
       : lines(lines), type(type), value(value), traceback(traceback) {}
 
   static constexpr auto module = &atoms::ElixirPythonxError;
@@ -257,6 +888,37 @@ std::vector<fine::Term> py_error_lines(ErlNifEnv *env, PyObjectPtr py_type,
                                        PyObjectPtr py_value,
                                        PyObjectPtr py_traceback);
 
+void py_clear_traceback_frames(PyObjectPtr py_value, PyObjectPtr py_traceback,
+                               bool drop);
+
+// Options affecting how Python errors are converted to Pythonx.Error,
+// set for the duration of a NIF call with ErrorOptionsGuard.
+struct ErrorOptions {
+  // Whether to format the traceback lines right away. Otherwise the
+  // lines are formatted only when the error message is requested.
+  bool eager_lines = false;
+
+  // What to keep from the traceback, see the :traceback option in
+  // Pythonx.eval/3.
+  enum class Traceback { keep, clear_frames, summary };
+  Traceback traceback = Traceback::clear_frames;
+};
+
+thread_local ErrorOptions current_error_options;
+
+class ErrorOptionsGuard {
+public:
+  ErrorOptionsGuard(ErrorOptions options) {
+    this->previous_options = current_error_options;
+    current_error_options = options;
+  }
+
+  ~ErrorOptionsGuard() { current_error_options = this->previous_options; }
+
+private:
+  ErrorOptions previous_options;
+};
+
 ExError build_py_error_from_current(ErlNifEnv *env) {
   PyObjectPtr py_type, py_value, py_traceback;
   PyErr_Fetch(&py_type, &py_value, &py_traceback);
@@ -272,12 +934,36 @@ ExError build_py_error_from_current(ErlNifEnv *env) {
   py_value = py_value == NULL ? Py_BuildValue("") : py_value;
   py_traceback = py_traceback == NULL ? Py_BuildValue("") : py_traceback;
 
-  auto lines = py_error_lines(env, py_type, py_value, py_traceback);
+  // Formatting involves importing the traceback module and building
+  // a binary per line, which is wasteful if the error is rescued and
+  // the message is never used, so we do it lazily by default.
+  auto traceback_option = current_error_options.traceback;
+
+  auto lines = std::optional<std::vector<fine::Term>>();
+  if (current_error_options.eager_lines ||
+      traceback_option == ErrorOptions::Traceback::summary) {
+    lines = py_error_lines(env, py_type, py_value, py_traceback);
+  }
+
+  // Traceback frames reference all their local variables, which may
+  // be large objects, so unless requested otherwise, we clear them.
+  // This is best-effort, so we ignore the result.
+  if (traceback_option != ErrorOptions::Traceback::keep) {
+    auto drop = traceback_option == ErrorOptions::Traceback::summary;
+
+    py_clear_traceback_frames(py_value, py_traceback, drop);
+
+    if (drop) {
+      Py_DecRef(py_traceback);
+      py_traceback = Py_BuildValue("");
+    }
+  }
+
   auto type = fine::make_resource<PyObjectResource>(py_type);
   auto value = fine::make_resource<PyObjectResource>(py_value);
   auto traceback = fine::make_resource<PyObjectResource>(py_traceback);
 
-  return ExError(lines, type, value, traceback);
+  return ExError(lines, ExObject(type), ExObject(value), ExObject(traceback));
 }
 
 void raise_py_error(ErlNifEnv *env) {
@@ -302,796 +988,4656 @@ void raise_if_failed(ErlNifEnv *env, Py_ssize_t size) {
   }
 }
 
-ERL_NIF_TERM py_str_to_binary_term(ErlNifEnv *env, PyObjectPtr py_object) {
-  Py_ssize_t size;
-  auto buffer = PyUnicode_AsUTF8AndSize(py_object, &size);
-  raise_if_failed(env, buffer);
+// Borrowed references to the built-in types, so that traversals can
+// look them up only once.
+struct PyBuiltinTypes {
+  PyObjectPtr int_type;
+  PyObjectPtr float_type;
+  PyObjectPtr tuple_type;
+  PyObjectPtr list_type;
+  PyObjectPtr dict_type;
+  PyObjectPtr str_type;
+  PyObjectPtr bytes_type;
+  PyObjectPtr bytearray_type;
+  PyObjectPtr set_type;
+  PyObjectPtr frozenset_type;
+  PyObjectPtr memoryview_type;
+  PyObjectPtr range_type;
+};
 
-  // The buffer is immutable and lives as long as the Python object,
-  // so we create the term as a resource binary to make it zero-copy.
-  Py_IncRef(py_object);
-  auto ex_object_resource = fine::make_resource<PyObjectResource>(py_object);
-  return fine::make_resource_binary(env, ex_object_resource, buffer, size);
-}
+// New references to the datetime and decimal types.
+struct PyCalendarTypes {
+  PyObjectPtr date_type;
+  PyObjectPtr time_type;
+  PyObjectPtr datetime_type;
+  PyObjectPtr timezone_type;
+  PyObjectPtr timedelta_type;
+  PyObjectPtr utc;
+  PyObjectPtr zone_info_type;
+  PyObjectPtr decimal_type;
+};
 
-ERL_NIF_TERM py_bytes_to_binary_term(ErlNifEnv *env, PyObjectPtr py_object) {
-  Py_ssize_t size;
-  char *buffer;
-  auto result = PyBytes_AsStringAndSize(py_object, &buffer, &size);
-  raise_if_failed(env, result);
+// New references to modules, functions and strings used on hot paths,
+// such as evaluation and error formatting. They are resolved on init,
+// see init_py_cache, and kept for the lifetime of the interpreter, so
+// that we avoid repeated imports, attribute lookups and string
+// allocations.
+struct PyCache {
+  PyObjectPtr pythonx_PID;
+  PyObjectPtr pythonx_elixir_source;
+  PyObjectPtr pythonx_struct_fields;
+  PyObjectPtr pythonx_memory_size;
+  PyObjectPtr pythonx_data_memory_size;
+  PyObjectPtr pythonx_type_name;
+  PyObjectPtr pythonx_clear_traceback_frames;
+  PyObjectPtr int_from_bytes;
+  PyObjectPtr traceback_format_exception;
+  PyObjectPtr ast_parse;
+  PyObjectPtr ast_Expr;
+  PyObjectPtr ast_Expression;
+  PyObjectPtr types_ModuleType;
+  PyObjectPtr pickle_dumps;
+  PyObjectPtr pickle_loads;
+  PyObjectPtr array_array;
+  // Interned strings
+  PyObjectPtr string_filename;
+  PyObjectPtr string_exec;
+  PyObjectPtr string_eval;
+  PyObjectPtr string_main;
+  // Types
+  PyObjectPtr binary_buffer_type;
+  PyBuiltinTypes builtin_types;
+  PyCalendarTypes calendar_types;
+};
 
-  // The buffer is immutable and lives as long as the Python object,
-  // so we create the term as a resource binary to make it zero-copy.
-  Py_IncRef(py_object);
-  auto ex_object_resource = fine::make_resource<PyObjectResource>(py_object);
-  return fine::make_resource_binary(env, ex_object_resource, buffer, size);
-}
+// Set by init, while holding init_mutex. All other NIFs wait for the
+// mutex in ensure_initialized, so they never see a partial cache.
+std::optional<PyCache> py_cache;
 
-std::vector<fine::Term> py_error_lines(ErlNifEnv *env, PyObjectPtr py_type,
-                                       PyObjectPtr py_value,
+const PyCache &get_py_cache(ErlNifEnv *env) {
+  if (!py_cache) {
+    throw std::runtime_error("Python interpreter has not been initialized");
+  }
+
+  return *py_cache;
+}
+
+const PyBuiltinTypes &get_builtin_types(ErlNifEnv *env) {
+  return get_py_cache(env).builtin_types;
+}
+
+const PyCalendarTypes &get_calendar_types(ErlNifEnv *env) {
+  return get_py_cache(env).calendar_types;
+}
+
+// Python strings for atoms, shared across all encodings of the same
+// atom. The strings are interned, so they also share memory with the
+// identifiers and attribute names on the Python side.
+//
+// There are two levels of caching. Atoms encoded via the protocol are
+// mapped to a pinned resource, which is looked up without the GIL.
+// Atoms read in bulk (see PyTermReader) are mapped to the string only,
+// by name.
+//
+// The table is bounded, once full, atoms get new strings as usual.
+class AtomTable {
+public:
+  // Returns the object for the given atom, creating it on first use.
+  ExObject get(ErlNifEnv *env, ERL_NIF_TERM atom) {
+    {
+      auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+      auto it = this->objects.find(atom);
+      if (it != this->objects.end()) {
+        return it->second;
+      }
+    }
+
+    auto name = fine::decode<fine::Atom>(env, atom).to_string();
+
+    auto gil_guard = PyGILGuard();
+
+    auto py_string = this->py_string(env, name);
+
+    auto guard = std::lock_guard<std::mutex>(this->mutex);
+
+    if (this->objects.size() >= max_size) {
+      return make_ex_object(env, py_string);
+    }
+
+    // Another thread may have inserted the atom in the meantime, in
+    // which case the existing object is kept
+    auto ex_object = make_pinned_ex_object(py_string);
+    return this->objects.try_emplace(atom, ex_object).first->second;
+  }
+
+  // Returns a new reference to the string for the given atom name.
+  //
+  // Requires GIL.
+  PyObjectPtr py_string(ErlNifEnv *env, const std::string &name) {
+    auto it = this->py_strings.find(name);
+    if (it != this->py_strings.end()) {
+      Py_IncRef(it->second);
+      return it->second;
+    }
+
+    auto py_string = PyUnicode_FromStringAndSize(name.data(), name.size());
+    raise_if_failed(env, py_string);
+
+    if (this->py_strings.size() >= max_size) {
+      return py_string;
+    }
+
+    // Note that this may replace the string with an already interned
+    // one, taking care of the references
+    PyUnicode_InternInPlace(&py_string);
+
+    Py_IncRef(py_string);
+    this->py_strings.emplace(name, py_string);
+    return py_string;
+  }
+
+private:
+  static constexpr size_t max_size = 65536;
+
+  // Guards objects, py_strings is guarded by the GIL
+  std::mutex mutex;
+  std::unordered_map<ERL_NIF_TERM, ExObject> objects;
+  std::unordered_map<std::string, PyObjectPtr> py_strings;
+};
+
+// The table holds Python references, which must not be released on
+// exit, so it is intentionally never freed.
+auto &atom_table = *new AtomTable();
+
+ERL_NIF_TERM py_str_to_binary_term(ErlNifEnv *env, PyObjectPtr py_object) {
+  Py_ssize_t size;
+  auto buffer = PyUnicode_AsUTF8AndSize(py_object, &size);
+  raise_if_failed(env, buffer);
+
+  // The buffer is immutable and lives as long as the Python object,
+  // so we create the term as a resource binary to make it zero-copy.
+  Py_IncRef(py_object);
+  auto ex_object_resource = fine::make_resource<PyObjectResource>(py_object);
+  return fine::make_resource_binary(env, ex_object_resource, buffer, size);
+}
+
+ERL_NIF_TERM py_bytes_to_binary_term(ErlNifEnv *env, PyObjectPtr py_object) {
+  Py_ssize_t size;
+  char *buffer;
+  auto result = PyBytes_AsStringAndSize(py_object, &buffer, &size);
+  raise_if_failed(env, result);
+
+  // The buffer is immutable and lives as long as the Python object,
+  // so we create the term as a resource binary to make it zero-copy.
+  Py_IncRef(py_object);
+  auto ex_object_resource = fine::make_resource<PyObjectResource>(py_object);
+  return fine::make_resource_binary(env, ex_object_resource, buffer, size);
+}
+
+// Copies a strided buffer into contiguous memory, in C order.
+//
+// This does not use any Python API, so it can run without the GIL.
+void copy_strided(const Py_buffer &buffer, int dim, const char *src,
+                  char *&dest) {
+  auto itemsize = static_cast<size_t>(buffer.itemsize);
+
+  if (dim == buffer.ndim) {
+    std::memcpy(dest, src, itemsize);
+    dest += itemsize;
+    return;
+  }
+
+  auto length = buffer.shape[dim];
+  auto stride = buffer.strides[dim];
+
+  if (dim == buffer.ndim - 1 && stride == buffer.itemsize) {
+    // The innermost dimension is contiguous, so we copy it at once
+    std::memcpy(dest, src, length * itemsize);
+    dest += length * itemsize;
+    return;
+  }
+
+  for (Py_ssize_t i = 0; i < length; i++) {
+    copy_strided(buffer, dim + 1, src + i * stride, dest);
+  }
+}
+
+// Returns whether the object buffer is known to never change, which
+// is the case for bytes and memoryviews over bytes.
+//
+// The readonly flag of the buffer is not enough, since a read-only
+// buffer may still be backed by writable memory, for example a numpy
+// array with the writeable flag unset, or memoryview.toreadonly() of
+// a bytearray.
+//
+// Requires GIL.
+bool py_is_immutable_buffer(ErlNifEnv *env, PyObjectPtr py_object) {
+  auto &types = get_builtin_types(env);
+  auto py_bytes_type = types.bytes_type;
+  auto py_memoryview_type = types.memoryview_type;
+
+  auto py_type = PyObject_Type(py_object);
+  raise_if_failed(env, py_type);
+  Py_DecRef(py_type);
+
+  if (py_type == py_bytes_type) {
+    return true;
+  }
+
+  if (py_type != py_memoryview_type) {
+    return false;
+  }
+
+  // The underlying object of a memoryview is the original exporter,
+  // even for views of other memoryviews
+  auto py_obj = PyObject_GetAttrString(py_object, "obj");
+  raise_if_failed(env, py_obj);
+  auto py_obj_guard = PyDecRefGuard(py_obj);
+
+  auto py_obj_type = PyObject_Type(py_obj);
+  raise_if_failed(env, py_obj_type);
+  Py_DecRef(py_obj_type);
+
+  return py_obj_type == py_bytes_type;
+}
+
+ERL_NIF_TERM py_buffer_to_binary_term(ErlNifEnv *env, PyObjectPtr py_object,
+                                      bool share_writable) {
+  // We wrap the object in a memoryview, which holds onto the object
+  // buffer for as long as it is alive, so we can keep the memoryview
+  // around to back a resource binary.
+  auto py_memoryview = PyMemoryView_FromObject(py_object);
+  raise_if_failed(env, py_memoryview);
+  auto py_memoryview_guard = PyDecRefGuard(py_memoryview);
+
+  auto immutable = py_is_immutable_buffer(env, py_object);
+
+  auto buffer = Py_buffer{};
+  if (PyObject_GetBuffer(py_memoryview, &buffer, PyBUF_SIMPLE) == -1) {
+    // The buffer is not C-contiguous, so we need to copy it anyway
+    PyErr_Clear();
+
+    if (PyObject_GetBuffer(py_memoryview, &buffer, PyBUF_STRIDES) == 0) {
+      ERL_NIF_TERM binary_term;
+      auto dest = reinterpret_cast<char *>(
+          enif_make_new_binary(env, buffer.len, &binary_term));
+      if (dest == NULL) {
+        PyBuffer_Release(&buffer);
+        throw std::runtime_error("failed to allocate a binary");
+      }
+      auto src = reinterpret_cast<const char *>(buffer.buf);
+
+      // Our buffer export prevents the memory from being resized or
+      // freed, however other threads may still write to it, so we
+      // only release the GIL when copying immutable buffers.
+      if (immutable &&
+          static_cast<size_t>(buffer.len) >= allow_threads_min_size) {
+        auto allow_threads_guard = PyAllowThreadsGuard();
+        copy_strided(buffer, 0, src, dest);
+      } else {
+        copy_strided(buffer, 0, src, dest);
+      }
+
+      PyBuffer_Release(&buffer);
+      return binary_term;
+    }
+
+    // The buffer uses suboffsets, so we let Python do the copy
+    PyErr_Clear();
+
+    auto py_tobytes = PyObject_GetAttrString(py_memoryview, "tobytes");
+    raise_if_failed(env, py_tobytes);
+    auto py_tobytes_guard = PyDecRefGuard(py_tobytes);
+
+    auto py_bytes = PyObject_CallNoArgs(py_tobytes);
+    raise_if_failed(env, py_bytes);
+    auto py_bytes_guard = PyDecRefGuard(py_bytes);
+
+    return py_bytes_to_binary_term(env, py_bytes);
+  }
+
+  auto data = reinterpret_cast<const char *>(buffer.buf);
+  auto size = static_cast<size_t>(buffer.len);
+
+  // The memoryview keeps its own export of the underlying buffer, so
+  // the data stays valid after we release our view.
+  PyBuffer_Release(&buffer);
+
+  if (!share_writable && !immutable) {
+    // The buffer may be mutated, while binaries must be immutable, so
+    // we copy it. We keep the GIL, so that Python code in other threads
+    // cannot write to the buffer in the middle of the copy.
+    ERL_NIF_TERM binary_term;
+    auto binary_data = enif_make_new_binary(env, size, &binary_term);
+    if (binary_data == NULL) {
+      throw std::runtime_error("failed to allocate a binary");
+    }
+    std::memcpy(binary_data, data, size);
+    return binary_term;
+  }
+
+  Py_IncRef(py_memoryview);
+  auto ex_object_resource =
+      fine::make_resource<PyObjectResource>(py_memoryview);
+  return fine::make_resource_binary(env, ex_object_resource, data, size);
+}
+
+// Element type of a packed numeric array.
+struct ArrayType {
+  std::string name;
+  // The corresponding Python array.array typecode
+  char typecode;
+  // One of 'u' (unsigned integer), 's' (signed integer) or 'f' (float)
+  char kind;
+  size_t size;
+};
+
+ArrayType get_array_type(fine::Atom type) {
+  auto name = type.to_string();
+
+  static const std::vector<ArrayType> array_types = {
+      {"u8", 'B', 'u', 1},  {"u16", 'H', 'u', 2}, {"u32", 'I', 'u', 4},
+      {"u64", 'Q', 'u', 8}, {"s8", 'b', 's', 1},  {"s16", 'h', 's', 2},
+      {"s32", 'i', 's', 4}, {"s64", 'q', 's', 8}, {"f32", 'f', 'f', 4},
+      {"f64", 'd', 'f', 8}};
+
+  for (const auto &array_type : array_types) {
+    if (array_type.name == name) {
+      return array_type;
+    }
+  }
+
+  throw std::invalid_argument("unsupported array type: " + name);
+}
+
+// Writes the lowest bytes of value at dest, as an item of the given
+// size. For signed values this gives their two's complement.
+void store_bits(size_t size, uint64_t value, uint8_t *dest) {
+  switch (size) {
+  case 1: {
+    auto item = static_cast<uint8_t>(value);
+    std::memcpy(dest, &item, sizeof(item));
+    break;
+  }
+  case 2: {
+    auto item = static_cast<uint16_t>(value);
+    std::memcpy(dest, &item, sizeof(item));
+    break;
+  }
+  case 4: {
+    auto item = static_cast<uint32_t>(value);
+    std::memcpy(dest, &item, sizeof(item));
+    break;
+  }
+  default:
+    std::memcpy(dest, &value, sizeof(value));
+  }
+}
+
+// Stores a float value at dest. Returns false if the array type is
+// not a float type.
+bool store_float(const ArrayType &type, double value, uint8_t *dest) {
+  if (type.kind != 'f') {
+    return false;
+  }
+
+  if (type.size == 4) {
+    auto item = static_cast<float>(value);
+    std::memcpy(dest, &item, sizeof(item));
+  } else {
+    std::memcpy(dest, &value, sizeof(value));
+  }
+
+  return true;
+}
+
+// Stores an integer value at dest. Returns false if the value is out
+// of range for the array type.
+bool store_signed(const ArrayType &type, int64_t value, uint8_t *dest) {
+  if (type.kind == 'f') {
+    return store_float(type, static_cast<double>(value), dest);
+  }
+
+  auto bits = type.size * 8;
+
+  if (type.kind == 'u') {
+    if (value < 0 || (bits < 64 && value >> bits != 0)) {
+      return false;
+    }
+  } else if (bits < 64) {
+    auto max = (static_cast<int64_t>(1) << (bits - 1)) - 1;
+    if (value < -max - 1 || value > max) {
+      return false;
+    }
+  }
+
+  store_bits(type.size, static_cast<uint64_t>(value), dest);
+  return true;
+}
+
+bool store_unsigned(const ArrayType &type, uint64_t value, uint8_t *dest) {
+  if (type.kind == 'f') {
+    return store_float(type, static_cast<double>(value), dest);
+  }
+
+  auto bits = type.size * 8;
+  auto value_bits = type.kind == 's' ? bits - 1 : bits;
+
+  if (value_bits < 64 && value >> value_bits != 0) {
+    return false;
+  }
+
+  store_bits(type.size, value, dest);
+  return true;
+}
+
+[[noreturn]] void raise_array_item_error(const ArrayType &type,
+                                         size_t index) {
+  throw std::invalid_argument("item at index " + std::to_string(index) +
+                              " is not a valid :" + type.name + " value");
+}
+
+// Packs an Erlang list of numbers into a native buffer.
+//
+// This does not touch any Python objects, so it is called without
+// holding the GIL.
+std::vector<uint8_t> pack_numbers(ErlNifEnv *env, ERL_NIF_TERM list,
+                                  const ArrayType &type) {
+  unsigned int length;
+  if (!enif_get_list_length(env, list, &length)) {
+    throw std::invalid_argument("expected a list or a binary");
+  }
+
+  auto packed = std::vector<uint8_t>(length * type.size);
+
+  ERL_NIF_TERM head;
+  for (size_t index = 0; enif_get_list_cell(env, list, &head, &list);
+       index++) {
+    auto dest = packed.data() + index * type.size;
+
+    double float_value;
+    ErlNifSInt64 signed_value;
+    ErlNifUInt64 unsigned_value;
+
+    auto stored = false;
+
+    if (enif_get_double(env, head, &float_value)) {
+      stored = store_float(type, float_value, dest);
+    } else if (enif_get_int64(env, head, &signed_value)) {
+      stored = store_signed(type, signed_value, dest);
+    } else if (enif_get_uint64(env, head, &unsigned_value)) {
+      stored = store_unsigned(type, unsigned_value, dest);
+    }
+
+    if (!stored) {
+      raise_array_item_error(type, index);
+    }
+  }
+
+  return packed;
+}
+
+struct IodataFragment {
+  // Points to binary data, or NULL for a run of byte list items
+  const uint8_t *data;
+  size_t size;
+};
+
+// Collects fragments of the given iodata, without copying binaries.
+// Byte list items are gathered into the bytes vector.
+//
+// Returns the total iodata size.
+size_t collect_iodata(ErlNifEnv *env, ERL_NIF_TERM term,
+                      std::vector<IodataFragment> &fragments,
+                      std::vector<uint8_t> &bytes) {
+  auto size = static_cast<size_t>(0);
+  auto stack = std::vector<ERL_NIF_TERM>{term};
+
+  while (!stack.empty()) {
+    auto term = stack.back();
+    stack.pop_back();
+
+    ErlNifBinary binary;
+    ERL_NIF_TERM head, tail;
+    ErlNifUInt64 byte;
+
+    if (enif_inspect_binary(env, term, &binary)) {
+      if (binary.size > 0) {
+        fragments.push_back(IodataFragment{binary.data, binary.size});
+        size += binary.size;
+      }
+    } else if (enif_get_list_cell(env, term, &head, &tail)) {
+      stack.push_back(tail);
+
+      if (enif_get_uint64(env, head, &byte)) {
+        if (byte > 255) {
+          throw std::invalid_argument("expected iodata");
+        }
+
+        if (fragments.empty() || fragments.back().data != NULL) {
+          fragments.push_back(IodataFragment{NULL, 0});
+        }
+
+        fragments.back().size++;
+        bytes.push_back(static_cast<uint8_t>(byte));
+        size++;
+      } else {
+        stack.push_back(head);
+      }
+    } else if (!enif_is_list(env, term)) {
+      // The only remaining list is an empty list, anything else is
+      // not valid iodata
+      throw std::invalid_argument("expected iodata");
+    }
+  }
+
+  return size;
+}
+
+// Copies collected iodata fragments into the given buffer.
+void copy_iodata(const std::vector<IodataFragment> &fragments,
+                 const std::vector<uint8_t> &bytes, uint8_t *dest) {
+  auto bytes_data = bytes.data();
+
+  for (const auto &fragment : fragments) {
+    auto data = fragment.data;
+
+    if (data == NULL) {
+      data = bytes_data;
+      bytes_data += fragment.size;
+    }
+
+    std::memcpy(dest, data, fragment.size);
+    dest += fragment.size;
+  }
+}
+
+// Checks if the buffer items have exactly the given array type, so
+// that the buffer can be used as is.
+bool buffer_matches_array_type(const Py_buffer &buffer,
+                               const ArrayType &type) {
+  if (buffer.itemsize != static_cast<Py_ssize_t>(type.size)) {
+    return false;
+  }
+
+  // When no format is given, the items are unsigned bytes
+  const char *format = buffer.format == NULL ? "B" : buffer.format;
+
+  uint16_t endianness_probe = 1;
+  auto little_endian = *reinterpret_cast<uint8_t *>(&endianness_probe) == 1;
+
+  if (format[0] == '@' || format[0] == '=' ||
+      (format[0] == '<' && little_endian) ||
+      ((format[0] == '>' || format[0] == '!') && !little_endian)) {
+    format++;
+  }
+
+  if (format[0] == '\0' || format[1] != '\0') {
+    return false;
+  }
+
+  // The itemsize is already checked, so we only look at the kind
+  switch (type.kind) {
+  case 'u':
+    return std::strchr("BHILQN", format[0]) != NULL;
+  case 's':
+    return std::strchr("bhilqn", format[0]) != NULL;
+  default:
+    return std::strchr("fd", format[0]) != NULL;
+  }
+}
+
+// Converts a Python number into the given array type and stores it
+// at dest. Returns false if a Python error is set.
+bool store_py_number(const ArrayType &type, PyObjectPtr py_object,
+                     uint8_t *dest, size_t index) {
+  if (type.kind == 'f') {
+    auto value = PyFloat_AsDouble(py_object);
+    if (value == -1.0 && PyErr_Occurred() != NULL) {
+      return false;
+    }
+    return store_float(type, value, dest);
+  }
+
+  int overflow;
+  auto value = PyLong_AsLongLongAndOverflow(py_object, &overflow);
+  if (value == -1 && PyErr_Occurred() != NULL) {
+    return false;
+  }
+
+  auto stored = false;
+
+  if (overflow == 0) {
+    stored = store_signed(type, value, dest);
+  } else if (overflow == 1 && type.kind == 'u') {
+    auto unsigned_value = PyLong_AsUnsignedLongLong(py_object);
+    if (unsigned_value == static_cast<unsigned long long>(-1) &&
+        PyErr_Occurred() != NULL) {
+      PyErr_Clear();
+    } else {
+      stored = store_unsigned(type, unsigned_value, dest);
+    }
+  }
+
+  if (!stored) {
+    raise_array_item_error(type, index);
+  }
+
+  return true;
+}
+
+// Negates a little-endian two's complement number in place.
+void negate_twos_complement(std::vector<uint8_t> &bytes) {
+  unsigned int carry = 1;
+
+  for (auto &byte : bytes) {
+    auto value = static_cast<unsigned int>(static_cast<uint8_t>(~byte)) + carry;
+    byte = static_cast<uint8_t>(value);
+    carry = value >> 8;
+  }
+}
+
+// Converts a Python integer into its sign and magnitude, where the
+// magnitude is given as little-endian bytes. This is the same layout
+// as Erlang uses for big integers, so the conversion is linear.
+std::vector<uint8_t> py_long_to_magnitude(ErlNifEnv *env,
+                                          PyObjectPtr py_object,
+                                          bool &negative) {
+  auto py_bit_length = PyObject_GetAttrString(py_object, "bit_length");
+  raise_if_failed(env, py_bit_length);
+  auto py_bit_length_guard = PyDecRefGuard(py_bit_length);
+
+  auto py_bits = PyObject_CallNoArgs(py_bit_length);
+  raise_if_failed(env, py_bits);
+  auto py_bits_guard = PyDecRefGuard(py_bits);
+
+  int overflow;
+  auto bits = PyLong_AsLongLongAndOverflow(py_bits, &overflow);
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  // We use the signed representation, so we need an extra bit for
+  // the sign
+  auto size = static_cast<Py_ssize_t>(bits / 8 + 1);
+
+  auto py_to_bytes = PyObject_GetAttrString(py_object, "to_bytes");
+  raise_if_failed(env, py_to_bytes);
+  auto py_to_bytes_guard = PyDecRefGuard(py_to_bytes);
+
+  auto py_args = Py_BuildValue("(ns)", size, "little");
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_kwargs = Py_BuildValue("{s:i}", "signed", 1);
+  raise_if_failed(env, py_kwargs);
+  auto py_kwargs_guard = PyDecRefGuard(py_kwargs);
+
+  auto py_bytes = PyObject_Call(py_to_bytes, py_args, py_kwargs);
+  raise_if_failed(env, py_bytes);
+  auto py_bytes_guard = PyDecRefGuard(py_bytes);
+
+  char *buffer;
+  Py_ssize_t buffer_size;
+  auto result = PyBytes_AsStringAndSize(py_bytes, &buffer, &buffer_size);
+  raise_if_failed(env, result);
+
+  auto bytes = std::vector<uint8_t>(buffer, buffer + buffer_size);
+
+  negative = !bytes.empty() && (bytes.back() & 0x80) != 0;
+  if (negative) {
+    negate_twos_complement(bytes);
+  }
+
+  while (!bytes.empty() && bytes.back() == 0) {
+    bytes.pop_back();
+  }
+
+  return bytes;
+}
+
+// Creates a Python integer from sign and little-endian magnitude, see
+// py_long_to_magnitude.
+//
+// Returns a new reference.
+PyObjectPtr py_long_from_magnitude(ErlNifEnv *env, const uint8_t *data,
+                                   size_t size, bool negative) {
+  // We add an extra zero byte, so that the magnitude is a valid
+  // non-negative number in two's complement
+  auto bytes = std::vector<uint8_t>(data, data + size);
+  bytes.push_back(0);
+
+  if (negative) {
+    negate_twos_complement(bytes);
+  }
+
+  auto py_bytes = PyBytes_FromStringAndSize(
+      reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  raise_if_failed(env, py_bytes);
+  auto py_bytes_guard = PyDecRefGuard(py_bytes);
+
+  auto py_args = Py_BuildValue("(Os)", py_bytes, "little");
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_kwargs = Py_BuildValue("{s:i}", "signed", 1);
+  raise_if_failed(env, py_kwargs);
+  auto py_kwargs_guard = PyDecRefGuard(py_kwargs);
+
+  auto py_long =
+      PyObject_Call(get_py_cache(env).int_from_bytes, py_args, py_kwargs);
+  raise_if_failed(env, py_long);
+
+  return py_long;
+}
+
+bool py_is_instance(ErlNifEnv *env, PyObjectPtr py_object,
+                    PyObjectPtr py_type) {
+  auto result = PyObject_IsInstance(py_object, py_type);
+  raise_if_failed(env, result);
+  return result == 1;
+}
+
+// A read-only buffer exporter backed by an Erlang binary. The binary
+// is kept alive by a separate env, which is freed when the object is
+// deallocated. Memoryviews, including the ones derived via slicing,
+// reference the exporter, so the memory stays valid as long as any
+// view exists. Unlike exposing a raw address via ctypes, there
+// is no object that would give write access to the memory.
+//
+// The fields are stored right after the object header. The header
+// layout is not part of the limited API and differs across builds,
+// for example free-threaded and Py_TRACE_REFS builds have extra
+// fields, so we determine its size at runtime, see
+// make_binary_buffer_type.
+struct PyBinaryBuffer {
+  ErlNifEnv *env;
+  char *data;
+  Py_ssize_t size;
+};
+
+size_t binary_buffer_offset = 0;
+
+PyBinaryBuffer *get_binary_buffer(PyObjectPtr py_self) {
+  return reinterpret_cast<PyBinaryBuffer *>(reinterpret_cast<char *>(py_self) +
+                                            binary_buffer_offset);
+}
+
+int binary_buffer_getbuffer(PyObjectPtr py_self, Py_buffer *view, int flags) {
+  auto self = get_binary_buffer(py_self);
+
+  // Empty binaries may have no data pointer, in which case we point
+  // to a valid empty buffer instead
+  static char empty[1] = {0};
+  auto data = self->data != nullptr ? self->data : empty;
+
+  // Raises BufferError if a writable buffer is requested
+  return PyBuffer_FillInfo(view, py_self, data, self->size, 1, flags);
+}
+
+void binary_buffer_dealloc(PyObjectPtr py_self) {
+  auto self = get_binary_buffer(py_self);
+
+  if (self->env != nullptr) {
+    enif_free_env(self->env);
+  }
+
+  auto py_type = PyObject_Type(py_self);
+  auto tp_free = reinterpret_cast<void (*)(PyObjectPtr)>(
+      PyType_GetSlot(py_type, Py_tp_free));
+  tp_free(py_self);
+
+  // One reference from PyObject_Type and one held by the instance,
+  // as is the case for all heap types
+  Py_DecRef(py_type);
+  Py_DecRef(py_type);
+}
+
+// Returns a new reference, or NULL on failure.
+//
+// Requires GIL.
+PyObjectPtr make_binary_buffer_type() {
+  // The header size is the basic size of the object type, which has
+  // no other fields
+  auto py_builtins = PyEval_GetBuiltins();
+  if (py_builtins == NULL) {
+    return NULL;
+  }
+
+  auto py_object_type = PyDict_GetItemString(py_builtins, "object");
+  if (py_object_type == NULL) {
+    return NULL;
+  }
+
+  auto py_basicsize = PyObject_GetAttrString(py_object_type, "__basicsize__");
+  if (py_basicsize == NULL) {
+    return NULL;
+  }
+  auto py_basicsize_guard = PyDecRefGuard(py_basicsize);
+
+  int overflow;
+  auto head_size = PyLong_AsLongLongAndOverflow(py_basicsize, &overflow);
+  if (head_size == -1 && PyErr_Occurred() != NULL) {
+    return NULL;
+  }
+
+  if (overflow != 0 || head_size <= 0) {
+    throw std::runtime_error("unexpected size of the Python object header");
+  }
+
+  auto alignment = alignof(PyBinaryBuffer);
+  binary_buffer_offset =
+      (static_cast<size_t>(head_size) + alignment - 1) / alignment * alignment;
+
+  static PyType_Slot slots[] = {
+      {Py_bf_getbuffer, reinterpret_cast<void *>(binary_buffer_getbuffer)},
+      {Py_tp_dealloc, reinterpret_cast<void *>(binary_buffer_dealloc)},
+      {0, nullptr}};
+
+  // The spec is only used while creating the type
+  auto spec = PyType_Spec{
+      "pythonx.BinaryBuffer",
+      static_cast<int>(binary_buffer_offset + sizeof(PyBinaryBuffer)), 0,
+      Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, slots};
+
+  return PyType_FromSpec(&spec);
+}
+
+// Resolves the references in py_cache. Must be called on init, once
+// the pythonx module is defined.
+//
+// Requires GIL.
+void init_py_cache(ErlNifEnv *env) {
+  // All references are released if any of the lookups fails
+  auto py_refs = std::vector<PyObjectPtr>();
+
+  auto keep = [&](PyObjectPtr py_object) {
+    if (py_object == NULL) {
+      for (auto py_ref : py_refs) {
+        Py_DecRef(py_ref);
+      }
+
+      raise_py_error(env);
+    }
+
+    py_refs.push_back(py_object);
+    return py_object;
+  };
+
+  auto import = [&](const char *name) {
+    return keep(PyImport_ImportModule(name));
+  };
+
+  auto get_attr = [&](PyObjectPtr py_object, const char *name) {
+    return keep(PyObject_GetAttrString(py_object, name));
+  };
+
+  auto intern = [&](const char *string) {
+    return keep(PyUnicode_InternFromString(string));
+  };
+
+  auto cache = PyCache();
+
+  // Borrowed reference, the builtins live as long as the interpreter
+  auto py_builtins = PyEval_GetBuiltins();
+  raise_if_failed(env, py_builtins);
+
+  auto get_type = [&](const char *name) {
+    auto py_type = PyDict_GetItemString(py_builtins, name);
+    raise_if_failed(env, py_type);
+    return py_type;
+  };
+
+  auto &types = cache.builtin_types;
+  types.int_type = get_type("int");
+  types.float_type = get_type("float");
+  types.tuple_type = get_type("tuple");
+  types.list_type = get_type("list");
+  types.dict_type = get_type("dict");
+  types.str_type = get_type("str");
+  types.bytes_type = get_type("bytes");
+  types.bytearray_type = get_type("bytearray");
+  types.set_type = get_type("set");
+  types.frozenset_type = get_type("frozenset");
+  types.memoryview_type = get_type("memoryview");
+  types.range_type = get_type("range");
+
+  cache.int_from_bytes = get_attr(types.int_type, "from_bytes");
+
+  // Borrowed reference, the module is kept alive by sys.modules
+  auto py_pythonx = PyImport_AddModule("pythonx");
+  raise_if_failed(env, py_pythonx);
+
+  cache.pythonx_PID = get_attr(py_pythonx, "PID");
+  cache.pythonx_elixir_source = get_attr(py_pythonx, "_elixir_source");
+  cache.pythonx_struct_fields = get_attr(py_pythonx, "_struct_fields");
+  cache.pythonx_memory_size = get_attr(py_pythonx, "_memory_size");
+  cache.pythonx_data_memory_size = get_attr(py_pythonx, "_data_memory_size");
+  cache.pythonx_type_name = get_attr(py_pythonx, "_type_name");
+  cache.pythonx_clear_traceback_frames =
+      get_attr(py_pythonx, "_clear_traceback_frames");
+
+  auto py_traceback = import("traceback");
+  cache.traceback_format_exception =
+      get_attr(py_traceback, "format_exception");
+
+  auto py_ast = import("ast");
+  cache.ast_parse = get_attr(py_ast, "parse");
+  cache.ast_Expr = get_attr(py_ast, "Expr");
+  cache.ast_Expression = get_attr(py_ast, "Expression");
+
+  auto py_types = import("types");
+  cache.types_ModuleType = get_attr(py_types, "ModuleType");
+
+  auto py_pickle = import("pickle");
+  cache.pickle_dumps = get_attr(py_pickle, "dumps");
+  cache.pickle_loads = get_attr(py_pickle, "loads");
+
+  auto py_array = import("array");
+  cache.array_array = get_attr(py_array, "array");
+
+  auto py_datetime = import("datetime");
+  auto &calendar_types = cache.calendar_types;
+  calendar_types.date_type = get_attr(py_datetime, "date");
+  calendar_types.time_type = get_attr(py_datetime, "time");
+  calendar_types.datetime_type = get_attr(py_datetime, "datetime");
+  calendar_types.timezone_type = get_attr(py_datetime, "timezone");
+  calendar_types.timedelta_type = get_attr(py_datetime, "timedelta");
+  calendar_types.utc = get_attr(calendar_types.timezone_type, "utc");
+
+  auto py_zoneinfo = import("zoneinfo");
+  calendar_types.zone_info_type = get_attr(py_zoneinfo, "ZoneInfo");
+
+  auto py_decimal = import("decimal");
+  calendar_types.decimal_type = get_attr(py_decimal, "Decimal");
+
+  cache.string_filename = intern("<string>");
+  cache.string_exec = intern("exec");
+  cache.string_eval = intern("eval");
+  cache.string_main = intern("__main__");
+
+  cache.binary_buffer_type = keep(make_binary_buffer_type());
+
+  py_cache = cache;
+}
+
+std::vector<fine::Term> py_error_lines(ErlNifEnv *env, PyObjectPtr py_type,
+                                       PyObjectPtr py_value,
                                        PyObjectPtr py_traceback) {
-  auto py_traceback_module = PyImport_ImportModule("traceback");
-  raise_if_failed(env, py_traceback_module);
-  auto py_traceback_module_guard = PyDecRefGuard(py_traceback_module);
+  auto format_exception = get_py_cache(env).traceback_format_exception;
+
+  auto format_exception_args = PyTuple_Pack(3, py_type, py_value, py_traceback);
+  raise_if_failed(env, format_exception_args);
+  auto format_exception_args_guard = PyDecRefGuard(format_exception_args);
+
+  auto py_lines = PyObject_Call(format_exception, format_exception_args, NULL);
+  raise_if_failed(env, py_lines);
+  auto py_lines_guard = PyDecRefGuard(py_lines);
+
+  auto size = PyList_Size(py_lines);
+  raise_if_failed(env, size);
+
+  auto terms = std::vector<fine::Term>();
+  terms.reserve(size);
+
+  for (Py_ssize_t i = 0; i < size; i++) {
+    auto py_line = PyList_GetItem(py_lines, i);
+    raise_if_failed(env, py_line);
+
+    terms.push_back(py_str_to_binary_term(env, py_line));
+  }
+
+  return terms;
+}
+
+// Python objects referenced by %Pythonx.Object{} can hold arbitrary
+// amounts of memory, however to the BEAM they are just small resource
+// terms. As a result, a process holding onto dead references may not
+// grow its heap enough to trigger garbage collection, and the Python
+// memory is never released. To address this, we estimate the memory
+// size of newly created Python objects and report it to the Janitor,
+// which accumulates the size per process and forces garbage collection
+// of the process once it goes past a threshold. This is similar to
+// how the BEAM accounts for off-heap binaries (binary virtual heap).
+//
+// We only report sizes above this value, in order to avoid flooding
+// the Janitor with messages, when dealing with many small objects,
+// which count towards the process heap anyway.
+constexpr size_t memory_pressure_min_size = 64 * 1024;
+
+// Calls a helper function defined in the pythonx module on init, see
+// PyCache.
+//
+// Returns a new reference, or NULL if the call fails, in which case
+// the error indicator is cleared. Use this only for best-effort
+// operations.
+PyObjectPtr call_pythonx_helper(PyObjectPtr py_helper,
+                                std::vector<PyObjectPtr> py_objects) {
+  auto py_args = PyTuple_New(py_objects.size());
+  if (py_args == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  for (size_t i = 0; i < py_objects.size(); i++) {
+    // Note that PyTuple_SetItem steals the reference
+    Py_IncRef(py_objects[i]);
+    PyTuple_SetItem(py_args, i, py_objects[i]);
+  }
+
+  auto py_result = PyObject_Call(py_helper, py_args, NULL);
+  if (py_result == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+
+  return py_result;
+}
+
+// Clears traceback frames, see the :traceback option in Pythonx.eval/3.
+// This is best-effort, so we ignore any errors.
+void py_clear_traceback_frames(PyObjectPtr py_value, PyObjectPtr py_traceback,
+                               bool drop) {
+  // Errors raised on init, before the helpers are available, are kept
+  // as is
+  if (!py_cache) {
+    return;
+  }
+
+  auto py_drop = PyBool_FromLong(drop);
+  if (py_drop == NULL) {
+    PyErr_Clear();
+    return;
+  }
+  auto py_drop_guard = PyDecRefGuard(py_drop);
+
+  auto py_result =
+      call_pythonx_helper(py_cache->pythonx_clear_traceback_frames,
+                          {py_value, py_traceback, py_drop});
+  if (py_result != NULL) {
+    Py_DecRef(py_result);
+  }
+}
+
+// Calls one of the size helpers defined in the pythonx module.
+size_t call_size_helper(PyObjectPtr py_helper, PyObjectPtr py_object) {
+  // The estimation is best-effort, so we ignore any errors.
+
+  auto py_size = call_pythonx_helper(py_helper, {py_object});
+  if (py_size == NULL) {
+    return 0;
+  }
+  auto py_size_guard = PyDecRefGuard(py_size);
+
+  int overflow;
+  auto size = PyLong_AsLongLongAndOverflow(py_size, &overflow);
+  if (PyErr_Occurred() != NULL) {
+    PyErr_Clear();
+    return 0;
+  }
+
+  if (overflow != 0 || size < 0) {
+    return 0;
+  }
+
+  return static_cast<size_t>(size);
+}
+
+size_t py_object_memory_size(PyObjectPtr py_object) {
+  return call_size_helper(py_cache->pythonx_memory_size, py_object);
+}
+
+// Returns the estimated memory size of the given object, but only if
+// it may be large enough to count towards memory pressure, otherwise
+// returns 0.
+//
+// The full estimation calls sys.getsizeof, which for arbitrary objects
+// runs __sizeof__ and may traverse the whole object, so we do not want
+// to do it for every evaluation result and global. Large data usually
+// lives in objects exposing a buffer, such as bytes and arrays, so we
+// estimate the size of those and of built-in containers with enough
+// items to go past memory_pressure_min_size. For other objects, such
+// as dataframes and tensors, we only ask for the size of the data they
+// report, which is cheap to get, see data_memory_size in the pythonx
+// module.
+//
+// Requires GIL.
+size_t py_object_large_memory_size(const PyBuiltinTypes &types,
+                                   PyObjectPtr py_object) {
+  if (!PyObject_CheckBuffer(py_object)) {
+    auto py_type = PyObject_Type(py_object);
+    if (py_type == NULL) {
+      PyErr_Clear();
+      return 0;
+    }
+    Py_DecRef(py_type);
+
+    auto is_container =
+        py_type == types.list_type || py_type == types.tuple_type ||
+        py_type == types.dict_type || py_type == types.set_type ||
+        py_type == types.frozenset_type || py_type == types.str_type;
+
+    if (py_type == types.int_type || py_type == types.float_type) {
+      return 0;
+    }
+
+    if (!is_container) {
+      return call_size_helper(py_cache->pythonx_data_memory_size,
+                              py_object);
+    }
+
+    auto size = PyObject_Size(py_object);
+    if (size < 0) {
+      PyErr_Clear();
+      return 0;
+    }
+
+    // Each item takes at least a pointer, or a byte for str
+    auto item_size = py_type == types.str_type ? 1 : sizeof(PyObjectPtr);
+
+    if (static_cast<size_t>(size) * item_size < memory_pressure_min_size) {
+      return 0;
+    }
+  }
+
+  return py_object_memory_size(py_object);
+}
+
+std::string py_object_type_name(PyObjectPtr py_object) {
+  auto py_name = call_pythonx_helper(py_cache->pythonx_type_name, {py_object});
+  if (py_name == NULL) {
+    return "unknown";
+  }
+  auto py_name_guard = PyDecRefGuard(py_name);
+
+  Py_ssize_t size;
+  auto name = PyUnicode_AsUTF8AndSize(py_name, &size);
+  if (name == NULL) {
+    PyErr_Clear();
+    return "unknown";
+  }
+
+  return std::string(name, size);
+}
+
+TrackedObject make_tracked_object(PyObjectPtr py_object) {
+  return TrackedObject{py_object_type_name(py_object),
+                       py_object_memory_size(py_object), current_object_tag,
+                       std::chrono::steady_clock::now()};
+}
+
+void report_memory_pressure(ErlNifEnv *env, size_t size) {
+  if (size < memory_pressure_min_size) {
+    return;
+  }
+
+  ErlNifPid pid;
+  if (enif_self(env, &pid) == NULL) {
+    // Not called from a process, so there is nothing to account for.
+    return;
+  }
+
+  auto janitor_name = fine::encode(env, atoms::ElixirPythonxJanitor);
+  ErlNifPid janitor_pid;
+  if (enif_whereis_pid(env, janitor_name, &janitor_pid)) {
+    auto msg_env = enif_alloc_env();
+    auto msg = fine::encode(
+        msg_env, std::make_tuple(atoms::memory_pressure, pid,
+                                 static_cast<uint64_t>(size)));
+    enif_send(env, &janitor_pid, msg_env, msg);
+    enif_free_env(msg_env);
+  }
+}
+
+// Requires GIL.
+PinnedObjects *make_pinned_objects(ErlNifEnv *env) {
+  auto objects = std::make_unique<PinnedObjects>();
+
+  // Note that Limited API has Py_GetConstant, but only since v3.13
+  auto py_none = Py_BuildValue("");
+  raise_if_failed(env, py_none);
+  objects->none = make_pinned_ex_object(py_none);
+
+  auto py_true = PyBool_FromLong(1);
+  raise_if_failed(env, py_true);
+  objects->true_ = make_pinned_ex_object(py_true);
+
+  auto py_false = PyBool_FromLong(0);
+  raise_if_failed(env, py_false);
+  objects->false_ = make_pinned_ex_object(py_false);
+
+  for (auto number = PinnedObjects::min_small_int;
+       number <= PinnedObjects::max_small_int; number++) {
+    auto py_long = PyLong_FromLongLong(number);
+    raise_if_failed(env, py_long);
+    objects->small_ints.push_back(make_pinned_ex_object(py_long));
+  }
+
+  return objects.release();
+}
+
+fine::Ok<> init(ErlNifEnv *env, std::string python_dl_path,
+                ErlNifBinary python_home_path,
+                ErlNifBinary python_executable_path,
+                std::vector<ErlNifBinary> sys_paths) {
+  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+
+  if (is_initialized) {
+    throw std::runtime_error("Python interpreter has already been initialized");
+  }
+
+  // Raises runtime error on failure, which is propagated automatically
+  load_python_library(python_dl_path);
+
+  // The path needs to be available for the whole interpreter lifetime,
+  // so we store it in a global variable.
+  python_home_path_w = std::wstring(
+      python_home_path.data, python_home_path.data + python_home_path.size);
+
+  python_executable_path_w =
+      std::wstring(python_executable_path.data,
+                   python_executable_path.data + python_executable_path.size);
+
+  // As part of the initialization, sys.path gets set. It is important
+  // that it gets set correctly, so that the built-in modules can be
+  // found, otherwise the initialization fails. This logic is internal
+  // to Python, but we can configure base paths used to infer sys.path.
+  // The Limited API exposes Py_SetPythonHome and Py_SetProgramName and
+  // it appears that setting either of them alone should be sufficient.
+  //
+  // Py_SetProgramName has the advantage that, when set to the executable
+  // inside venv, it results in the packages directory being added to
+  // sys.path automatically, however, when tested, this did not work
+  // as expected in Python 3.10 on Windows. For this reason we prefer
+  // to use Py_SetPythonHome and add other paths to sys.path manually.
+  //
+  // Even then, we still want to set Py_SetProgramName to a Python
+  // executable, otherwise `sys.executable` is going to point to the
+  // BEAM executable (`argv[0]`), which can be problematic.
+  //
+  // In the end, the most reliable combination seems to be to set both,
+  // and also add the extra sys.path manually.
+  //
+  // Note that Python home is the directory with lib/ child directory
+  // containing the built-in Python modules [1].
+  //
+  // [1]: https://docs.python.org/3/using/cmdline.html#envvar-PYTHONHOME
+  Py_SetPythonHome(python_home_path_w.c_str());
+  Py_SetProgramName(python_executable_path_w.c_str());
+
+  Py_InitializeEx(0);
+
+  interpreter_state = PyInterpreterState_Get();
+
+  // In order to use any of the Python C API functions, the calling
+  // thread must hold the GIL. Since every NIF call may run on a
+  // different dirty scheduler thread, we need to acquire the GIL at
+  // the beginning of each NIF and release it afterwards.
+  //
+  // After initializing the Python interpreter above, the current
+  // thread automatically holds the GIL, so we explicitly release it.
+  // See pyo3 [1] for an extra reference.
+  //
+  // [1]: https://github.com/PyO3/pyo3/blob/v0.23.3/src/gil.rs#L63-L74
+  thread_states[std::this_thread::get_id()] = PyEval_SaveThread();
+
+  is_initialized = true;
+
+  // We still hold the init_mutex, so we can obtain the GIL guard
+  // before any other concurrent NIF. At this point we marked the
+  // interpreter as initialized and now we continue with further
+  // preparation using Python APIs. If any exception is subsequently
+  // raised, it will propagate as expected, and since the interpreter
+  // is initialized, the exception formatting will also work.
+  auto gil_guard = PyGILGuard();
+
+  // Add extra paths to sys.path
+
+  auto py_sys = PyImport_AddModule("sys");
+  raise_if_failed(env, py_sys);
+
+  auto py_sys_path = PyObject_GetAttrString(py_sys, "path");
+  raise_if_failed(env, py_sys_path);
+  auto py_sys_path_guard = PyDecRefGuard(py_sys_path);
+
+  for (const auto &path : sys_paths) {
+    auto py_path = PyUnicode_FromStringAndSize(
+        reinterpret_cast<const char *>(path.data), path.size);
+    raise_if_failed(env, py_path);
+    auto py_path_guard = PyDecRefGuard(py_path);
+
+    raise_if_failed(env, PyList_Append(py_sys_path, py_path));
+  }
+
+  // Define global stdout and stdin overrides
+
+  auto py_builtins = PyEval_GetBuiltins();
+  raise_if_failed(env, py_builtins);
+
+  auto py_exec = PyDict_GetItemString(py_builtins, "exec");
+  raise_if_failed(env, py_exec);
+
+  const char code[] = R"(
+import ctypes
+import dataclasses
+import io
+import sys
+import inspect
+import traceback
+import types
+import sys
+import weakref
+
+pythonx_handle_io_write = ctypes.CFUNCTYPE(
+  None, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_bool
+)(pythonx_handle_io_write_ptr)
+
+pythonx_handle_send_tagged_object = ctypes.CFUNCTYPE(
+  None, ctypes.c_char_p, ctypes.c_char_p, ctypes.py_object, ctypes.c_char_p
+)(pythonx_handle_send_tagged_object_ptr)
+
+pythonx_handle_free_env = ctypes.CFUNCTYPE(
+  None, ctypes.c_void_p
+)(pythonx_handle_free_env_ptr)
+
+# Note that ctypes releases the GIL while calling CFUNCTYPE functions,
+# while PYFUNCTYPE functions are called with the GIL held
+pythonx_handle_source_pull = ctypes.CFUNCTYPE(
+  ctypes.c_int, ctypes.c_void_p, ctypes.c_uint64, ctypes.c_char_p
+)(pythonx_handle_source_pull_ptr)
+
+pythonx_handle_source_take = ctypes.PYFUNCTYPE(
+  ctypes.c_int, ctypes.c_void_p, ctypes.py_object
+)(pythonx_handle_source_take_ptr)
+
+
+def get_eval_info_bytes():
+  # The evaluation caller has __pythonx_eval_info_bytes__ set in
+  # their globals. It is not available in globals() here, because
+  # the globals dict in function definitions is fixed at definition
+  # time. To find the current evaluation globals, we look at the
+  # call stack using the inspect module and find the caller with
+  # __pythonx_eval_info_bytes__ in globals. We look specifically
+  # for the outermost caller, because intermediate functions could
+  # be defined by previous evaluations, in which case they would
+  # have __pythonx_eval_info_bytes__ in their globals, corresponding
+  # to that previous evaluation. When called within a thread, the
+  # evaluation caller is not in the stack, so __pythonx_eval_info_bytes__
+  # will be found in the thread entrypoint function globals.
+  call_stack = inspect.stack()
+  eval_info_bytes = next(
+    frame_info.frame.f_globals["__pythonx_eval_info_bytes__"]
+    for frame_info in reversed(call_stack)
+    if "__pythonx_eval_info_bytes__" in frame_info.frame.f_globals
+  )
+  return eval_info_bytes
+
+
+class Stdout(io.TextIOBase):
+  def __init__(self, type):
+    self.type = type
+
+  def write(self, string):
+    pythonx_handle_io_write(string.encode("utf-8"), get_eval_info_bytes(), self.type)
+    return len(string)
+
+
+class Stdin(io.IOBase):
+  def read(self, size=None):
+    raise RuntimeError("stdin not supported")
+
+
+sys.stdout = Stdout(0)
+sys.stderr = Stdout(1)
+sys.stdin = Stdin()
+
+pythonx = types.ModuleType("pythonx")
+
+class PID:
+  def __init__(self, bytes):
+    self.bytes = bytes
+
+  def __repr__(self):
+    return "<pythonx.PID>"
+
+pythonx.PID = PID
+
+def send_tagged_object(pid, tag, object):
+  pythonx_handle_send_tagged_object(pid.bytes, tag.encode("utf-8"), object, get_eval_info_bytes())
+
+pythonx.send_tagged_object = send_tagged_object
+
+# Objects such as arrays, tensors and dataframes often keep their data
+# in separate buffers, which are not included in sys.getsizeof. Most
+# of them report the data size in one of the ways below, so we pick
+# the right one once per type.
+data_size_probes = weakref.WeakKeyDictionary()
+
+def data_size_probe(type_):
+  if hasattr(type_, "nbytes"):
+    # numpy, pyarrow, torch
+    return lambda object: object.nbytes
+  if hasattr(type_, "estimated_size"):
+    # polars
+    return lambda object: object.estimated_size()
+  if hasattr(type_, "memory_usage"):
+    # pandas, either a series of column sizes or a single size
+    def probe(object):
+      usage = object.memory_usage()
+      return usage.sum() if hasattr(usage, "sum") else usage
+    return probe
+  return None
+
+def data_memory_size(object):
+  try:
+    type_ = type(object)
+    probe = data_size_probes.get(type_, False)
+    if probe is False:
+      probe = data_size_probes[type_] = data_size_probe(type_)
+    return 0 if probe is None else int(probe(object))
+  except Exception:
+    return 0
+
+pythonx._data_memory_size = data_memory_size
+
+def memory_size(object):
+  try:
+    return max(sys.getsizeof(object), data_memory_size(object))
+  except Exception:
+    return 0
+
+pythonx._memory_size = memory_size
+
+def type_name(object):
+  type_ = type(object)
+  if type_.__module__ == "builtins":
+    return type_.__qualname__
+  return f"{type_.__module__}.{type_.__qualname__}"
+
+pythonx._type_name = type_name
+
+def struct_fields(cls):
+  # Returns the names of fields accepted as positional constructor
+  # arguments, in order.
+  if not isinstance(cls, type):
+    raise TypeError(f"expected a class, got: {cls!r}")
+  if dataclasses.is_dataclass(cls):
+    return [field.name for field in dataclasses.fields(cls) if field.init]
+  if issubclass(cls, tuple) and hasattr(cls, "_fields"):
+    return list(cls._fields)
+  slots = cls.__dict__.get("__slots__")
+  if isinstance(slots, str):
+    return [slots]
+  if slots is not None:
+    return list(slots)
+  raise TypeError(
+    "expected a dataclass, a namedtuple or a class with __slots__, "
+    f"got: {cls!r}"
+  )
+
+pythonx._struct_fields = struct_fields
+
+def clear_traceback_frames(error, tb, drop):
+  # Clears local variables of all frames referenced by the traceback,
+  # including tracebacks of chained exceptions. With drop, tracebacks
+  # are also detached from the exceptions.
+  traceback.clear_frames(tb)
+
+  seen = set()
+  stack = [error]
+
+  while stack:
+    error = stack.pop()
+    if not isinstance(error, BaseException) or id(error) in seen:
+      continue
+
+    seen.add(id(error))
+    traceback.clear_frames(error.__traceback__)
+
+    if drop:
+      error.__traceback__ = None
+
+    stack.append(error.__cause__)
+    stack.append(error.__context__)
+    stack.extend(getattr(error, "exceptions", ()))
+
+pythonx._clear_traceback_frames = clear_traceback_frames
+
+class ElixirSource:
+  # Pulls chunks of data from an Elixir process, see Pythonx.Source.
+
+  def __init__(self, channel):
+    self._channel = channel
+    self._done = False
+
+  def pull(self, size):
+    if self._done:
+      return None
+
+    try:
+      eval_info_bytes = get_eval_info_bytes()
+    except StopIteration:
+      raise RuntimeError(
+        "Elixir sources can only be consumed by code evaluated "
+        "with Pythonx.eval"
+      ) from None
+
+    # Blocks until the Elixir process replies, with the GIL released
+    status = pythonx_handle_source_pull(self._channel, size, eval_info_bytes)
+    result = []
+    taken = pythonx_handle_source_take(self._channel, result)
+
+    if status > 0 and not taken:
+      # The items are not encoded by the Elixir process, see
+      # Pythonx.Source, so we only support built-in conversion
+      self._done = True
+      raise TypeError(
+        "the Elixir iterator produced items that cannot be converted to "
+        "Python. Only items with built-in conversion are supported, items "
+        "such as structs with a custom Pythonx.Encoder implementation need "
+        "to be encoded with Pythonx.encode!/2 before creating the iterator"
+      )
+
+    if status == 0:
+      self._done = True
+      return None
+
+    if status < 0:
+      self._done = True
+      if not result:
+        result = ["the Elixir source process is no longer alive"]
+      raise RuntimeError(result[0])
+
+    return result[0]
+
+class ElixirReader(io.RawIOBase):
+  def __init__(self, source):
+    self._source = source
+    self._chunk = memoryview(b"")
+    self._offset = 0
+
+  def readable(self):
+    return True
+
+  def readinto(self, buffer):
+    view = memoryview(buffer).cast("B")
+
+    if len(view) == 0:
+      return 0
+
+    while self._offset == len(self._chunk):
+      chunk = self._source.pull(len(view))
+      if chunk is None:
+        return 0
+      self._chunk = memoryview(chunk)
+      self._offset = 0
+
+    size = min(len(view), len(self._chunk) - self._offset)
+    view[:size] = self._chunk[self._offset : self._offset + size]
+    self._offset += size
+    return size
+
+class ElixirIterator:
+  def __init__(self, source):
+    self._source = source
+    self._items = iter(())
+
+  def __iter__(self):
+    return self
+
+  def __next__(self):
+    while True:
+      for item in self._items:
+        return item
+
+      items = self._source.pull(0)
+      if items is None:
+        raise StopIteration
+
+      self._items = iter(items)
+
+def elixir_source(kind, channel, env_ptr):
+  # The channel is kept alive by the given env, which we free once the
+  # source is deallocated.
+  source = ElixirSource(channel)
+  weakref.finalize(source, pythonx_handle_free_env, env_ptr)
+  return ElixirReader(source) if kind == "reader" else ElixirIterator(source)
+
+pythonx._elixir_source = elixir_source
+
+sys.modules["pythonx"] = pythonx
+)";
+
+  auto py_code = PyUnicode_FromStringAndSize(code, sizeof(code) - 1);
+  raise_if_failed(env, py_code);
+  auto py_code_guard = PyDecRefGuard(py_code);
+
+  auto py_globals = PyDict_New();
+  raise_if_failed(env, py_globals);
+  auto py_globals_guard = PyDecRefGuard(py_globals);
+
+  raise_if_failed(
+      env, PyDict_SetItemString(py_globals, "__builtins__", py_builtins));
+
+  auto py_pythonx_handle_io_write_ptr = PyLong_FromUnsignedLongLong(
+      reinterpret_cast<uintptr_t>(pythonx_handle_io_write));
+  raise_if_failed(env, py_pythonx_handle_io_write_ptr);
+  auto py_pythonx_handle_io_write_ptr_guard =
+      PyDecRefGuard(py_pythonx_handle_io_write_ptr);
+
+  raise_if_failed(env, PyDict_SetItemString(py_globals,
+                                            "pythonx_handle_io_write_ptr",
+                                            py_pythonx_handle_io_write_ptr));
+
+  auto py_pythonx_handle_send_tagged_object_ptr = PyLong_FromUnsignedLongLong(
+      reinterpret_cast<uintptr_t>(pythonx_handle_send_tagged_object));
+  raise_if_failed(env, py_pythonx_handle_send_tagged_object_ptr);
+  auto py_pythonx_handle_send_tagged_object_ptr_guard =
+      PyDecRefGuard(py_pythonx_handle_send_tagged_object_ptr);
+
+  raise_if_failed(env, PyDict_SetItemString(
+                           py_globals, "pythonx_handle_send_tagged_object_ptr",
+                           py_pythonx_handle_send_tagged_object_ptr));
+
+  auto py_pythonx_handle_free_env_ptr = PyLong_FromUnsignedLongLong(
+      reinterpret_cast<uintptr_t>(pythonx_handle_free_env));
+  raise_if_failed(env, py_pythonx_handle_free_env_ptr);
+  auto py_pythonx_handle_free_env_ptr_guard =
+      PyDecRefGuard(py_pythonx_handle_free_env_ptr);
+
+  raise_if_failed(env, PyDict_SetItemString(py_globals,
+                                            "pythonx_handle_free_env_ptr",
+                                            py_pythonx_handle_free_env_ptr));
+
+  auto py_pythonx_handle_source_pull_ptr = PyLong_FromUnsignedLongLong(
+      reinterpret_cast<uintptr_t>(pythonx_handle_source_pull));
+  raise_if_failed(env, py_pythonx_handle_source_pull_ptr);
+  auto py_pythonx_handle_source_pull_ptr_guard =
+      PyDecRefGuard(py_pythonx_handle_source_pull_ptr);
+
+  raise_if_failed(env, PyDict_SetItemString(
+                           py_globals, "pythonx_handle_source_pull_ptr",
+                           py_pythonx_handle_source_pull_ptr));
+
+  auto py_pythonx_handle_source_take_ptr = PyLong_FromUnsignedLongLong(
+      reinterpret_cast<uintptr_t>(pythonx_handle_source_take));
+  raise_if_failed(env, py_pythonx_handle_source_take_ptr);
+  auto py_pythonx_handle_source_take_ptr_guard =
+      PyDecRefGuard(py_pythonx_handle_source_take_ptr);
+
+  raise_if_failed(env, PyDict_SetItemString(
+                           py_globals, "pythonx_handle_source_take_ptr",
+                           py_pythonx_handle_source_take_ptr));
+
+  auto py_exec_args = PyTuple_Pack(2, py_code, py_globals);
+  raise_if_failed(env, py_exec_args);
+  auto py_exec_args_guard = PyDecRefGuard(py_exec_args);
+
+  auto py_result = PyObject_Call(py_exec, py_exec_args, NULL);
+  raise_if_failed(env, py_result);
+  Py_DecRef(py_result);
+
+  // We resolve the cached references while still holding init_mutex,
+  // so other threads can only use the cache once it is complete
+  init_py_cache(env);
+
+  pinned_objects = make_pinned_objects(env);
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(init, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> janitor_decref(ErlNifEnv *env, uint64_t ptr) {
+  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+
+  // If the interpreter is no longer initialized, ignore the call
+  if (is_initialized) {
+    auto gil_guard = PyGILGuard();
+
+    auto object = reinterpret_cast<PyObjectPtr>(ptr);
+
+    Py_DecRef(object);
+  }
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(janitor_decref, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> janitor_decref_many(ErlNifEnv *env, ErlNifBinary ptrs) {
+  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+
+  // If the interpreter is no longer initialized, ignore the call
+  if (is_initialized) {
+    auto gil_guard = PyGILGuard();
+
+    auto size = ptrs.size / sizeof(PyObjectPtr);
+
+    for (size_t i = 0; i < size; i++) {
+      PyObjectPtr object;
+      std::memcpy(&object, ptrs.data + i * sizeof(PyObjectPtr),
+                  sizeof(PyObjectPtr));
+      Py_DecRef(object);
+    }
+  }
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(janitor_decref_many, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> object_release(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  // We decrement the refcount right away and mark the object as
+  // released, so that the destructor skips it and any further use
+  // raises an error.
+  ex_object.release();
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(object_release, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> scope_begin(ErlNifEnv *env) {
+  ErlNifPid pid;
+  enif_self(env, &pid);
+
+  auto guard = std::lock_guard<std::mutex>(process_scopes_mutex);
+  process_scopes[pid_key(pid)].push_back(Scope());
+  process_scopes_count++;
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(scope_begin, 0);
+
+void release_scopes(std::vector<Scope> scopes) {
+  if (scopes.empty()) {
+    return;
+  }
+
+  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+
+  // If the interpreter is no longer initialized, ignore the call
+  if (is_initialized) {
+    auto gil_guard = PyGILGuard();
+
+    for (auto &scope : scopes) {
+      for (auto &ex_object : scope) {
+        ex_object.release();
+      }
+    }
+  }
+}
+
+fine::Ok<> scope_end(ErlNifEnv *env) {
+  ErlNifPid pid;
+  enif_self(env, &pid);
+
+  auto scopes = std::vector<Scope>();
+
+  {
+    auto guard = std::lock_guard<std::mutex>(process_scopes_mutex);
+
+    auto it = process_scopes.find(pid_key(pid));
+    if (it == process_scopes.end()) {
+      throw std::runtime_error("scope_end called without a matching scope");
+    }
+
+    scopes.push_back(std::move(it->second.back()));
+    it->second.pop_back();
+    process_scopes_count--;
+
+    if (it->second.empty()) {
+      process_scopes.erase(it);
+    }
+  }
+
+  release_scopes(std::move(scopes));
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(scope_end, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> janitor_release_scopes(ErlNifEnv *env, ErlNifPid pid) {
+  // Called once the given process terminates, in case it did not
+  // close its scopes (for example, when killed).
+
+  auto scopes = std::vector<Scope>();
+
+  {
+    auto guard = std::lock_guard<std::mutex>(process_scopes_mutex);
+
+    auto it = process_scopes.find(pid_key(pid));
+    if (it != process_scopes.end()) {
+      process_scopes_count -= it->second.size();
+      scopes = std::move(it->second);
+      process_scopes.erase(it);
+    }
+  }
+
+  release_scopes(std::move(scopes));
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(janitor_release_scopes, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> object_tracking_set(ErlNifEnv *env, bool enabled) {
+  object_registry.set_enabled(enabled);
+  return fine::Ok<>();
+}
+
+FINE_NIF(object_tracking_set, 0);
+
+// A {objects, bytes} tuple
+using TrackedStatsEntry = std::tuple<uint64_t, uint64_t>;
+
+// A {type, bytes, tag, age_ms} tuple
+using TrackedObjectEntry =
+    std::tuple<std::string, uint64_t, std::optional<std::string>, uint64_t>;
+
+// Returns nil if tracking is disabled.
+std::optional<std::tuple<
+    TrackedStatsEntry, std::vector<std::tuple<std::string, TrackedStatsEntry>>,
+    std::vector<std::tuple<std::optional<std::string>, TrackedStatsEntry>>,
+    std::vector<TrackedObjectEntry>>>
+object_tracking_stats(ErlNifEnv *env, uint64_t long_lived_after_ms) {
+  if (!object_registry.is_enabled()) {
+    return std::nullopt;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto summary =
+      object_registry.summary(std::chrono::milliseconds(long_lived_after_ms));
+
+  auto to_entry = [](const TrackedStats &stats) {
+    return std::make_tuple(stats.objects, stats.bytes);
+  };
+
+  auto by_type = std::vector<std::tuple<std::string, TrackedStatsEntry>>();
+  for (const auto &[type, stats] : summary.by_type) {
+    by_type.push_back(std::make_tuple(type, to_entry(stats)));
+  }
+
+  auto by_tag =
+      std::vector<std::tuple<std::optional<std::string>, TrackedStatsEntry>>();
+  for (const auto &[tag, stats] : summary.by_tag) {
+    by_tag.push_back(std::make_tuple(tag, to_entry(stats)));
+  }
+
+  auto long_lived = std::vector<TrackedObjectEntry>();
+  for (auto &object : summary.long_lived) {
+    auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - object.created_at);
+
+    long_lived.push_back(std::make_tuple(std::move(object.type), object.bytes,
+                                         std::move(object.tag), age.count()));
+  }
+
+  return std::make_tuple(to_entry(summary.total), by_type, by_tag,
+                         long_lived);
+}
+
+FINE_NIF(object_tracking_stats, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject none_new(ErlNifEnv *env) {
+  ensure_initialized();
+
+  if (pinned_objects != nullptr) {
+    return pinned_objects->none;
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  // Note that Limited API has Py_GetConstant, but only since v3.13
+  auto py_none = Py_BuildValue("");
+  raise_if_failed(env, py_none);
+
+  return make_ex_object(env, py_none);
+}
+
+FINE_NIF(none_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject false_new(ErlNifEnv *env) {
+  ensure_initialized();
+
+  if (pinned_objects != nullptr) {
+    return pinned_objects->false_;
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_bool = PyBool_FromLong(0);
+  raise_if_failed(env, py_bool);
+
+  return make_ex_object(env, py_bool);
+}
+
+FINE_NIF(false_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject true_new(ErlNifEnv *env) {
+  ensure_initialized();
+
+  if (pinned_objects != nullptr) {
+    return pinned_objects->true_;
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_bool = PyBool_FromLong(1);
+  raise_if_failed(env, py_bool);
+
+  return make_ex_object(env, py_bool);
+}
+
+FINE_NIF(true_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject long_from_int64(ErlNifEnv *env, int64_t number) {
+  ensure_initialized();
+
+  if (pinned_objects != nullptr) {
+    if (auto ex_object = pinned_objects->small_int(number)) {
+      return *ex_object;
+    }
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_long = PyLong_FromLongLong(number);
+  raise_if_failed(env, py_long);
+
+  return make_ex_object(env, py_long);
+}
+
+FINE_NIF(long_from_int64, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject float_new(ErlNifEnv *env, double number) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_float = PyFloat_FromDouble(number);
+  raise_if_failed(env, py_float);
+
+  return make_ex_object(env, py_float);
+}
+
+FINE_NIF(float_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject bytes_from_binary(ErlNifEnv *env, ErlNifBinary binary) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  // We allocate the object first and fill it in afterwards, so that
+  // large copies can happen with the GIL released. This is safe, since
+  // the object is not shared yet.
+  auto py_object = PyBytes_FromStringAndSize(NULL, binary.size);
+  raise_if_failed(env, py_object);
+  auto py_object_guard = PyDecRefGuard(py_object);
+
+  char *buffer;
+  Py_ssize_t buffer_size;
+  raise_if_failed(env,
+                  PyBytes_AsStringAndSize(py_object, &buffer, &buffer_size));
+
+  copy_allow_threads(buffer, binary.data, binary.size);
+
+  report_memory_pressure(env, binary.size);
+
+  py_object_guard = nullptr;
+  return make_ex_object(env, py_object);
+}
+
+FINE_NIF(bytes_from_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject bytes_from_iodata(ErlNifEnv *env, fine::Term iodata) {
+  ensure_initialized();
+
+  // Instead of flattening the iodata into an intermediate binary, we
+  // allocate the bytes object upfront and copy the fragments directly
+  // into it
+  auto fragments = std::vector<IodataFragment>();
+  auto bytes = std::vector<uint8_t>();
+  auto size = collect_iodata(env, iodata, fragments, bytes);
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_object = PyBytes_FromStringAndSize(NULL, size);
+  raise_if_failed(env, py_object);
+  auto py_object_guard = PyDecRefGuard(py_object);
+
+  char *buffer;
+  Py_ssize_t buffer_size;
+  raise_if_failed(env,
+                  PyBytes_AsStringAndSize(py_object, &buffer, &buffer_size));
+
+  auto dest = reinterpret_cast<uint8_t *>(buffer);
+
+  if (size >= allow_threads_min_size) {
+    // The object is not shared with anyone yet, so we can fill it in
+    // without holding the GIL
+    auto allow_threads_guard = PyAllowThreadsGuard();
+    copy_iodata(fragments, bytes, dest);
+  } else {
+    copy_iodata(fragments, bytes, dest);
+  }
+
+  report_memory_pressure(env, size);
+
+  py_object_guard = nullptr;
+  return make_ex_object(env, py_object);
+}
+
+FINE_NIF(bytes_from_iodata, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject memoryview_from_binary(ErlNifEnv *env, fine::Term binary_term) {
+  ensure_initialized();
+
+  if (!enif_is_binary(env, binary_term)) {
+    throw std::invalid_argument("expected a binary");
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_type = get_py_cache(env).binary_buffer_type;
+  auto tp_alloc = reinterpret_cast<PyObjectPtr (*)(PyObjectPtr, Py_ssize_t)>(
+      PyType_GetSlot(py_type, Py_tp_alloc));
+
+  auto py_buffer = tp_alloc(py_type, 0);
+  raise_if_failed(env, py_buffer);
+  auto py_buffer_guard = PyDecRefGuard(py_buffer);
+
+  // Instead of copying the binary into Python bytes, we expose its
+  // memory directly as a read-only buffer. To keep the binary alive,
+  // we copy the term into a separate env, which for refc binaries
+  // only increments the refcount. From now on the env is owned by
+  // the buffer object and freed on its deallocation.
+  auto buffer = get_binary_buffer(py_buffer);
+  buffer->env = enif_alloc_env();
+  auto binary_env_term = enif_make_copy(buffer->env, binary_term);
+
+  ErlNifBinary binary;
+  enif_inspect_binary(buffer->env, binary_env_term, &binary);
+  buffer->data = reinterpret_cast<char *>(binary.data);
+  buffer->size = static_cast<Py_ssize_t>(binary.size);
+
+  auto py_object = PyMemoryView_FromObject(py_buffer);
+  raise_if_failed(env, py_object);
+
+  return make_ex_object(env, py_object);
+}
+
+FINE_NIF(memoryview_from_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject unicode_from_string(ErlNifEnv *env, ErlNifBinary binary) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_object = PyUnicode_FromStringAndSize(
+      reinterpret_cast<const char *>(binary.data), binary.size);
+
+  raise_if_failed(env, py_object);
+
+  report_memory_pressure(env, binary.size);
+
+  return make_ex_object(env, py_object);
+}
+
+FINE_NIF(unicode_from_string, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject unicode_from_atom(ErlNifEnv *env, fine::Term atom) {
+  ensure_initialized();
+
+  if (!enif_is_atom(env, atom)) {
+    throw std::invalid_argument("expected an atom");
+  }
+
+  return atom_table.get(env, atom);
+}
+
+FINE_NIF(unicode_from_atom, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Term unicode_to_string(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  return py_str_to_binary_term(env, ex_object.py_object());
+}
+
+FINE_NIF(unicode_to_string, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Term object_to_binary(ErlNifEnv *env, ExObject ex_object,
+                            bool share_writable) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  return py_buffer_to_binary_term(env, ex_object.py_object(), share_writable);
+}
+
+FINE_NIF(object_to_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject array_from_numbers(ErlNifEnv *env, fine::Term term,
+                            fine::Atom type) {
+  ensure_initialized();
+
+  auto array_type = get_array_type(type);
+
+  // We pack the list before acquiring the GIL, so that the conversion
+  // loop does not block other Python threads. Binaries are expected
+  // to be packed already.
+  auto packed = std::vector<uint8_t>();
+  ErlNifBinary binary;
+  const uint8_t *data;
+  size_t size;
+
+  if (enif_inspect_binary(env, term, &binary)) {
+    if (binary.size % array_type.size != 0) {
+      throw std::invalid_argument(
+          "expected binary size to be a multiple of " +
+          std::to_string(array_type.size) + " for :" + array_type.name +
+          " items, got: " + std::to_string(binary.size));
+    }
+
+    data = binary.data;
+    size = binary.size;
+  } else {
+    packed = pack_numbers(env, term, array_type);
+    data = packed.data();
+    size = packed.size();
+  }
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_array_type = get_py_cache(env).array_array;
+
+  auto py_args = Py_BuildValue("(C)", static_cast<int>(array_type.typecode));
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_array = PyObject_Call(py_array_type, py_args, NULL);
+  raise_if_failed(env, py_array);
+  auto py_array_guard = PyDecRefGuard(py_array);
+
+  if (size > 0) {
+    // The array copies the items out of the memoryview, so it does
+    // not outlive the data.
+    auto py_memoryview = PyMemoryView_FromMemory(
+        reinterpret_cast<char *>(const_cast<uint8_t *>(data)),
+        static_cast<Py_ssize_t>(size), PyBUF_READ);
+    raise_if_failed(env, py_memoryview);
+    auto py_memoryview_guard = PyDecRefGuard(py_memoryview);
+
+    auto py_frombytes = PyObject_GetAttrString(py_array, "frombytes");
+    raise_if_failed(env, py_frombytes);
+    auto py_frombytes_guard = PyDecRefGuard(py_frombytes);
+
+    auto py_frombytes_args = PyTuple_Pack(1, py_memoryview);
+    raise_if_failed(env, py_frombytes_args);
+    auto py_frombytes_args_guard = PyDecRefGuard(py_frombytes_args);
+
+    auto py_result = PyObject_Call(py_frombytes, py_frombytes_args, NULL);
+    raise_if_failed(env, py_result);
+    Py_DecRef(py_result);
+  }
+
+  report_memory_pressure(env, size);
+
+  // Ownership is transferred to the resource
+  py_array_guard = nullptr;
+  return make_ex_object(env, py_array);
+}
+
+FINE_NIF(array_from_numbers, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Term array_to_binary(ErlNifEnv *env, ExObject ex_object,
+                           fine::Atom type) {
+  ensure_initialized();
+
+  auto array_type = get_array_type(type);
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_object = ex_object.py_object();
+
+  // If the object exposes a contiguous buffer with matching items,
+  // such as array.array or a numpy array, we use the buffer as is.
+  auto buffer = Py_buffer{};
+  if (PyObject_GetBuffer(py_object, &buffer,
+                         PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) == 0) {
+    auto matches = buffer_matches_array_type(buffer, array_type);
+    PyBuffer_Release(&buffer);
+
+    if (matches) {
+      return py_buffer_to_binary_term(env, py_object, false);
+    }
+  } else {
+    PyErr_Clear();
+  }
+
+  // Otherwise we iterate the object and convert every item.
+  auto py_iter = PyObject_GetIter(py_object);
+  raise_if_failed(env, py_iter);
+  auto py_iter_guard = PyDecRefGuard(py_iter);
+
+  auto packed = std::vector<uint8_t>();
+
+  for (size_t index = 0;; index++) {
+    auto py_item = PyIter_Next(py_iter);
+    if (py_item == NULL) {
+      break;
+    }
+    auto py_item_guard = PyDecRefGuard(py_item);
+
+    packed.resize(packed.size() + array_type.size);
+    auto dest = packed.data() + index * array_type.size;
+
+    if (!store_py_number(array_type, py_item, dest, index)) {
+      raise_py_error(env);
+    }
+  }
+
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  ERL_NIF_TERM binary_term;
+  auto binary_data = enif_make_new_binary(env, packed.size(), &binary_term);
+  if (!packed.empty()) {
+    std::memcpy(binary_data, packed.data(), packed.size());
+  }
+
+  return binary_term;
+}
+
+FINE_NIF(array_to_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject records_to_columns(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto types = get_builtin_types(env);
+
+  auto py_none = Py_BuildValue("");
+  raise_if_failed(env, py_none);
+  auto py_none_guard = PyDecRefGuard(py_none);
+
+  // Maps each key to its column list. Looking up keys in the dict
+  // interns them, so each distinct key is kept (and later decoded)
+  // only once, regardless of the number of records.
+  auto py_columns = PyDict_New();
+  raise_if_failed(env, py_columns);
+  auto py_columns_guard = PyDecRefGuard(py_columns);
+
+  auto py_iter = PyObject_GetIter(ex_object.py_object());
+  raise_if_failed(env, py_iter);
+  auto py_iter_guard = PyDecRefGuard(py_iter);
+
+  Py_ssize_t size = 0;
+
+  while (true) {
+    auto py_record = PyIter_Next(py_iter);
+    if (py_record == NULL) {
+      break;
+    }
+    auto py_record_guard = PyDecRefGuard(py_record);
+
+    if (!py_is_instance(env, py_record, types.dict_type)) {
+      throw std::invalid_argument(
+          "expected a sequence of dicts, but item at index " +
+          std::to_string(size) + " is not a dict");
+    }
+
+    PyObjectPtr py_key;
+    PyObjectPtr py_value;
+    Py_ssize_t pos = 0;
+
+    while (PyDict_Next(py_record, &pos, &py_key, &py_value)) {
+      auto py_column = PyDict_GetItem(py_columns, py_key);
+
+      if (py_column == NULL) {
+        // The key first appears in this record, so the column starts
+        // with None for all the previous records.
+        auto py_new_column = PyList_New(size);
+        raise_if_failed(env, py_new_column);
+        auto py_new_column_guard = PyDecRefGuard(py_new_column);
+
+        for (Py_ssize_t i = 0; i < size; i++) {
+          Py_IncRef(py_none);
+          PyList_SetItem(py_new_column, i, py_none);
+        }
+
+        auto result = PyDict_SetItem(py_columns, py_key, py_new_column);
+        raise_if_failed(env, result);
+
+        // The dict holds a reference from now on
+        py_column = py_new_column;
+      }
+
+      auto result = PyList_Append(py_column, py_value);
+      raise_if_failed(env, result);
+    }
+
+    size++;
+
+    // Columns with keys missing from this record get None
+    PyObjectPtr py_column;
+    pos = 0;
+
+    while (PyDict_Next(py_columns, &pos, &py_key, &py_column)) {
+      if (PyList_Size(py_column) < size) {
+        auto result = PyList_Append(py_column, py_none);
+        raise_if_failed(env, result);
+      }
+    }
+  }
+
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  // Ownership is transferred to the resource
+  py_columns_guard = nullptr;
+  return make_ex_object(env, py_columns);
+}
+
+FINE_NIF(records_to_columns, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject object_get_iter(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_iter = PyObject_GetIter(ex_object.py_object());
+  raise_if_failed(env, py_iter);
+
+  return make_ex_object(env, py_iter);
+}
+
+FINE_NIF(object_get_iter, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+std::tuple<ExObject, bool> iter_next_chunk(ErlNifEnv *env, ExObject ex_iter,
+                                           uint64_t chunk_size) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  // We collect the items into a Python list, so that the whole chunk
+  // can be decoded in a single call afterwards.
+  auto py_list = PyList_New(0);
+  raise_if_failed(env, py_list);
+  auto py_list_guard = PyDecRefGuard(py_list);
+
+  auto done = false;
+
+  for (uint64_t i = 0; i < chunk_size; i++) {
+    auto py_item = PyIter_Next(ex_iter.py_object());
+    if (py_item == NULL) {
+      done = true;
+      break;
+    }
+    auto py_item_guard = PyDecRefGuard(py_item);
+
+    auto result = PyList_Append(py_list, py_item);
+    raise_if_failed(env, result);
+  }
+
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  // Ownership is transferred to the resource
+  py_list_guard = nullptr;
+  return std::make_tuple(make_ex_object(env, py_list), done);
+}
+
+FINE_NIF(iter_next_chunk, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+std::tuple<fine::ResourcePtr<SourceChannelResource>, ExObject>
+source_new(ErlNifEnv *env, ErlNifPid pid, fine::Atom kind,
+           fine::Term release_notifier) {
+  ensure_initialized();
+
+  auto channel = fine::make_resource<SourceChannelResource>(pid);
+
+  auto gil_guard = PyGILGuard();
+
+  auto py_elixir_source = get_py_cache(env).pythonx_elixir_source;
+
+  // The Python object keeps the channel alive via a separate env. The
+  // env also holds the notifier, which tells the source process once
+  // the Python object is deallocated.
+  auto channel_env = enif_alloc_env();
+  enif_make_copy(channel_env, fine::encode(env, channel));
+  enif_make_copy(channel_env, release_notifier);
+
+  auto py_args = Py_BuildValue(
+      "(sKK)", kind.to_string().c_str(),
+      static_cast<unsigned long long>(
+          reinterpret_cast<uintptr_t>(channel.get())),
+      static_cast<unsigned long long>(
+          reinterpret_cast<uintptr_t>(channel_env)));
+
+  PyObjectPtr py_source = NULL;
+  if (py_args != NULL) {
+    py_source = PyObject_Call(py_elixir_source, py_args, NULL);
+    Py_DecRef(py_args);
+  }
+
+  if (py_source == NULL) {
+    // The finalizer is registered last, so on failure the env is
+    // still owned by us
+    enif_free_env(channel_env);
+    raise_py_error(env);
+  }
+
+  return std::make_tuple(channel, make_ex_object(env, py_source));
+}
+
+FINE_NIF(source_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> source_reply(ErlNifEnv *env,
+                        fine::ResourcePtr<SourceChannelResource> channel,
+                        fine::Atom reply, fine::Term payload) {
+  auto lock = std::unique_lock<std::mutex>(channel->mutex);
+
+  if (!channel->closed) {
+    auto name = reply.to_string();
+
+    if (name == "data") {
+      channel->reply = SourceChannelResource::Reply::data;
+    } else if (name == "done") {
+      channel->reply = SourceChannelResource::Reply::done;
+    } else {
+      channel->reply = SourceChannelResource::Reply::error;
+    }
+
+    // Copying a refc binary only increments its refcount
+    enif_clear_env(channel->reply_env);
+    channel->reply_term = enif_make_copy(channel->reply_env, payload);
+    channel->has_reply = true;
+    channel->condition.notify_all();
+  }
+
+  return fine::Ok<>();
+}
+
+// This only copies terms and notifies the waiting thread, so it does
+// not need to run on a dirty scheduler.
+FINE_NIF(source_reply, 0);
+
+fine::Ok<> source_close(ErlNifEnv *env,
+                        fine::ResourcePtr<SourceChannelResource> channel) {
+  auto lock = std::unique_lock<std::mutex>(channel->mutex);
+  channel->closed = true;
+  channel->condition.notify_all();
+  return fine::Ok<>();
+}
+
+FINE_NIF(source_close, 0);
+
+// Requires GIL.
+PyObjectPtr py_range_new(ErlNifEnv *env, int64_t start, int64_t stop,
+                         int64_t step) {
+  auto py_range_type = get_builtin_types(env).range_type;
+
+  auto py_args = Py_BuildValue("(LLL)", static_cast<long long>(start),
+                               static_cast<long long>(stop),
+                               static_cast<long long>(step));
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_range = PyObject_Call(py_range_type, py_args, NULL);
+  raise_if_failed(env, py_range);
+
+  return py_range;
+}
+
+ExObject range_new(ErlNifEnv *env, int64_t start, int64_t stop,
+                   int64_t step) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  return make_ex_object(env, py_range_new(env, start, stop, step));
+}
+
+FINE_NIF(range_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject dict_new(ErlNifEnv *env) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_dict = PyDict_New();
+  raise_if_failed(env, py_dict);
+
+  return make_ex_object(env, py_dict);
+}
+
+FINE_NIF(dict_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> dict_set_item(ErlNifEnv *env, ExObject ex_object, ExObject ex_key,
+                         ExObject ex_value) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto result =
+      PyDict_SetItem(ex_object.py_object(), ex_key.py_object(),
+                     ex_value.py_object());
+  raise_if_failed(env, result);
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(dict_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject tuple_new(ErlNifEnv *env, uint64_t size) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_tuple = PyTuple_New(size);
+  raise_if_failed(env, py_tuple);
+
+  return make_ex_object(env, py_tuple);
+}
+
+FINE_NIF(tuple_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> tuple_set_item(ErlNifEnv *env, ExObject ex_object, uint64_t index,
+                          ExObject ex_value) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto result = PyTuple_SetItem(ex_object.py_object(), index,
+                                ex_value.py_object());
+  raise_if_failed(env, result);
+
+  // PyTuple_SetItem steals a reference, so we add one back
+  Py_IncRef(ex_value.py_object());
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(tuple_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject list_new(ErlNifEnv *env, uint64_t size) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_tuple = PyList_New(size);
+  raise_if_failed(env, py_tuple);
+
+  return make_ex_object(env, py_tuple);
+}
+
+FINE_NIF(list_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> list_set_item(ErlNifEnv *env, ExObject ex_object, uint64_t index,
+                         ExObject ex_value) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto result = PyList_SetItem(ex_object.py_object(), index,
+                               ex_value.py_object());
+  raise_if_failed(env, result);
+
+  // PyList_SetItem steals a reference, so we add one back
+  Py_IncRef(ex_value.py_object());
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(list_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject set_new(ErlNifEnv *env) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_set = PySet_New(NULL);
+  raise_if_failed(env, py_set);
+
+  return make_ex_object(env, py_set);
+}
+
+FINE_NIF(set_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+fine::Ok<> set_add(ErlNifEnv *env, ExObject ex_object, ExObject ex_key) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto result =
+      PySet_Add(ex_object.py_object(), ex_key.py_object());
+  raise_if_failed(env, result);
+
+  return fine::Ok<>();
+}
+
+FINE_NIF(set_add, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject pid_new(ErlNifEnv *env, ErlNifPid pid) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  // ErlNifPid is self-contained struct, not bound to any env, so it's
+  // safe to copy [1].
+  //
+  // [1]: https://www.erlang.org/doc/apps/erts/erl_nif.html#ErlNifPid
+  auto py_pid_bytes = PyBytes_FromStringAndSize(
+      reinterpret_cast<const char *>(&pid), sizeof(ErlNifPid));
+  raise_if_failed(env, py_pid_bytes);
+
+  auto py_PID = get_py_cache(env).pythonx_PID;
+
+  auto py_PID_args = PyTuple_Pack(1, py_pid_bytes);
+  raise_if_failed(env, py_PID_args);
+  auto py_PID_args_guard = PyDecRefGuard(py_PID_args);
+
+  auto py_pid = PyObject_Call(py_PID, py_PID_args, NULL);
+  raise_if_failed(env, py_pid);
+
+  return make_ex_object(env, py_pid);
+}
+
+FINE_NIF(pid_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject object_repr(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_repr = PyObject_Repr(ex_object.py_object());
+  raise_if_failed(env, py_repr);
+
+  return make_ex_object(env, py_repr);
+}
+
+FINE_NIF(object_repr, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+// Returns the existing atom for the given dict key, or raises if no
+// such atom exists.
+ERL_NIF_TERM existing_atom_from_key(ErlNifEnv *env, const char *name,
+                                    size_t size) {
+  ERL_NIF_TERM atom;
+  if (!enif_make_existing_atom_len(env, name, size, &atom, ERL_NIF_UTF8)) {
+    throw std::invalid_argument("cannot decode dict key \"" +
+                                std::string(name, size) +
+                                "\" as an atom, because it does not exist");
+  }
+
+  return atom;
+}
+
+// External Term Format [1] tags, used for integers over 64 bits,
+// which have no dedicated enif_make_* and enif_get_* functions.
+//
+// [1]: https://www.erlang.org/doc/apps/erts/erl_ext_dist.html
+namespace etf {
+constexpr uint8_t version = 131;
+constexpr uint8_t small_big_ext = 110;
+constexpr uint8_t large_big_ext = 111;
+} // namespace etf
+
+// Maximum nesting depth we traverse when converting whole structures
+// in a single pass. Deeper (or cyclic) structures are not supported
+// and the caller falls back to the regular path.
+constexpr int max_depth = 256;
+
+ERL_NIF_TERM py_long_to_term(ErlNifEnv *env, PyObjectPtr py_object) {
+  int overflow;
+  auto integer = PyLong_AsLongLongAndOverflow(py_object, &overflow);
+
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  if (overflow == 0) {
+    return enif_make_int64(env, integer);
+  }
+
+  // Integer over 64 bits, we build it from the binary magnitude
+  // (bignum), which takes linear time
+
+  bool negative;
+  auto bytes = py_long_to_magnitude(env, py_object, negative);
+  auto size = bytes.size();
+
+  auto data = std::vector<uint8_t>{etf::version};
+
+  if (size <= 255) {
+    data.push_back(etf::small_big_ext);
+    data.push_back(static_cast<uint8_t>(size));
+  } else {
+    data.push_back(etf::large_big_ext);
+    data.push_back(static_cast<uint8_t>(size >> 24));
+    data.push_back(static_cast<uint8_t>(size >> 16));
+    data.push_back(static_cast<uint8_t>(size >> 8));
+    data.push_back(static_cast<uint8_t>(size));
+  }
+
+  data.push_back(negative ? 1 : 0);
+  data.insert(data.end(), bytes.begin(), bytes.end());
+
+  ERL_NIF_TERM term;
+  if (enif_binary_to_term(env, data.data(), data.size(), &term, 0) == 0) {
+    throw std::runtime_error("failed to build integer term");
+  }
+
+  return term;
+}
+
+PyObjectPtr py_date_new(ErlNifEnv *env, long long year, long long month,
+                        long long day) {
+  auto &types = get_calendar_types(env);
+
+  auto py_args = Py_BuildValue("(LLL)", year, month, day);
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_date = PyObject_Call(types.date_type, py_args, NULL);
+  raise_if_failed(env, py_date);
+  return py_date;
+}
+
+PyObjectPtr py_time_new(ErlNifEnv *env, long long hour, long long minute,
+                        long long second, long long microsecond) {
+  auto &types = get_calendar_types(env);
+
+  auto py_args = Py_BuildValue("(LLLL)", hour, minute, second, microsecond);
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_time = PyObject_Call(types.time_type, py_args, NULL);
+  raise_if_failed(env, py_time);
+  return py_time;
+}
+
+// Converts the aware datetime to the zoneinfo time zone with the given
+// name. Returns NULL if the time zone is not available in Python, for
+// example when there is no system time zone database and the tzdata
+// package is not installed.
+PyObjectPtr py_datetime_to_zone(ErlNifEnv *env, PyObjectPtr py_datetime,
+                                const std::string &time_zone) {
+  auto &types = get_calendar_types(env);
+
+  auto py_name =
+      PyUnicode_FromStringAndSize(time_zone.data(), time_zone.size());
+  if (py_name == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+  auto py_name_guard = PyDecRefGuard(py_name);
+
+  auto py_zone_args = PyTuple_Pack(1, py_name);
+  raise_if_failed(env, py_zone_args);
+  auto py_zone_args_guard = PyDecRefGuard(py_zone_args);
+
+  auto py_zone = PyObject_Call(types.zone_info_type, py_zone_args, NULL);
+  if (py_zone == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+  auto py_zone_guard = PyDecRefGuard(py_zone);
+
+  auto py_astimezone = PyObject_GetAttrString(py_datetime, "astimezone");
+  raise_if_failed(env, py_astimezone);
+  auto py_astimezone_guard = PyDecRefGuard(py_astimezone);
+
+  auto py_astimezone_args = PyTuple_Pack(1, py_zone);
+  raise_if_failed(env, py_astimezone_args);
+  auto py_astimezone_args_guard = PyDecRefGuard(py_astimezone_args);
+
+  // The conversion preserves the point in time, so if the time zone
+  // database differs from the Elixir one, only the wall time differs
+  auto py_zoned = PyObject_Call(py_astimezone, py_astimezone_args, NULL);
+  if (py_zoned == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+
+  return py_zoned;
+}
+
+// Builds a datetime, which is aware when utc_offset is given. The
+// time zone is looked up with zoneinfo, falling back to a fixed
+// offset, which represents the same point in time.
+PyObjectPtr py_datetime_new(ErlNifEnv *env, long long year, long long month,
+                            long long day, long long hour, long long minute,
+                            long long second, long long microsecond,
+                            std::optional<int64_t> utc_offset,
+                            const std::optional<std::string> &time_zone) {
+  auto &types = get_calendar_types(env);
+
+  auto py_tzinfo = Py_BuildValue("");
+  raise_if_failed(env, py_tzinfo);
+  auto py_tzinfo_guard = PyDecRefGuard(py_tzinfo);
+
+  if (utc_offset && *utc_offset == 0) {
+    py_tzinfo = types.utc;
+    Py_IncRef(py_tzinfo);
+    py_tzinfo_guard = py_tzinfo;
+  } else if (utc_offset) {
+    auto py_delta_args =
+        Py_BuildValue("(iL)", 0, static_cast<long long>(*utc_offset));
+    raise_if_failed(env, py_delta_args);
+    auto py_delta_args_guard = PyDecRefGuard(py_delta_args);
+
+    auto py_delta = PyObject_Call(types.timedelta_type, py_delta_args, NULL);
+    raise_if_failed(env, py_delta);
+    auto py_delta_guard = PyDecRefGuard(py_delta);
+
+    auto py_timezone_args = PyTuple_Pack(1, py_delta);
+    raise_if_failed(env, py_timezone_args);
+    auto py_timezone_args_guard = PyDecRefGuard(py_timezone_args);
+
+    py_tzinfo = PyObject_Call(types.timezone_type, py_timezone_args, NULL);
+    raise_if_failed(env, py_tzinfo);
+    py_tzinfo_guard = py_tzinfo;
+  }
+
+  auto py_args = Py_BuildValue("(LLLLLLLO)", year, month, day, hour, minute,
+                               second, microsecond, py_tzinfo);
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_datetime = PyObject_Call(types.datetime_type, py_args, NULL);
+  raise_if_failed(env, py_datetime);
+
+  if (utc_offset && time_zone && *time_zone != "Etc/UTC") {
+    auto py_zoned = py_datetime_to_zone(env, py_datetime, *time_zone);
+    if (py_zoned != NULL) {
+      Py_DecRef(py_datetime);
+      return py_zoned;
+    }
+  }
+
+  return py_datetime;
+}
+
+// Builds a Decimal from its string representation, which is exact,
+// regardless of the decimal context precision.
+PyObjectPtr py_decimal_new(ErlNifEnv *env, const char *string, size_t size) {
+  auto &types = get_calendar_types(env);
+
+  auto py_string = PyUnicode_FromStringAndSize(string, size);
+  raise_if_failed(env, py_string);
+  auto py_string_guard = PyDecRefGuard(py_string);
+
+  auto py_args = PyTuple_Pack(1, py_string);
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_decimal = PyObject_Call(types.decimal_type, py_args, NULL);
+  raise_if_failed(env, py_decimal);
+  return py_decimal;
+}
+
+int64_t get_int_attr(ErlNifEnv *env, PyObjectPtr py_object,
+                     const char *name) {
+  auto py_attr = PyObject_GetAttrString(py_object, name);
+  raise_if_failed(env, py_attr);
+  auto py_attr_guard = PyDecRefGuard(py_attr);
+
+  int overflow;
+  auto integer = PyLong_AsLongLongAndOverflow(py_attr, &overflow);
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  return integer;
+}
+
+ERL_NIF_TERM make_struct(ErlNifEnv *env, const char *module,
+                         std::vector<std::tuple<const char *, ERL_NIF_TERM>>
+                             fields) {
+  auto keys = std::vector<ERL_NIF_TERM>();
+  auto values = std::vector<ERL_NIF_TERM>();
+
+  keys.push_back(fine::encode(env, fine::Atom("__struct__")));
+  values.push_back(fine::encode(env, fine::Atom(module)));
+
+  for (auto &[key, value] : fields) {
+    keys.push_back(fine::encode(env, fine::Atom(key)));
+    values.push_back(value);
+  }
+
+  ERL_NIF_TERM term;
+  enif_make_map_from_arrays(env, keys.data(), values.data(), keys.size(),
+                            &term);
+  return term;
+}
+
+// Returns the calendar fields of a date, time or datetime object, in
+// the Elixir struct field order.
+std::vector<std::tuple<const char *, ERL_NIF_TERM>>
+calendar_fields(ErlNifEnv *env, PyObjectPtr py_object, bool date, bool time) {
+  auto fields = std::vector<std::tuple<const char *, ERL_NIF_TERM>>();
+
+  auto field = [&](const char *key, const char *attr) {
+    fields.push_back(
+        {key, enif_make_int64(env, get_int_attr(env, py_object, attr))});
+  };
+
+  fields.push_back(
+      {"calendar", fine::encode(env, fine::Atom("Elixir.Calendar.ISO"))});
+
+  if (date) {
+    field("year", "year");
+    field("month", "month");
+    field("day", "day");
+  }
+
+  if (time) {
+    field("hour", "hour");
+    field("minute", "minute");
+    field("second", "second");
+
+    // Python does not track precision, so we assume microseconds,
+    // unless there are none
+    auto microsecond = get_int_attr(env, py_object, "microsecond");
+    auto precision = microsecond == 0 ? 0 : 6;
+    fields.push_back({"microsecond",
+                      fine::encode(env, std::make_tuple(microsecond,
+                                                        int64_t(precision)))});
+  }
+
+  return fields;
+}
+
+// Checks if the given datetime is aware, that is, it has a UTC offset.
+bool py_is_aware(ErlNifEnv *env, PyObjectPtr py_object) {
+  auto py_utcoffset = PyObject_GetAttrString(py_object, "utcoffset");
+  raise_if_failed(env, py_utcoffset);
+  auto py_utcoffset_guard = PyDecRefGuard(py_utcoffset);
+
+  auto py_offset = PyObject_CallNoArgs(py_utcoffset);
+  raise_if_failed(env, py_offset);
+  auto py_offset_guard = PyDecRefGuard(py_offset);
+
+  auto is_none = Py_IsNone(py_offset);
+  raise_if_failed(env, is_none);
+  return !is_none;
+}
+
+ERL_NIF_TERM py_decimal_to_term(ErlNifEnv *env, PyObjectPtr py_object) {
+  auto py_as_tuple = PyObject_GetAttrString(py_object, "as_tuple");
+  raise_if_failed(env, py_as_tuple);
+  auto py_as_tuple_guard = PyDecRefGuard(py_as_tuple);
+
+  auto py_tuple = PyObject_CallNoArgs(py_as_tuple);
+  raise_if_failed(env, py_tuple);
+  auto py_tuple_guard = PyDecRefGuard(py_tuple);
+
+  // DecimalTuple(sign, digits, exponent)
+  auto py_sign = PyTuple_GetItem(py_tuple, 0);
+  raise_if_failed(env, py_sign);
+  auto py_digits = PyTuple_GetItem(py_tuple, 1);
+  raise_if_failed(env, py_digits);
+  auto py_exponent = PyTuple_GetItem(py_tuple, 2);
+  raise_if_failed(env, py_exponent);
+
+  int overflow;
+  auto sign = PyLong_AsLongLongAndOverflow(py_sign, &overflow) == 0 ? 1 : -1;
+  if (PyErr_Occurred() != NULL) {
+    raise_py_error(env);
+  }
+
+  ERL_NIF_TERM coef;
+  int64_t exp = 0;
+
+  auto exponent = PyLong_AsLongLongAndOverflow(py_exponent, &overflow);
+
+  if (PyErr_Occurred() != NULL) {
+    // For special values the exponent is one of 'n' (NaN), 'N'
+    // (signaling NaN) or 'F' (infinity)
+    PyErr_Clear();
+
+    Py_ssize_t size;
+    auto buffer = PyUnicode_AsUTF8AndSize(py_exponent, &size);
+    raise_if_failed(env, buffer);
+
+    coef = fine::encode(
+        env, fine::Atom(std::string(buffer, size) == "F" ? "inf" : "NaN"));
+  } else {
+    exp = exponent;
+
+    auto size = PyTuple_Size(py_digits);
+    raise_if_failed(env, size);
+
+    auto digits = std::string();
+    digits.reserve(size);
+
+    for (Py_ssize_t i = 0; i < size; i++) {
+      auto py_digit = PyTuple_GetItem(py_digits, i);
+      raise_if_failed(env, py_digit);
+
+      auto digit = PyLong_AsLongLongAndOverflow(py_digit, &overflow);
+      if (PyErr_Occurred() != NULL) {
+        raise_py_error(env);
+      }
+
+      digits.push_back(static_cast<char>('0' + digit));
+    }
+
+    if (digits.size() <= 18) {
+      coef = enif_make_int64(env, std::stoll(digits));
+    } else {
+      // The coefficient does not fit in 64 bits, so we let Python
+      // parse it and convert the resulting integer
+      auto py_int_type = get_builtin_types(env).int_type;
+
+      auto py_digits_str =
+          PyUnicode_FromStringAndSize(digits.data(), digits.size());
+      raise_if_failed(env, py_digits_str);
+      auto py_digits_str_guard = PyDecRefGuard(py_digits_str);
+
+      auto py_args = PyTuple_Pack(1, py_digits_str);
+      raise_if_failed(env, py_args);
+      auto py_args_guard = PyDecRefGuard(py_args);
+
+      auto py_coef = PyObject_Call(py_int_type, py_args, NULL);
+      raise_if_failed(env, py_coef);
+      auto py_coef_guard = PyDecRefGuard(py_coef);
+
+      coef = py_long_to_term(env, py_coef);
+    }
+  }
+
+  return make_struct(env, "Elixir.Decimal",
+                     {{"coef", coef},
+                      {"exp", enif_make_int64(env, exp)},
+                      {"sign", enif_make_int64(env, sign)}});
+}
+
+// Converts datetime.date, datetime.time, datetime.datetime and
+// decimal.Decimal objects into the corresponding Elixir structs.
+//
+// Aware datetimes are converted to UTC, since Elixir time zones other
+// than UTC require a time zone database. Aware times are not
+// supported.
+//
+// Decimal objects are converted only when the decimal flag is set,
+// that is, when the Decimal module is available on the Elixir side.
+//
+// Returns false if the object is not one of the supported types.
+//
+// Requires GIL.
+bool py_calendar_to_term(ErlNifEnv *env, PyObjectPtr py_object, bool decimal,
+                         ERL_NIF_TERM &term) {
+  auto &types = get_calendar_types(env);
+
+  // Note that datetime is a subclass of date, so we check it first
+  if (py_is_instance(env, py_object, types.datetime_type)) {
+    if (!py_is_aware(env, py_object)) {
+      term = make_struct(env, "Elixir.NaiveDateTime",
+                         calendar_fields(env, py_object, true, true));
+      return true;
+    }
+
+    auto py_astimezone = PyObject_GetAttrString(py_object, "astimezone");
+    raise_if_failed(env, py_astimezone);
+    auto py_astimezone_guard = PyDecRefGuard(py_astimezone);
+
+    auto py_args = PyTuple_Pack(1, types.utc);
+    raise_if_failed(env, py_args);
+    auto py_args_guard = PyDecRefGuard(py_args);
+
+    auto py_utc_datetime = PyObject_Call(py_astimezone, py_args, NULL);
+    raise_if_failed(env, py_utc_datetime);
+    auto py_utc_datetime_guard = PyDecRefGuard(py_utc_datetime);
+
+    auto fields = calendar_fields(env, py_utc_datetime, true, true);
+    fields.push_back({"std_offset", enif_make_int64(env, 0)});
+    fields.push_back({"time_zone", fine::encode(env, std::string("Etc/UTC"))});
+    fields.push_back({"utc_offset", enif_make_int64(env, 0)});
+    fields.push_back({"zone_abbr", fine::encode(env, std::string("UTC"))});
+
+    term = make_struct(env, "Elixir.DateTime", fields);
+    return true;
+  }
+
+  if (py_is_instance(env, py_object, types.date_type)) {
+    term = make_struct(env, "Elixir.Date",
+                       calendar_fields(env, py_object, true, false));
+    return true;
+  }
+
+  if (py_is_instance(env, py_object, types.time_type)) {
+    auto py_tzinfo = PyObject_GetAttrString(py_object, "tzinfo");
+    raise_if_failed(env, py_tzinfo);
+    auto py_tzinfo_guard = PyDecRefGuard(py_tzinfo);
+
+    auto is_naive = Py_IsNone(py_tzinfo);
+    raise_if_failed(env, is_naive);
+    if (!is_naive) {
+      return false;
+    }
+
+    term = make_struct(env, "Elixir.Time",
+                       calendar_fields(env, py_object, false, true));
+    return true;
+  }
+
+  if (decimal && py_is_instance(env, py_object, types.decimal_type)) {
+    term = py_decimal_to_term(env, py_object);
+    return true;
+  }
+
+  return false;
+}
+
+// A Python class registered for an Elixir struct, see
+// struct_class_register.
+//
+// The class is constructed with positional arguments, so we keep the
+// struct keys in the order of constructor arguments. All other struct
+// keys are filled in with their default values when decoding.
+//
+// Requires GIL for destruction.
+struct StructClass {
+  std::string module;
+  // New reference
+  PyObjectPtr py_class;
+  // Owns the terms below
+  ErlNifEnv *env;
+  ERL_NIF_TERM module_term;
+  // All struct keys, other than __struct__, with their default values
+  std::vector<std::string> key_names;
+  std::vector<ERL_NIF_TERM> keys;
+  std::vector<ERL_NIF_TERM> defaults;
+  // Interned attribute name for every struct key, or NULL if the key
+  // is not a class field
+  std::vector<PyObjectPtr> py_attrs;
+  // Struct key indices in the order of constructor arguments
+  std::vector<size_t> field_keys;
+
+  StructClass(fine::Atom module, PyObjectPtr py_class)
+      : module(module.to_string()), py_class(py_class),
+        env(enif_alloc_env()) {
+    Py_IncRef(py_class);
+    this->module_term = fine::encode(this->env, module);
+  }
+
+  ~StructClass() {
+    Py_DecRef(this->py_class);
+
+    for (auto py_attr : this->py_attrs) {
+      if (py_attr != NULL) {
+        Py_DecRef(py_attr);
+      }
+    }
+
+    enif_free_env(this->env);
+  }
+};
+
+// Registered struct classes, keyed both by the struct module name and
+// by the class. Entries are shared, so that a class replaced while in
+// use is only released once the current user is done.
+//
+// Accessed only with the GIL held.
+struct StructClassRegistry {
+  std::unordered_map<std::string, std::shared_ptr<StructClass>> by_module;
+  std::unordered_map<PyObjectPtr, std::shared_ptr<StructClass>> by_class;
+};
+
+StructClassRegistry &get_struct_class_registry() {
+  // The entries hold Python references, which must not be released
+  // on exit, so the registry is intentionally never freed
+  static auto registry = new StructClassRegistry();
+  return *registry;
+}
+
+// Returns the struct class registered for the exact type of the given
+// object, if any.
+//
+// Requires GIL.
+std::shared_ptr<StructClass> find_struct_class(PyObjectPtr py_object) {
+  auto &registry = get_struct_class_registry();
+
+  if (registry.by_class.empty()) {
+    return nullptr;
+  }
+
+  // The object keeps its type alive, so we only need the pointer
+  auto py_type = PyObject_Type(py_object);
+  Py_DecRef(py_type);
+
+  auto it = registry.by_class.find(py_type);
+  if (it == registry.by_class.end()) {
+    return nullptr;
+  }
+
+  return it->second;
+}
+
+// Requires GIL.
+std::shared_ptr<StructClass> find_struct_class(const std::string &module) {
+  auto &registry = get_struct_class_registry();
+
+  auto it = registry.by_module.find(module);
+  if (it == registry.by_module.end()) {
+    return nullptr;
+  }
+
+  return it->second;
+}
+
+// Converts the given object into a term, with container items as
+// %Pythonx.Object{}, see decode_once.
+//
+// Requires GIL.
+fine::Term decode_py_object(ErlNifEnv *env, ExObject ex_object,
+                            bool atom_keys, bool decimal) {
+  auto py_object = ex_object.py_object();
+
+  // Container items inherit the tag of the decoded object
+  auto tag_guard = ObjectTagGuard(
+      object_registry.is_enabled() ? ex_object.tag() : std::nullopt);
+
+  auto is_none = Py_IsNone(py_object);
+  raise_if_failed(env, is_none);
+  if (is_none) {
+    return fine::encode(env, std::nullopt);
+  }
+
+  auto is_true = Py_IsTrue(py_object);
+  raise_if_failed(env, is_true);
+  if (is_true) {
+    return fine::encode(env, true);
+  }
+
+  auto is_false = Py_IsFalse(py_object);
+  raise_if_failed(env, is_false);
+  if (is_false) {
+    return fine::encode(env, false);
+  }
+
+  // Registered classes may be tuple subclasses (namedtuple), so we
+  // check them before the built-in types
+  if (auto struct_class = find_struct_class(py_object)) {
+    auto fields = std::vector<ERL_NIF_TERM>();
+    fields.reserve(struct_class->field_keys.size());
+
+    auto group = make_group(env);
+
+    for (auto key_index : struct_class->field_keys) {
+      auto py_value =
+          PyObject_GetAttr(py_object, struct_class->py_attrs[key_index]);
+      raise_if_failed(env, py_value);
+      auto ex_value = make_group_ex_object(group, py_value);
+      auto key = enif_make_copy(env, struct_class->keys[key_index]);
+      fields.push_back(
+          fine::encode(env, std::make_tuple(fine::Term(key), ex_value)));
+    }
+
+    auto module = enif_make_copy(env, struct_class->module_term);
+    auto items = enif_make_list_from_array(
+        env, fields.data(), static_cast<unsigned int>(fields.size()));
+    return fine::encode(env, std::make_tuple(atoms::struct_, fine::Term(module),
+                                             fine::Term(items)));
+  }
+
+  auto &types = get_builtin_types(env);
+
+  auto py_int_type = types.int_type;
+  auto is_long = PyObject_IsInstance(py_object, py_int_type);
+  raise_if_failed(env, is_long);
+  if (is_long) {
+    return py_long_to_term(env, py_object);
+  }
+
+  auto py_float_type = types.float_type;
+  auto is_float = PyObject_IsInstance(py_object, py_float_type);
+  raise_if_failed(env, is_float);
+  if (is_float) {
+    double number = PyFloat_AsDouble(py_object);
+    if (PyErr_Occurred() != NULL) {
+      raise_py_error(env);
+    }
+
+    return enif_make_double(env, number);
+  }
+
+  auto py_tuple_type = types.tuple_type;
+  auto is_tuple = PyObject_IsInstance(py_object, py_tuple_type);
+  raise_if_failed(env, is_tuple);
+  if (is_tuple) {
+    auto size = PyTuple_Size(py_object);
+    raise_if_failed(env, size);
+
+    auto terms = std::vector<ERL_NIF_TERM>();
+    terms.reserve(size);
+
+    auto group = make_group(env);
+
+    for (Py_ssize_t i = 0; i < size; i++) {
+      auto py_item = PyTuple_GetItem(py_object, i);
+      raise_if_failed(env, py_item);
+      Py_IncRef(py_item);
+      auto ex_item = make_group_ex_object(group, py_item);
+      terms.push_back(fine::encode(env, ex_item));
+    }
+
+    auto items = enif_make_list_from_array(env, terms.data(),
+                                           static_cast<unsigned int>(size));
+    return fine::encode(env, std::make_tuple(atoms::tuple, fine::Term(items)));
+  }
+
+  auto py_list_type = types.list_type;
+  auto is_list = PyObject_IsInstance(py_object, py_list_type);
+  raise_if_failed(env, is_list);
+  if (is_list) {
+    auto size = PyList_Size(py_object);
+    raise_if_failed(env, size);
+
+    auto terms = std::vector<ERL_NIF_TERM>();
+    terms.reserve(size);
+
+    auto group = make_group(env);
+
+    for (Py_ssize_t i = 0; i < size; i++) {
+      auto py_item = PyList_GetItem(py_object, i);
+      raise_if_failed(env, py_item);
+      Py_IncRef(py_item);
+      auto ex_item = make_group_ex_object(group, py_item);
+      terms.push_back(fine::encode(env, ex_item));
+    }
+
+    auto items = enif_make_list_from_array(env, terms.data(),
+                                           static_cast<unsigned int>(size));
+    return fine::encode(env, std::make_tuple(atoms::list, fine::Term(items)));
+  }
+
+  auto py_dict_type = types.dict_type;
+  auto is_dict = PyObject_IsInstance(py_object, py_dict_type);
+  raise_if_failed(env, is_dict);
+  if (is_dict) {
+    auto size = PyDict_Size(py_object);
+    raise_if_failed(env, size);
+
+    auto terms = std::vector<ERL_NIF_TERM>();
+    terms.reserve(size);
+
+    auto group = make_group(env);
+
+    auto py_str_type = types.str_type;
+
+    PyObjectPtr py_key, py_value;
+    Py_ssize_t pos = 0;
+
+    while (PyDict_Next(py_object, &pos, &py_key, &py_value)) {
+      Py_IncRef(py_value);
+      auto ex_value = make_group_ex_object(group, py_value);
+
+      // With atom keys, str keys are converted right away, while other
+      // keys are decoded as usual
+      if (atom_keys && py_is_instance(env, py_key, py_str_type)) {
+        Py_ssize_t size;
+        auto buffer = PyUnicode_AsUTF8AndSize(py_key, &size);
+        raise_if_failed(env, buffer);
+
+        auto key = existing_atom_from_key(env, buffer, size);
+        terms.push_back(
+            fine::encode(env, std::make_tuple(fine::Term(key), ex_value)));
+      } else {
+        Py_IncRef(py_key);
+        auto ex_key = make_group_ex_object(group, py_key);
+        terms.push_back(fine::encode(env, std::make_tuple(ex_key, ex_value)));
+      }
+    }
+
+    auto items = enif_make_list_from_array(env, terms.data(),
+                                           static_cast<unsigned int>(size));
+    return fine::encode(env, std::make_tuple(atoms::map, fine::Term(items)));
+  }
+
+  auto py_str_type = types.str_type;
+  auto is_unicode = PyObject_IsInstance(py_object, py_str_type);
+  raise_if_failed(env, is_unicode);
+  if (is_unicode) {
+    return py_str_to_binary_term(env, py_object);
+  }
+
+  auto py_bytes_type = types.bytes_type;
+  auto is_bytes = PyObject_IsInstance(py_object, py_bytes_type);
+  raise_if_failed(env, is_bytes);
+  if (is_bytes) {
+    return py_bytes_to_binary_term(env, py_object);
+  }
+
+  auto py_bytearray_type = types.bytearray_type;
+  auto is_bytearray = PyObject_IsInstance(py_object, py_bytearray_type);
+  raise_if_failed(env, is_bytearray);
+  auto py_memoryview_type = types.memoryview_type;
+  auto is_memoryview = PyObject_IsInstance(py_object, py_memoryview_type);
+  raise_if_failed(env, is_memoryview);
+  if (is_bytearray || is_memoryview) {
+    return py_buffer_to_binary_term(env, py_object, false);
+  }
+
+  auto py_set_type = types.set_type;
+  auto is_set = PyObject_IsInstance(py_object, py_set_type);
+  raise_if_failed(env, is_set);
+  auto py_frozenset_type = types.frozenset_type;
+  auto is_frozenset = PyObject_IsInstance(py_object, py_frozenset_type);
+  raise_if_failed(env, is_frozenset);
+  if (is_set || is_frozenset) {
+    auto size = PySet_Size(py_object);
+    raise_if_failed(env, size);
+
+    auto terms = std::vector<ERL_NIF_TERM>();
+    terms.reserve(size);
+
+    auto py_iter = PyObject_GetIter(py_object);
+    raise_if_failed(env, py_iter);
+    auto py_iter_guard = PyDecRefGuard(py_iter);
+
+    auto group = make_group(env);
+
+    PyObjectPtr py_item = NULL;
+
+    while ((py_item = PyIter_Next(py_iter)) != NULL) {
+      // Note that PyIter_Next already returns a new reference
+      auto ex_item = make_group_ex_object(group, py_item);
+      terms.push_back(fine::encode(env, ex_item));
+    }
 
-  auto format_exception =
-      PyObject_GetAttrString(py_traceback_module, "format_exception");
-  raise_if_failed(env, format_exception);
-  auto format_exception_guard = PyDecRefGuard(format_exception);
+    if (PyErr_Occurred() != NULL) {
+      raise_py_error(env);
+    }
 
-  auto format_exception_args = PyTuple_Pack(3, py_type, py_value, py_traceback);
-  raise_if_failed(env, format_exception_args);
-  auto format_exception_args_guard = PyDecRefGuard(format_exception_args);
+    auto items = enif_make_list_from_array(env, terms.data(),
+                                           static_cast<unsigned int>(size));
+    return fine::encode(env,
+                        std::make_tuple(atoms::map_set, fine::Term(items)));
+  }
 
-  auto py_lines = PyObject_Call(format_exception, format_exception_args, NULL);
-  raise_if_failed(env, py_lines);
-  auto py_lines_guard = PyDecRefGuard(py_lines);
+  ERL_NIF_TERM calendar_term;
+  if (py_calendar_to_term(env, py_object, decimal, calendar_term)) {
+    return fine::Term(calendar_term);
+  }
 
-  auto size = PyList_Size(py_lines);
-  raise_if_failed(env, size);
+  auto py_PID = get_py_cache(env).pythonx_PID;
 
-  auto terms = std::vector<fine::Term>();
-  terms.reserve(size);
+  auto is_pid = PyObject_IsInstance(py_object, py_PID);
+  raise_if_failed(env, is_pid);
+  if (is_pid) {
+    auto py_pid_bytes = PyObject_GetAttrString(py_object, "bytes");
+    raise_if_failed(env, py_pid_bytes);
+    auto py_pid_bytes_guard = PyDecRefGuard(py_pid_bytes);
 
-  for (Py_ssize_t i = 0; i < size; i++) {
-    auto py_line = PyList_GetItem(py_lines, i);
-    raise_if_failed(env, py_line);
+    Py_ssize_t size;
+    char *pid_bytes;
+    auto result = PyBytes_AsStringAndSize(py_pid_bytes, &pid_bytes, &size);
+    raise_if_failed(env, result);
 
-    terms.push_back(py_str_to_binary_term(env, py_line));
+    auto pid = ErlNifPid{};
+    std::memcpy(&pid, pid_bytes, sizeof(ErlNifPid));
+
+    return fine::encode(env, pid);
   }
 
-  return terms;
+  // None of the built-ins, return %Pythonx.Object{} as is
+  return fine::encode(env, ex_object);
 }
 
-fine::Ok<> init(ErlNifEnv *env, std::string python_dl_path,
-                ErlNifBinary python_home_path,
-                ErlNifBinary python_executable_path,
-                std::vector<ErlNifBinary> sys_paths) {
-  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+fine::Term decode_once(ErlNifEnv *env, ExObject ex_object, bool atom_keys,
+                       bool decimal) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  if (is_initialized) {
-    throw std::runtime_error("Python interpreter has already been initialized");
-  }
+  return decode_py_object(env, ex_object, atom_keys, decimal);
+}
 
-  // Raises runtime error on failure, which is propagated automatically
-  load_python_library(python_dl_path);
+FINE_NIF(decode_once, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-  // The path needs to be available for the whole interpreter lifetime,
-  // so we store it in a global variable.
-  python_home_path_w = std::wstring(
-      python_home_path.data, python_home_path.data + python_home_path.size);
+ExObject date_new(ErlNifEnv *env, int64_t year, int64_t month, int64_t day) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  python_executable_path_w =
-      std::wstring(python_executable_path.data,
-                   python_executable_path.data + python_executable_path.size);
+  return make_ex_object(env, py_date_new(env, year, month, day));
+}
 
-  // As part of the initialization, sys.path gets set. It is important
-  // that it gets set correctly, so that the built-in modules can be
-  // found, otherwise the initialization fails. This logic is internal
-  // to Python, but we can configure base paths used to infer sys.path.
-  // The Limited API exposes Py_SetPythonHome and Py_SetProgramName and
-  // it appears that setting either of them alone should be sufficient.
-  //
-  // Py_SetProgramName has the advantage that, when set to the executable
-  // inside venv, it results in the packages directory being added to
-  // sys.path automatically, however, when tested, this did not work
-  // as expected in Python 3.10 on Windows. For this reason we prefer
-  // to use Py_SetPythonHome and add other paths to sys.path manually.
-  //
-  // Even then, we still want to set Py_SetProgramName to a Python
-  // executable, otherwise `sys.executable` is going to point to the
-  // BEAM executable (`argv[0]`), which can be problematic.
-  //
-  // In the end, the most reliable combination seems to be to set both,
-  // and also add the extra sys.path manually.
-  //
-  // Note that Python home is the directory with lib/ child directory
-  // containing the built-in Python modules [1].
-  //
-  // [1]: https://docs.python.org/3/using/cmdline.html#envvar-PYTHONHOME
-  Py_SetPythonHome(python_home_path_w.c_str());
-  Py_SetProgramName(python_executable_path_w.c_str());
+FINE_NIF(date_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-  Py_InitializeEx(0);
+ExObject time_new(ErlNifEnv *env, int64_t hour, int64_t minute,
+                  int64_t second, int64_t microsecond) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  interpreter_state = PyInterpreterState_Get();
+  return make_ex_object(env,
+                        py_time_new(env, hour, minute, second, microsecond));
+}
 
-  // In order to use any of the Python C API functions, the calling
-  // thread must hold the GIL. Since every NIF call may run on a
-  // different dirty scheduler thread, we need to acquire the GIL at
-  // the beginning of each NIF and release it afterwards.
-  //
-  // After initializing the Python interpreter above, the current
-  // thread automatically holds the GIL, so we explicitly release it.
-  // See pyo3 [1] for an extra reference.
-  //
-  // [1]: https://github.com/PyO3/pyo3/blob/v0.23.3/src/gil.rs#L63-L74
-  thread_states[std::this_thread::get_id()] = PyEval_SaveThread();
+FINE_NIF(time_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-  is_initialized = true;
+ExObject datetime_new(ErlNifEnv *env, int64_t year, int64_t month,
+                      int64_t day, int64_t hour, int64_t minute,
+                      int64_t second, int64_t microsecond,
+                      std::optional<int64_t> utc_offset,
+                      std::optional<std::string> time_zone) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  // We still hold the init_mutex, so we can obtain the GIL guard
-  // before any other concurrent NIF. At this point we marked the
-  // interpreter as initialized and now we continue with further
-  // preparation using Python APIs. If any exception is subsequently
-  // raised, it will propagate as expected, and since the interpreter
-  // is initialized, the exception formatting will also work.
+  return make_ex_object(env, py_datetime_new(env, year, month, day, hour,
+                                             minute, second, microsecond,
+                                             utc_offset, time_zone));
+}
+
+FINE_NIF(datetime_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+ExObject decimal_new(ErlNifEnv *env, ErlNifBinary string) {
+  ensure_initialized();
   auto gil_guard = PyGILGuard();
 
-  // Add extra paths to sys.path
+  return make_ex_object(
+      env, py_decimal_new(env, reinterpret_cast<const char *>(string.data),
+                          string.size));
+}
 
-  auto py_sys = PyImport_AddModule("sys");
-  raise_if_failed(env, py_sys);
+FINE_NIF(decimal_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-  auto py_sys_path = PyObject_GetAttrString(py_sys, "path");
-  raise_if_failed(env, py_sys_path);
-  auto py_sys_path_guard = PyDecRefGuard(py_sys_path);
+std::vector<fine::Atom> struct_class_register(
+    ErlNifEnv *env, fine::Atom module, ExObject ex_class,
+    std::vector<std::tuple<fine::Atom, fine::Term>> defaults) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  for (const auto &path : sys_paths) {
-    auto py_path = PyUnicode_FromStringAndSize(
-        reinterpret_cast<const char *>(path.data), path.size);
-    raise_if_failed(env, py_path);
-    auto py_path_guard = PyDecRefGuard(py_path);
+  auto py_class = ex_class.py_object();
 
-    raise_if_failed(env, PyList_Append(py_sys_path, py_path));
+  auto py_struct_fields = get_py_cache(env).pythonx_struct_fields;
+
+  auto py_args = PyTuple_Pack(1, py_class);
+  raise_if_failed(env, py_args);
+  auto py_args_guard = PyDecRefGuard(py_args);
+
+  auto py_fields = PyObject_Call(py_struct_fields, py_args, NULL);
+  raise_if_failed(env, py_fields);
+  auto py_fields_guard = PyDecRefGuard(py_fields);
+
+  auto size = PyList_Size(py_fields);
+  raise_if_failed(env, size);
+
+  auto struct_class = std::make_shared<StructClass>(module, py_class);
+
+  for (auto &[key, value] : defaults) {
+    struct_class->key_names.push_back(key.to_string());
+    struct_class->keys.push_back(fine::encode(struct_class->env, key));
+    struct_class->defaults.push_back(enif_make_copy(struct_class->env, value));
+    struct_class->py_attrs.push_back(NULL);
   }
 
-  // Define global stdout and stdin overrides
+  auto fields = std::vector<fine::Atom>();
 
-  auto py_builtins = PyEval_GetBuiltins();
-  raise_if_failed(env, py_builtins);
+  for (Py_ssize_t i = 0; i < size; i++) {
+    auto py_field = PyList_GetItem(py_fields, i);
+    raise_if_failed(env, py_field);
+
+    Py_ssize_t field_size;
+    auto buffer = PyUnicode_AsUTF8AndSize(py_field, &field_size);
+    raise_if_failed(env, buffer);
+    auto field = std::string(buffer, field_size);
+
+    auto &key_names = struct_class->key_names;
+    auto it = std::find(key_names.begin(), key_names.end(), field);
+    if (it == key_names.end()) {
+      throw std::invalid_argument("expected the Python class fields to be "
+                                  "struct fields, but the struct has no "
+                                  "field :" +
+                                  field);
+    }
 
-  auto py_exec = PyDict_GetItemString(py_builtins, "exec");
-  raise_if_failed(env, py_exec);
+    auto key_index = static_cast<size_t>(it - key_names.begin());
 
-  const char code[] = R"(
-import ctypes
-import io
-import sys
-import inspect
-import types
-import sys
+    // Attribute names are interned, so that attribute lookups are
+    // cheap and instances do not allocate new strings
+    auto py_attr = PyUnicode_InternFromString(field.c_str());
+    raise_if_failed(env, py_attr);
+    struct_class->py_attrs[key_index] = py_attr;
 
-pythonx_handle_io_write = ctypes.CFUNCTYPE(
-  None, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_bool
-)(pythonx_handle_io_write_ptr)
+    struct_class->field_keys.push_back(key_index);
+    fields.push_back(fine::Atom(field));
+  }
 
-pythonx_handle_send_tagged_object = ctypes.CFUNCTYPE(
-  None, ctypes.c_char_p, ctypes.c_char_p, ctypes.py_object, ctypes.c_char_p
-)(pythonx_handle_send_tagged_object_ptr)
+  auto &registry = get_struct_class_registry();
 
+  // Drop the previous registrations of both the struct and the class
+  auto previous_class = registry.by_module.find(struct_class->module);
+  if (previous_class != registry.by_module.end()) {
+    registry.by_class.erase(previous_class->second->py_class);
+    registry.by_module.erase(previous_class);
+  }
 
-def get_eval_info_bytes():
-  # The evaluation caller has __pythonx_eval_info_bytes__ set in
-  # their globals. It is not available in globals() here, because
-  # the globals dict in function definitions is fixed at definition
-  # time. To find the current evaluation globals, we look at the
-  # call stack using the inspect module and find the caller with
-  # __pythonx_eval_info_bytes__ in globals. We look specifically
-  # for the outermost caller, because intermediate functions could
-  # be defined by previous evaluations, in which case they would
-  # have __pythonx_eval_info_bytes__ in their globals, corresponding
-  # to that previous evaluation. When called within a thread, the
-  # evaluation caller is not in the stack, so __pythonx_eval_info_bytes__
-  # will be found in the thread entrypoint function globals.
-  call_stack = inspect.stack()
-  eval_info_bytes = next(
-    frame_info.frame.f_globals["__pythonx_eval_info_bytes__"]
-    for frame_info in reversed(call_stack)
-    if "__pythonx_eval_info_bytes__" in frame_info.frame.f_globals
-  )
-  return eval_info_bytes
+  auto previous_module = registry.by_class.find(py_class);
+  if (previous_module != registry.by_class.end()) {
+    registry.by_module.erase(previous_module->second->module);
+    registry.by_class.erase(previous_module);
+  }
 
+  registry.by_module[struct_class->module] = struct_class;
+  registry.by_class[py_class] = struct_class;
 
-class Stdout(io.TextIOBase):
-  def __init__(self, type):
-    self.type = type
+  return fields;
+}
 
-  def write(self, string):
-    pythonx_handle_io_write(string.encode("utf-8"), get_eval_info_bytes(), self.type)
-    return len(string)
+FINE_NIF(struct_class_register, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
+// Requires GIL.
+std::shared_ptr<StructClass> get_struct_class(fine::Atom module) {
+  auto struct_class = find_struct_class(module.to_string());
 
-class Stdin(io.IOBase):
-  def read(self, size=None):
-    raise RuntimeError("stdin not supported")
+  if (!struct_class) {
+    throw std::invalid_argument("no Python class registered for struct " +
+                                module.to_string());
+  }
 
+  return struct_class;
+}
 
-sys.stdout = Stdout(0)
-sys.stderr = Stdout(1)
-sys.stdin = Stdin()
+ExObject struct_new(ErlNifEnv *env, fine::Atom module, ExObject ex_args) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-pythonx = types.ModuleType("pythonx")
+  auto struct_class = get_struct_class(module);
 
-class PID:
-  def __init__(self, bytes):
-    self.bytes = bytes
+  auto py_object =
+      PyObject_Call(struct_class->py_class, ex_args.py_object(), NULL);
+  raise_if_failed(env, py_object);
 
-  def __repr__(self):
-    return "<pythonx.PID>"
+  return make_ex_object(env, py_object);
+}
 
-pythonx.PID = PID
+FINE_NIF(struct_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-def send_tagged_object(pid, tag, object):
-  pythonx_handle_send_tagged_object(pid.bytes, tag.encode("utf-8"), object, get_eval_info_bytes())
+ExObject struct_new_many(ErlNifEnv *env, fine::Atom module, ExObject ex_rows) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-pythonx.send_tagged_object = send_tagged_object
+  auto struct_class = get_struct_class(module);
+
+  auto py_rows = ex_rows.py_object();
+
+  auto size = PyList_Size(py_rows);
+  raise_if_failed(env, size);
+
+  auto py_list = PyList_New(size);
+  raise_if_failed(env, py_list);
+  auto py_list_guard = PyDecRefGuard(py_list);
+
+  for (Py_ssize_t i = 0; i < size; i++) {
+    auto py_row = PyList_GetItem(py_rows, i);
+    raise_if_failed(env, py_row);
+
+    auto py_object = PyObject_Call(struct_class->py_class, py_row, NULL);
+    raise_if_failed(env, py_object);
+
+    // Note that PyList_SetItem steals the reference
+    raise_if_failed(env, PyList_SetItem(py_list, i, py_object));
+  }
+
+  py_list_guard = nullptr;
+  return make_ex_object(env, py_list);
+}
+
+FINE_NIF(struct_new_many, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+// Builds terms directly from Python objects with a built-in term
+// representation, converting the whole object graph in a single pass.
+//
+// String dict keys are interned for the duration of the build, so
+// keys repeated across many dicts (such as in a list of records)
+// share a single binary, or are decoded as existing atoms.
+//
+// Small strings and bytes are always copied, while larger ones point
+// to the Python object memory, which requires a resource per binary.
+// In the arena mode, medium-sized binaries are instead copied into
+// shared arena chunks and returned as sub-binaries, so there is just
+// a single allocation per chunk.
+//
+// Other objects are embedded as %Pythonx.Object{}, unless objects is
+// false, in which case the build fails. This is the case for terms
+// sent to other nodes, since those would not keep the objects alive.
+//
+// Requires GIL.
+class PyTermBuilder {
+public:
+  PyTermBuilder(ErlNifEnv *env, bool map_set, bool decimal, bool atom_keys,
+                bool arena, bool objects)
+      : env(env), types(get_builtin_types(env)), map_set(map_set),
+        decimal(decimal), atom_keys(atom_keys), arena(arena),
+        objects(objects) {}
+
+  // Returns false if the object cannot be represented as a term.
+  bool build(PyObjectPtr py_object, ERL_NIF_TERM &term, int depth = 0) {
+    if (depth > max_depth) {
+      return false;
+    }
+
+    auto is_none = Py_IsNone(py_object);
+    raise_if_failed(env, is_none);
+    if (is_none) {
+      term = fine::encode(this->env, std::nullopt);
+      return true;
+    }
+
+    auto is_true = Py_IsTrue(py_object);
+    raise_if_failed(env, is_true);
+    if (is_true) {
+      term = fine::encode(this->env, true);
+      return true;
+    }
+
+    auto is_false = Py_IsFalse(py_object);
+    raise_if_failed(env, is_false);
+    if (is_false) {
+      term = fine::encode(this->env, false);
+      return true;
+    }
+
+    if (auto struct_class = find_struct_class(py_object)) {
+      return this->build_struct(*struct_class, py_object, term, depth);
+    }
+
+    if (py_is_instance(env, py_object, this->types.int_type)) {
+      term = py_long_to_term(this->env, py_object);
+      return true;
+    }
+
+    if (py_is_instance(env, py_object, this->types.float_type)) {
+      double number = PyFloat_AsDouble(py_object);
+      if (PyErr_Occurred() != NULL) {
+        raise_py_error(env);
+      }
+
+      // Erlang has no representation for infinity and NaN
+      if (!std::isfinite(number)) {
+        return false;
+      }
+
+      term = enif_make_double(this->env, number);
+      return true;
+    }
+
+    if (py_is_instance(env, py_object, this->types.tuple_type)) {
+      auto size = PyTuple_Size(py_object);
+      raise_if_failed(env, size);
+
+      auto items = std::vector<ERL_NIF_TERM>(size);
+
+      for (Py_ssize_t i = 0; i < size; i++) {
+        auto py_item = PyTuple_GetItem(py_object, i);
+        raise_if_failed(env, py_item);
+
+        if (!this->build(py_item, items[i], depth + 1)) {
+          return false;
+        }
+      }
+
+      term = enif_make_tuple_from_array(this->env, items.data(),
+                                        static_cast<unsigned int>(size));
+      return true;
+    }
 
-sys.modules["pythonx"] = pythonx
-)";
+    if (py_is_instance(env, py_object, this->types.list_type)) {
+      auto size = PyList_Size(py_object);
+      raise_if_failed(env, size);
 
-  auto py_code = PyUnicode_FromStringAndSize(code, sizeof(code) - 1);
-  raise_if_failed(env, py_code);
-  auto py_code_guard = PyDecRefGuard(py_code);
+      auto items = std::vector<ERL_NIF_TERM>(size);
 
-  auto py_globals = PyDict_New();
-  raise_if_failed(env, py_globals);
-  auto py_globals_guard = PyDecRefGuard(py_globals);
+      for (Py_ssize_t i = 0; i < size; i++) {
+        auto py_item = PyList_GetItem(py_object, i);
+        raise_if_failed(env, py_item);
 
-  raise_if_failed(
-      env, PyDict_SetItemString(py_globals, "__builtins__", py_builtins));
+        if (!this->build(py_item, items[i], depth + 1)) {
+          return false;
+        }
+      }
 
-  auto py_pythonx_handle_io_write_ptr = PyLong_FromUnsignedLongLong(
-      reinterpret_cast<uintptr_t>(pythonx_handle_io_write));
-  raise_if_failed(env, py_pythonx_handle_io_write_ptr);
-  auto py_pythonx_handle_io_write_ptr_guard =
-      PyDecRefGuard(py_pythonx_handle_io_write_ptr);
+      term = enif_make_list_from_array(this->env, items.data(),
+                                       static_cast<unsigned int>(size));
+      return true;
+    }
 
-  raise_if_failed(env, PyDict_SetItemString(py_globals,
-                                            "pythonx_handle_io_write_ptr",
-                                            py_pythonx_handle_io_write_ptr));
+    if (py_is_instance(env, py_object, this->types.dict_type)) {
+      auto size = PyDict_Size(py_object);
+      raise_if_failed(env, size);
 
-  auto py_pythonx_handle_send_tagged_object_ptr = PyLong_FromUnsignedLongLong(
-      reinterpret_cast<uintptr_t>(pythonx_handle_send_tagged_object));
-  raise_if_failed(env, py_pythonx_handle_send_tagged_object_ptr);
-  auto py_pythonx_handle_send_tagged_object_ptr_guard =
-      PyDecRefGuard(py_pythonx_handle_send_tagged_object_ptr);
+      auto keys = std::vector<ERL_NIF_TERM>();
+      auto values = std::vector<ERL_NIF_TERM>();
+      keys.reserve(size);
+      values.reserve(size);
 
-  raise_if_failed(env, PyDict_SetItemString(
-                           py_globals, "pythonx_handle_send_tagged_object_ptr",
-                           py_pythonx_handle_send_tagged_object_ptr));
+      PyObjectPtr py_key, py_value;
+      Py_ssize_t pos = 0;
 
-  auto py_exec_args = PyTuple_Pack(2, py_code, py_globals);
-  raise_if_failed(env, py_exec_args);
-  auto py_exec_args_guard = PyDecRefGuard(py_exec_args);
+      while (PyDict_Next(py_object, &pos, &py_key, &py_value)) {
+        ERL_NIF_TERM key, value;
 
-  auto py_result = PyObject_Call(py_exec, py_exec_args, NULL);
-  raise_if_failed(env, py_result);
-  Py_DecRef(py_result);
+        if (!this->build_key(py_key, key, depth + 1) ||
+            !this->build(py_value, value, depth + 1)) {
+          return false;
+        }
 
-  return fine::Ok<>();
-}
+        keys.push_back(key);
+        values.push_back(value);
+      }
 
-FINE_NIF(init, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+      // This fails if different Python keys map to the same term
+      return enif_make_map_from_arrays(this->env, keys.data(), values.data(),
+                                       keys.size(), &term);
+    }
 
-fine::Ok<> janitor_decref(ErlNifEnv *env, uint64_t ptr) {
-  auto init_guard = std::lock_guard<std::mutex>(init_mutex);
+    if (py_is_instance(env, py_object, this->types.str_type)) {
+      Py_ssize_t size;
+      auto buffer = PyUnicode_AsUTF8AndSize(py_object, &size);
+      raise_if_failed(env, buffer);
 
-  // If the interpreter is no longer initialized, ignore the call
-  if (is_initialized) {
-    auto gil_guard = PyGILGuard();
+      term = this->make_binary(py_object, buffer, size, false);
+      return true;
+    }
 
-    auto object = reinterpret_cast<PyObjectPtr>(ptr);
+    if (py_is_instance(env, py_object, this->types.bytes_type)) {
+      Py_ssize_t size;
+      char *buffer;
+      auto result = PyBytes_AsStringAndSize(py_object, &buffer, &size);
+      raise_if_failed(env, result);
 
-    Py_DecRef(object);
-  }
+      term = this->make_binary(py_object, buffer, size, true);
+      return true;
+    }
 
-  return fine::Ok<>();
-}
+    if (py_is_instance(env, py_object, this->types.set_type) ||
+        py_is_instance(env, py_object, this->types.frozenset_type)) {
+      if (!this->map_set) {
+        return false;
+      }
 
-FINE_NIF(janitor_decref, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+      auto size = PySet_Size(py_object);
+      raise_if_failed(env, size);
 
-ExObject none_new(ErlNifEnv *env) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+      auto items = std::vector<ERL_NIF_TERM>();
+      items.reserve(size);
 
-  // Note that Limited API has Py_GetConstant, but only since v3.13
-  auto py_none = Py_BuildValue("");
-  raise_if_failed(env, py_none);
+      auto py_iter = PyObject_GetIter(py_object);
+      raise_if_failed(env, py_iter);
+      auto py_iter_guard = PyDecRefGuard(py_iter);
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_none));
-}
+      PyObjectPtr py_item = NULL;
 
-FINE_NIF(none_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+      while ((py_item = PyIter_Next(py_iter)) != NULL) {
+        auto py_item_guard = PyDecRefGuard(py_item);
 
-ExObject false_new(ErlNifEnv *env) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+        ERL_NIF_TERM item;
+        if (!this->build(py_item, item, depth + 1)) {
+          return false;
+        }
 
-  auto py_bool = PyBool_FromLong(0);
-  raise_if_failed(env, py_bool);
+        items.push_back(item);
+      }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_bool));
-}
+      if (PyErr_Occurred() != NULL) {
+        raise_py_error(env);
+      }
 
-FINE_NIF(false_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+      // %MapSet{map: %{item => []}}
+      auto nils = std::vector<ERL_NIF_TERM>(
+          items.size(), enif_make_list_from_array(this->env, NULL, 0));
 
-ExObject true_new(ErlNifEnv *env) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+      ERL_NIF_TERM map;
+      if (!enif_make_map_from_arrays(this->env, items.data(), nils.data(),
+                                     items.size(), &map)) {
+        return false;
+      }
 
-  auto py_bool = PyBool_FromLong(1);
-  raise_if_failed(env, py_bool);
+      ERL_NIF_TERM struct_keys[] = {
+          fine::encode(this->env, fine::Atom("__struct__")),
+          fine::encode(this->env, atoms::map)};
+      ERL_NIF_TERM struct_values[] = {
+          fine::encode(this->env, fine::Atom("Elixir.MapSet")), map};
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_bool));
-}
+      return enif_make_map_from_arrays(this->env, struct_keys, struct_values,
+                                       2, &term);
+    }
 
-FINE_NIF(true_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    if (py_calendar_to_term(this->env, py_object, this->decimal, term)) {
+      return true;
+    }
 
-ExObject long_from_int64(ErlNifEnv *env, int64_t number) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    // Other objects are converted with the regular decoding, which
+    // returns %Pythonx.Object{} for non built-in types
+    Py_IncRef(py_object);
+    auto ex_object = make_group_ex_object(this->get_group(), py_object);
+    term = decode_py_object(env, ex_object, this->atom_keys, this->decimal);
 
-  auto py_long = PyLong_FromLongLong(number);
-  raise_if_failed(env, py_long);
+    return this->objects || !enif_is_map(env, term);
+  }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_long));
-}
+private:
+  // Binaries up to this size are always copied, since they are stored
+  // directly on the process heap
+  static constexpr Py_ssize_t max_copy_size = 64;
+  // Binaries up to this size are copied into the arena, if enabled
+  static constexpr Py_ssize_t max_arena_item_size = 4096;
+  // Arena chunks start small and double in size up to the maximum,
+  // so that little memory is wasted on the unused tail of the last
+  // chunk
+  static constexpr size_t min_arena_chunk_size = 4096;
+  static constexpr size_t max_arena_chunk_size = 1024 * 1024;
 
-FINE_NIF(long_from_int64, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  ErlNifEnv *env;
+  PyBuiltinTypes types;
+  bool map_set;
+  bool decimal;
+  bool atom_keys;
+  bool arena;
+  bool objects;
+  std::unordered_map<std::string, ERL_NIF_TERM> keys;
+  ERL_NIF_TERM arena_chunk_term;
+  uint8_t *arena_chunk_data = NULL;
+  size_t arena_chunk_size = 0;
+  size_t arena_chunk_used = 0;
+  std::optional<fine::ResourcePtr<PyObjectGroupResource>> group;
+
+  bool build_struct(const StructClass &struct_class, PyObjectPtr py_object,
+                    ERL_NIF_TERM &term, int depth) {
+    auto size = struct_class.keys.size() + 1;
+
+    auto keys = std::vector<ERL_NIF_TERM>();
+    keys.reserve(size);
+    auto values = std::vector<ERL_NIF_TERM>();
+    values.reserve(size);
+
+    keys.push_back(fine::encode(this->env, fine::Atom("__struct__")));
+    values.push_back(enif_make_copy(this->env, struct_class.module_term));
+
+    for (size_t i = 0; i < struct_class.keys.size(); i++) {
+      keys.push_back(enif_make_copy(this->env, struct_class.keys[i]));
+
+      auto py_attr = struct_class.py_attrs[i];
+
+      if (py_attr == NULL) {
+        values.push_back(enif_make_copy(this->env, struct_class.defaults[i]));
+        continue;
+      }
 
-ExObject long_from_string(ErlNifEnv *env, std::string string, int64_t base) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+      auto py_value = PyObject_GetAttr(py_object, py_attr);
+      raise_if_failed(env, py_value);
+      auto py_value_guard = PyDecRefGuard(py_value);
 
-  auto py_long =
-      PyLong_FromString(string.c_str(), NULL, static_cast<int>(base));
-  raise_if_failed(env, py_long);
+      ERL_NIF_TERM value;
+      if (!this->build(py_value, value, depth + 1)) {
+        return false;
+      }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_long));
-}
+      values.push_back(value);
+    }
 
-FINE_NIF(long_from_string, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    return enif_make_map_from_arrays(this->env, keys.data(), values.data(),
+                                     size, &term);
+  }
 
-ExObject float_new(ErlNifEnv *env, double number) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+  bool build_key(PyObjectPtr py_key, ERL_NIF_TERM &term, int depth) {
+    if (!py_is_instance(env, py_key, this->types.str_type)) {
+      return this->build(py_key, term, depth);
+    }
 
-  auto py_float = PyFloat_FromDouble(number);
-  raise_if_failed(env, py_float);
+    Py_ssize_t size;
+    auto buffer = PyUnicode_AsUTF8AndSize(py_key, &size);
+    raise_if_failed(env, buffer);
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_float));
-}
+    auto key = std::string(buffer, size);
 
-FINE_NIF(float_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    auto it = this->keys.find(key);
+    if (it != this->keys.end()) {
+      term = it->second;
+      return true;
+    }
 
-ExObject bytes_from_binary(ErlNifEnv *env, ErlNifBinary binary) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    if (this->atom_keys) {
+      term = existing_atom_from_key(this->env, buffer, size);
+    } else {
+      term = this->make_binary(py_key, buffer, size, false);
+    }
 
-  auto py_object = PyBytes_FromStringAndSize(
-      reinterpret_cast<const char *>(binary.data), binary.size);
-  raise_if_failed(env, py_object);
+    this->keys.emplace(std::move(key), term);
+    return true;
+  }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_object));
-}
+  ERL_NIF_TERM make_binary(PyObjectPtr py_object, const char *buffer,
+                           Py_ssize_t size, bool bytes) {
+    if (size <= max_copy_size) {
+      ERL_NIF_TERM binary_term;
+      auto binary_data = enif_make_new_binary(this->env, size, &binary_term);
+      std::memcpy(binary_data, buffer, size);
+      return binary_term;
+    }
 
-FINE_NIF(bytes_from_binary, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    if (this->arena && size <= max_arena_item_size) {
+      return this->make_arena_binary(buffer, size);
+    }
 
-ExObject unicode_from_string(ErlNifEnv *env, ErlNifBinary binary) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    return bytes ? py_bytes_to_binary_term(this->env, py_object)
+                 : py_str_to_binary_term(this->env, py_object);
+  }
 
-  auto py_object = PyUnicode_FromStringAndSize(
-      reinterpret_cast<const char *>(binary.data), binary.size);
+  ERL_NIF_TERM make_arena_binary(const char *buffer, size_t size) {
+    if (this->arena_chunk_data == NULL ||
+        this->arena_chunk_size - this->arena_chunk_used < size) {
+      // The chunk binary is created upfront, so that we can create
+      // sub-binaries right away. We can write to the binary data up
+      // until the NIF returns.
+      this->arena_chunk_size =
+          this->arena_chunk_data == NULL
+              ? min_arena_chunk_size
+              : std::min(this->arena_chunk_size * 2, max_arena_chunk_size);
+      this->arena_chunk_data = enif_make_new_binary(
+          this->env, this->arena_chunk_size, &this->arena_chunk_term);
+      this->arena_chunk_used = 0;
+    }
 
-  raise_if_failed(env, py_object);
+    std::memcpy(this->arena_chunk_data + this->arena_chunk_used, buffer, size);
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_object));
-}
+    auto term = enif_make_sub_binary(this->env, this->arena_chunk_term,
+                                     this->arena_chunk_used, size);
+    this->arena_chunk_used += size;
+    return term;
+  }
 
-FINE_NIF(unicode_from_string, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  fine::ResourcePtr<PyObjectGroupResource> get_group() {
+    if (!this->group) {
+      this->group = make_group(this->env);
+    }
 
-fine::Term unicode_to_string(ErlNifEnv *env, ExObject ex_object) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    return *this->group;
+  }
+};
 
-  return py_str_to_binary_term(env, ex_object.resource->py_object);
-}
+// Builds Python objects directly from terms, following the same
+// conversion rules as Pythonx.Encoder.
+//
+// Only terms with built-in encoding are supported. Other terms, in
+// particular structs without a native counterpart, require the Elixir
+// protocol, so the caller needs to fall back to it. We give up on the
+// first such term, so that falling back is cheap.
+//
+// Requires GIL.
+class PyTermReader {
+public:
+  PyTermReader(ErlNifEnv *env) : env(env) {}
 
-FINE_NIF(unicode_to_string, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  // Returns a new reference, or NULL if the term is not supported.
+  PyObjectPtr read(ERL_NIF_TERM term, int depth = 0) {
+    if (depth > max_depth) {
+      return NULL;
+    }
 
-ExObject dict_new(ErlNifEnv *env) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    if (enif_is_number(env, term)) {
+      return this->read_number(term);
+    }
 
-  auto py_dict = PyDict_New();
-  raise_if_failed(env, py_dict);
+    if (enif_is_atom(env, term)) {
+      return this->read_atom(term);
+    }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_dict));
-}
+    ErlNifBinary binary;
+    if (enif_inspect_binary(env, term, &binary)) {
+      return this->read_binary(binary);
+    }
 
-FINE_NIF(dict_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    int arity;
+    const ERL_NIF_TERM *elements;
+    if (enif_get_tuple(env, term, &arity, &elements)) {
+      auto py_tuple = this->checked(PyTuple_New(arity));
+      auto py_tuple_guard = PyDecRefGuard(py_tuple);
 
-fine::Ok<> dict_set_item(ErlNifEnv *env, ExObject ex_object, ExObject ex_key,
-                         ExObject ex_value) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+      for (int i = 0; i < arity; i++) {
+        auto py_item = this->read(elements[i], depth + 1);
+        if (py_item == NULL) {
+          return NULL;
+        }
 
-  auto result =
-      PyDict_SetItem(ex_object.resource->py_object, ex_key.resource->py_object,
-                     ex_value.resource->py_object);
-  raise_if_failed(env, result);
+        // Note that PyTuple_SetItem steals the reference
+        raise_if_failed(env, PyTuple_SetItem(py_tuple, i, py_item));
+      }
 
-  return fine::Ok<>();
-}
+      py_tuple_guard = nullptr;
+      return py_tuple;
+    }
 
-FINE_NIF(dict_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    // Improper lists are not supported, in which case getting the
+    // length fails
+    unsigned int length;
+    if (enif_get_list_length(env, term, &length)) {
+      auto py_list = this->checked(PyList_New(length));
+      auto py_list_guard = PyDecRefGuard(py_list);
+
+      ERL_NIF_TERM head, tail = term;
+      for (unsigned int i = 0; enif_get_list_cell(env, tail, &head, &tail);
+           i++) {
+        auto py_item = this->read(head, depth + 1);
+        if (py_item == NULL) {
+          return NULL;
+        }
+
+        // Note that PyList_SetItem steals the reference
+        raise_if_failed(env, PyList_SetItem(py_list, i, py_item));
+      }
 
-ExObject tuple_new(ErlNifEnv *env, uint64_t size) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+      py_list_guard = nullptr;
+      return py_list;
+    }
 
-  auto py_tuple = PyTuple_New(size);
-  raise_if_failed(env, py_tuple);
+    if (enif_is_map(env, term)) {
+      return this->read_map(term, depth);
+    }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_tuple));
-}
+    return NULL;
+  }
 
-FINE_NIF(tuple_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  // Returns the total size of binaries copied into bytes objects.
+  size_t binaries_size() { return this->binaries_size_; }
 
-fine::Ok<> tuple_set_item(ErlNifEnv *env, ExObject ex_object, uint64_t index,
-                          ExObject ex_value) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+private:
+  ErlNifEnv *env;
+  size_t binaries_size_ = 0;
 
-  auto result = PyTuple_SetItem(ex_object.resource->py_object, index,
-                                ex_value.resource->py_object);
-  raise_if_failed(env, result);
+  PyObjectPtr read_number(ERL_NIF_TERM term) {
+    ErlNifSInt64 integer;
+    if (enif_get_int64(env, term, &integer)) {
+      return this->checked(PyLong_FromLongLong(integer));
+    }
 
-  // PyTuple_SetItem steals a reference, so we add one back
-  Py_IncRef(ex_value.resource->py_object);
+    ErlNifUInt64 unsigned_integer;
+    if (enif_get_uint64(env, term, &unsigned_integer)) {
+      return this->checked(PyLong_FromUnsignedLongLong(unsigned_integer));
+    }
 
-  return fine::Ok<>();
-}
+    double number;
+    if (enif_get_double(env, term, &number)) {
+      return this->checked(PyFloat_FromDouble(number));
+    }
 
-FINE_NIF(tuple_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    return this->read_big_integer(term);
+  }
 
-ExObject list_new(ErlNifEnv *env, uint64_t size) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+  // Integers over 64 bits are serialized as bignums, that is, sign and
+  // little-endian magnitude, which we pass to int.from_bytes. This way
+  // the conversion takes linear time, as opposed to going through a
+  // string representation.
+  PyObjectPtr read_big_integer(ERL_NIF_TERM term) {
+    ErlNifBinary binary;
+    if (!enif_term_to_binary(env, term, &binary)) {
+      return NULL;
+    }
 
-  auto py_tuple = PyList_New(size);
-  raise_if_failed(env, py_tuple);
+    auto data = binary.data;
+    auto size = binary.size;
+    auto magnitude = std::vector<uint8_t>();
+    auto negative = false;
+    auto valid = false;
+
+    if (size >= 4 && data[0] == etf::version &&
+        (data[1] == etf::small_big_ext || data[1] == etf::large_big_ext)) {
+      auto small = data[1] == etf::small_big_ext;
+      size_t offset = small ? 3 : 6;
+      size_t length = 0;
+
+      if (size > offset) {
+        length = small ? data[2]
+                       : static_cast<size_t>(data[2]) << 24 |
+                             static_cast<size_t>(data[3]) << 16 |
+                             static_cast<size_t>(data[4]) << 8 | data[5];
+      }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_tuple));
-}
+      // The length is followed by the sign byte and the magnitude
+      if (size > offset && size - offset - 1 == length) {
+        negative = data[offset] != 0;
+        magnitude.assign(data + offset + 1, data + size);
+        valid = true;
+      }
+    }
 
-FINE_NIF(list_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    enif_release_binary(&binary);
 
-fine::Ok<> list_set_item(ErlNifEnv *env, ExObject ex_object, uint64_t index,
-                         ExObject ex_value) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    if (!valid) {
+      return NULL;
+    }
 
-  auto result = PyList_SetItem(ex_object.resource->py_object, index,
-                               ex_value.resource->py_object);
-  raise_if_failed(env, result);
+    return py_long_from_magnitude(env, magnitude.data(), magnitude.size(),
+                                  negative);
+  }
 
-  // PyList_SetItem steals a reference, so we add one back
-  Py_IncRef(ex_value.resource->py_object);
+  PyObjectPtr read_atom(ERL_NIF_TERM term) {
+    auto name = fine::decode<fine::Atom>(env, term).to_string();
 
-  return fine::Ok<>();
-}
+    if (name == "nil") {
+      return this->checked(Py_BuildValue(""));
+    } else if (name == "true") {
+      return this->checked(PyBool_FromLong(1));
+    } else if (name == "false") {
+      return this->checked(PyBool_FromLong(0));
+    } else {
+      return atom_table.py_string(env, name);
+    }
+  }
 
-FINE_NIF(list_set_item, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  PyObjectPtr read_binary(const ErlNifBinary &binary) {
+    // We allocate the object first and fill it in afterwards, so that
+    // large copies can happen with the GIL released, as in
+    // bytes_from_binary
+    auto py_bytes = this->checked(PyBytes_FromStringAndSize(NULL, binary.size));
+    auto py_bytes_guard = PyDecRefGuard(py_bytes);
 
-ExObject set_new(ErlNifEnv *env) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    char *buffer;
+    Py_ssize_t buffer_size;
+    raise_if_failed(env,
+                    PyBytes_AsStringAndSize(py_bytes, &buffer, &buffer_size));
 
-  auto py_set = PySet_New(NULL);
-  raise_if_failed(env, py_set);
+    copy_allow_threads(buffer, binary.data, binary.size);
+    this->binaries_size_ += binary.size;
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_set));
-}
+    py_bytes_guard = nullptr;
+    return py_bytes;
+  }
 
-FINE_NIF(set_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+  PyObjectPtr read_map(ERL_NIF_TERM term, int depth) {
+    ERL_NIF_TERM module_term;
+    if (enif_get_map_value(env, term, fine::encode(env, atoms::__struct__),
+                           &module_term)) {
+      return this->read_struct(term, module_term, depth);
+    }
 
-fine::Ok<> set_add(ErlNifEnv *env, ExObject ex_object, ExObject ex_key) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    auto py_dict = this->checked(PyDict_New());
+    auto py_dict_guard = PyDecRefGuard(py_dict);
+
+    auto success =
+        this->each_map_pair(term, [&](ERL_NIF_TERM key, ERL_NIF_TERM value) {
+          auto py_key = this->read(key, depth + 1);
+          if (py_key == NULL) {
+            return false;
+          }
+          auto py_key_guard = PyDecRefGuard(py_key);
+
+          auto py_value = this->read(value, depth + 1);
+          if (py_value == NULL) {
+            return false;
+          }
+          auto py_value_guard = PyDecRefGuard(py_value);
+
+          raise_if_failed(env, PyDict_SetItem(py_dict, py_key, py_value));
+          return true;
+        });
+
+    if (!success) {
+      return NULL;
+    }
 
-  auto result =
-      PySet_Add(ex_object.resource->py_object, ex_key.resource->py_object);
-  raise_if_failed(env, result);
+    py_dict_guard = nullptr;
+    return py_dict;
+  }
 
-  return fine::Ok<>();
-}
+  PyObjectPtr read_struct(ERL_NIF_TERM term, ERL_NIF_TERM module_term,
+                          int depth) {
+    if (!enif_is_atom(env, module_term)) {
+      return NULL;
+    }
 
-FINE_NIF(set_add, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    auto name = fine::decode<fine::Atom>(env, module_term).to_string();
+
+    if (name == "Elixir.Pythonx.Object") {
+      try {
+        auto ex_object = fine::decode<ExObject>(env, term);
+        auto py_object = ex_object.py_object();
+        Py_IncRef(py_object);
+        return py_object;
+      } catch (const std::exception &) {
+        // Remote and released objects are reported by the protocol
+        return NULL;
+      }
+    }
 
-ExObject pid_new(ErlNifEnv *env, ErlNifPid pid) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    if (name == "Elixir.MapSet") {
+      return this->read_map_set(term, depth);
+    }
 
-  // ErlNifPid is self-contained struct, not bound to any env, so it's
-  // safe to copy [1].
-  //
-  // [1]: https://www.erlang.org/doc/apps/erts/erl_nif.html#ErlNifPid
-  auto py_pid_bytes = PyBytes_FromStringAndSize(
-      reinterpret_cast<const char *>(&pid), sizeof(ErlNifPid));
-  raise_if_failed(env, py_pid_bytes);
+    if (name == "Elixir.Range") {
+      return this->read_range(term);
+    }
 
-  auto py_pythonx = PyImport_AddModule("pythonx");
-  raise_if_failed(env, py_pythonx);
+    if (name == "Elixir.Decimal") {
+      return this->read_decimal(term);
+    }
 
-  auto py_PID = PyObject_GetAttrString(py_pythonx, "PID");
-  raise_if_failed(env, py_PID);
-  auto py_PID_guard = PyDecRefGuard(py_PID);
+    if (name == "Elixir.Date" || name == "Elixir.Time" ||
+        name == "Elixir.NaiveDateTime" || name == "Elixir.DateTime") {
+      return this->read_calendar(name, term);
+    }
 
-  auto py_PID_args = PyTuple_Pack(1, py_pid_bytes);
-  raise_if_failed(env, py_PID_args);
-  auto py_PID_args_guard = PyDecRefGuard(py_PID_args);
+    // Other structs have custom encoding, unless a Python class is
+    // registered for them
+    auto struct_class = find_struct_class(name);
+    if (!struct_class) {
+      return NULL;
+    }
 
-  auto py_pid = PyObject_Call(py_PID, py_PID_args, NULL);
-  raise_if_failed(env, py_pid);
+    return this->read_registered_struct(*struct_class, term, depth);
+  }
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_pid));
-}
+  PyObjectPtr read_map_set(ERL_NIF_TERM term, int depth) {
+    ERL_NIF_TERM map;
+    if (!enif_get_map_value(env, term, fine::encode(env, atoms::map), &map) ||
+        !enif_is_map(env, map)) {
+      return NULL;
+    }
 
-FINE_NIF(pid_new, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    auto py_set = this->checked(PySet_New(NULL));
+    auto py_set_guard = PyDecRefGuard(py_set);
 
-ExObject object_repr(ErlNifEnv *env, ExObject ex_object) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+    // The items are the map keys
+    auto success =
+        this->each_map_pair(map, [&](ERL_NIF_TERM key, ERL_NIF_TERM) {
+          auto py_item = this->read(key, depth + 1);
+          if (py_item == NULL) {
+            return false;
+          }
+          auto py_item_guard = PyDecRefGuard(py_item);
 
-  auto py_repr = PyObject_Repr(ex_object.resource->py_object);
-  raise_if_failed(env, py_repr);
+          raise_if_failed(env, PySet_Add(py_set, py_item));
+          return true;
+        });
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_repr));
-}
+    if (!success) {
+      return NULL;
+    }
 
-FINE_NIF(object_repr, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+    py_set_guard = nullptr;
+    return py_set;
+  }
 
-fine::Term decode_once(ErlNifEnv *env, ExObject ex_object) {
-  ensure_initialized();
-  auto gil_guard = PyGILGuard();
+  // Builds a Python range, same as the Range encoder. Bounds that do
+  // not fit in 64 bits are not supported.
+  PyObjectPtr read_range(ERL_NIF_TERM term) {
+    int64_t first, last, step;
+    if (!this->get_int_field(term, "first", first) ||
+        !this->get_int_field(term, "last", last) ||
+        !this->get_int_field(term, "step", step)) {
+      return NULL;
+    }
 
-  auto py_object = ex_object.resource->py_object;
+    // Python ranges exclude the stop value
+    if (last == (step > 0 ? std::numeric_limits<int64_t>::max()
+                          : std::numeric_limits<int64_t>::min())) {
+      return NULL;
+    }
 
-  auto is_none = Py_IsNone(py_object);
-  raise_if_failed(env, is_none);
-  if (is_none) {
-    return fine::encode(env, std::nullopt);
+    auto stop = step > 0 ? last + 1 : last - 1;
+    return py_range_new(env, first, stop, step);
   }
 
-  auto is_true = Py_IsTrue(py_object);
-  raise_if_failed(env, is_true);
-  if (is_true) {
-    return fine::encode(env, true);
-  }
+  // Constructs the registered class from the struct fields. Returns
+  // NULL if any of the class fields is missing.
+  PyObjectPtr read_registered_struct(const StructClass &struct_class,
+                                     ERL_NIF_TERM term, int depth) {
+    auto size = struct_class.field_keys.size();
 
-  auto is_false = Py_IsFalse(py_object);
-  raise_if_failed(env, is_false);
-  if (is_false) {
-    return fine::encode(env, false);
-  }
+    auto py_args = this->checked(PyTuple_New(size));
+    auto py_args_guard = PyDecRefGuard(py_args);
 
-  auto py_builtins = PyEval_GetBuiltins();
-  raise_if_failed(env, py_builtins);
+    for (size_t i = 0; i < size; i++) {
+      // Atoms are the same across envs, so we can use the key terms
+      // owned by the struct class env
+      auto key = struct_class.keys[struct_class.field_keys[i]];
 
-  auto py_int_type = PyDict_GetItemString(py_builtins, "int");
-  raise_if_failed(env, py_int_type);
-  auto is_long = PyObject_IsInstance(py_object, py_int_type);
-  raise_if_failed(env, is_long);
-  if (is_long) {
-    int overflow;
-    auto integer = PyLong_AsLongLongAndOverflow(py_object, &overflow);
+      ERL_NIF_TERM value;
+      if (!enif_get_map_value(env, term, key, &value)) {
+        return NULL;
+      }
 
-    if (PyErr_Occurred() != NULL) {
-      raise_py_error(env);
+      auto py_value = this->read(value, depth + 1);
+      if (py_value == NULL) {
+        return NULL;
+      }
+
+      // Note that PyTuple_SetItem steals the reference
+      raise_if_failed(env, PyTuple_SetItem(py_args, i, py_value));
     }
 
-    if (overflow == 0) {
-      return enif_make_int64(env, integer);
+    return this->checked(PyObject_Call(struct_class.py_class, py_args, NULL));
+  }
+
+  // Builds the Python object from calendar struct fields. Returns NULL
+  // if the fields are not as expected, for example when the calendar
+  // is other than Calendar.ISO, so that the protocol is used instead.
+  PyObjectPtr read_calendar(const std::string &name, ERL_NIF_TERM term) {
+    if (!this->has_atom_field(term, "calendar", "Elixir.Calendar.ISO")) {
+      return NULL;
     }
 
-    // Integer over 64 bits
+    int64_t year, month, day, hour, minute, second, microsecond;
 
-    auto py_str = PyObject_Str(py_object);
-    raise_if_failed(env, py_str);
-    auto py_str_guard = PyDecRefGuard(py_str);
+    auto has_date = this->get_int_field(term, "year", year) &&
+                    this->get_int_field(term, "month", month) &&
+                    this->get_int_field(term, "day", day);
 
-    auto binary_term = py_str_to_binary_term(env, py_str);
+    auto has_time = this->get_int_field(term, "hour", hour) &&
+                    this->get_int_field(term, "minute", minute) &&
+                    this->get_int_field(term, "second", second) &&
+                    this->get_microsecond_field(term, microsecond);
 
-    return fine::encode(
-        env, std::make_tuple(atoms::integer, fine::Term(binary_term)));
-  }
+    if (name == "Elixir.Date") {
+      return has_date ? py_date_new(env, year, month, day) : NULL;
+    }
 
-  auto py_float_type = PyDict_GetItemString(py_builtins, "float");
-  raise_if_failed(env, py_float_type);
-  auto is_float = PyObject_IsInstance(py_object, py_float_type);
-  raise_if_failed(env, is_float);
-  if (is_float) {
-    double number = PyFloat_AsDouble(py_object);
-    if (PyErr_Occurred() != NULL) {
-      raise_py_error(env);
+    if (name == "Elixir.Time") {
+      return has_time ? py_time_new(env, hour, minute, second, microsecond)
+                      : NULL;
     }
 
-    return enif_make_double(env, number);
-  }
+    if (!has_date || !has_time) {
+      return NULL;
+    }
 
-  auto py_tuple_type = PyDict_GetItemString(py_builtins, "tuple");
-  raise_if_failed(env, py_tuple_type);
-  auto is_tuple = PyObject_IsInstance(py_object, py_tuple_type);
-  raise_if_failed(env, is_tuple);
-  if (is_tuple) {
-    auto size = PyTuple_Size(py_object);
-    raise_if_failed(env, size);
+    auto utc_offset = std::optional<int64_t>();
+    auto time_zone = std::optional<std::string>();
 
-    auto terms = std::vector<ERL_NIF_TERM>();
-    terms.reserve(size);
+    if (name == "Elixir.DateTime") {
+      int64_t offset, std_offset;
+      std::string zone;
+      if (!this->get_int_field(term, "utc_offset", offset) ||
+          !this->get_int_field(term, "std_offset", std_offset) ||
+          !this->get_binary_field(term, "time_zone", zone)) {
+        return NULL;
+      }
 
-    for (Py_ssize_t i = 0; i < size; i++) {
-      auto py_item = PyTuple_GetItem(py_object, i);
-      raise_if_failed(env, py_item);
-      Py_IncRef(py_item);
-      auto ex_item = ExObject(fine::make_resource<PyObjectResource>(py_item));
-      terms.push_back(fine::encode(env, ex_item));
+      utc_offset = offset + std_offset;
+      time_zone = zone;
     }
 
-    auto items = enif_make_list_from_array(env, terms.data(),
-                                           static_cast<unsigned int>(size));
-    return fine::encode(env, std::make_tuple(atoms::tuple, fine::Term(items)));
+    return py_datetime_new(env, year, month, day, hour, minute, second,
+                           microsecond, utc_offset, time_zone);
   }
 
-  auto py_list_type = PyDict_GetItemString(py_builtins, "list");
-  raise_if_failed(env, py_list_type);
-  auto is_list = PyObject_IsInstance(py_object, py_list_type);
-  raise_if_failed(env, is_list);
-  if (is_list) {
-    auto size = PyList_Size(py_object);
-    raise_if_failed(env, size);
+  PyObjectPtr read_decimal(ERL_NIF_TERM term) {
+    int64_t sign, exp;
+    ERL_NIF_TERM coef;
+    if (!this->get_int_field(term, "sign", sign) ||
+        !this->get_int_field(term, "exp", exp) ||
+        !enif_get_map_value(env, term, fine::encode(env, fine::Atom("coef")),
+                            &coef)) {
+      return NULL;
+    }
 
-    auto terms = std::vector<ERL_NIF_TERM>();
-    terms.reserve(size);
+    auto string = std::string(sign < 0 ? "-" : "");
 
-    for (Py_ssize_t i = 0; i < size; i++) {
-      auto py_item = PyList_GetItem(py_object, i);
-      raise_if_failed(env, py_item);
-      Py_IncRef(py_item);
-      auto ex_item = ExObject(fine::make_resource<PyObjectResource>(py_item));
-      terms.push_back(fine::encode(env, ex_item));
-    }
+    if (this->has_atom_field(term, "coef", "inf")) {
+      string += "Infinity";
+    } else if (this->has_atom_field(term, "coef", "NaN")) {
+      string = "NaN";
+    } else {
+      if (!enif_is_number(env, coef)) {
+        return NULL;
+      }
 
-    auto items = enif_make_list_from_array(env, terms.data(),
-                                           static_cast<unsigned int>(size));
-    return fine::encode(env, std::make_tuple(atoms::list, fine::Term(items)));
-  }
+      auto py_coef = this->read_number(coef);
+      if (py_coef == NULL) {
+        return NULL;
+      }
+      auto py_coef_guard = PyDecRefGuard(py_coef);
 
-  auto py_dict_type = PyDict_GetItemString(py_builtins, "dict");
-  raise_if_failed(env, py_dict_type);
-  auto is_dict = PyObject_IsInstance(py_object, py_dict_type);
-  raise_if_failed(env, is_dict);
-  if (is_dict) {
-    auto size = PyDict_Size(py_object);
-    raise_if_failed(env, size);
+      auto py_coef_str = PyObject_Str(py_coef);
+      raise_if_failed(env, py_coef_str);
+      auto py_coef_str_guard = PyDecRefGuard(py_coef_str);
 
-    auto terms = std::vector<ERL_NIF_TERM>();
-    terms.reserve(size);
+      Py_ssize_t size;
+      auto buffer = PyUnicode_AsUTF8AndSize(py_coef_str, &size);
+      raise_if_failed(env, buffer);
 
-    PyObjectPtr py_key, py_value;
-    Py_ssize_t pos = 0;
+      string.append(buffer, size);
+      string += "E" + std::to_string(exp);
+    }
 
-    while (PyDict_Next(py_object, &pos, &py_key, &py_value)) {
-      Py_IncRef(py_key);
-      auto ex_key = ExObject(fine::make_resource<PyObjectResource>(py_key));
+    return py_decimal_new(env, string.data(), string.size());
+  }
 
-      Py_IncRef(py_value);
-      auto ex_value = ExObject(fine::make_resource<PyObjectResource>(py_value));
+  // Gets an integer struct field. Returns false if the field is missing
+  // or is not an integer that fits in 64 bits.
+  bool get_int_field(ERL_NIF_TERM term, const char *key, int64_t &value) {
+    ERL_NIF_TERM field;
+    ErlNifSInt64 integer;
 
-      terms.push_back(fine::encode(env, std::make_tuple(ex_key, ex_value)));
+    if (!enif_get_map_value(env, term, fine::encode(env, fine::Atom(key)),
+                            &field) ||
+        !enif_get_int64(env, field, &integer)) {
+      return false;
     }
 
-    auto items = enif_make_list_from_array(env, terms.data(),
-                                           static_cast<unsigned int>(size));
-    return fine::encode(env, std::make_tuple(atoms::map, fine::Term(items)));
+    value = integer;
+    return true;
   }
 
-  auto py_str_type = PyDict_GetItemString(py_builtins, "str");
-  raise_if_failed(env, py_str_type);
-  auto is_unicode = PyObject_IsInstance(py_object, py_str_type);
-  raise_if_failed(env, is_unicode);
-  if (is_unicode) {
-    return py_str_to_binary_term(env, py_object);
-  }
+  // Gets a binary struct field. Returns false if the field is missing
+  // or is not a binary.
+  bool get_binary_field(ERL_NIF_TERM term, const char *key,
+                        std::string &value) {
+    ERL_NIF_TERM field;
+    ErlNifBinary binary;
+
+    if (!enif_get_map_value(env, term, fine::encode(env, fine::Atom(key)),
+                            &field) ||
+        !enif_inspect_binary(env, field, &binary)) {
+      return false;
+    }
 
-  auto py_bytes_type = PyDict_GetItemString(py_builtins, "bytes");
-  raise_if_failed(env, py_bytes_type);
-  auto is_bytes = PyObject_IsInstance(py_object, py_bytes_type);
-  raise_if_failed(env, is_bytes);
-  if (is_bytes) {
-    return py_bytes_to_binary_term(env, py_object);
+    value.assign(reinterpret_cast<const char *>(binary.data), binary.size);
+    return true;
   }
 
-  auto py_set_type = PyDict_GetItemString(py_builtins, "set");
-  raise_if_failed(env, py_set_type);
-  auto is_set = PyObject_IsInstance(py_object, py_set_type);
-  raise_if_failed(env, is_set);
-  auto py_frozenset_type = PyDict_GetItemString(py_builtins, "frozenset");
-  raise_if_failed(env, py_frozenset_type);
-  auto is_frozenset = PyObject_IsInstance(py_object, py_frozenset_type);
-  raise_if_failed(env, is_frozenset);
-  if (is_set || is_frozenset) {
-    auto size = PySet_Size(py_object);
-    raise_if_failed(env, size);
+  // Gets the value from the {value, precision} microsecond field.
+  bool get_microsecond_field(ERL_NIF_TERM term, int64_t &value) {
+    ERL_NIF_TERM field;
+    int arity;
+    const ERL_NIF_TERM *elements;
+    ErlNifSInt64 integer;
+
+    if (!enif_get_map_value(env, term,
+                            fine::encode(env, fine::Atom("microsecond")),
+                            &field) ||
+        !enif_get_tuple(env, field, &arity, &elements) || arity != 2 ||
+        !enif_get_int64(env, elements[0], &integer)) {
+      return false;
+    }
 
-    auto terms = std::vector<ERL_NIF_TERM>();
-    terms.reserve(size);
+    value = integer;
+    return true;
+  }
 
-    auto py_iter = PyObject_GetIter(py_object);
-    raise_if_failed(env, py_iter);
-    auto py_iter_guard = PyDecRefGuard(py_iter);
+  // Checks if the struct field is the given atom.
+  bool has_atom_field(ERL_NIF_TERM term, const char *key,
+                      const char *expected) {
+    ERL_NIF_TERM field;
+    if (!enif_get_map_value(env, term, fine::encode(env, fine::Atom(key)),
+                            &field) ||
+        !enif_is_atom(env, field)) {
+      return false;
+    }
 
-    PyObjectPtr py_item = NULL;
+    return fine::decode<fine::Atom>(env, field).to_string() == expected;
+  }
 
-    while ((py_item = PyIter_Next(py_iter)) != NULL) {
-      // Note that PyIter_Next already returns a new reference
-      auto ex_item = ExObject(fine::make_resource<PyObjectResource>(py_item));
-      terms.push_back(fine::encode(env, ex_item));
+  // Calls fun with every key-value pair of the map, until it returns
+  // false. Returns whether all pairs have been processed.
+  template <typename Fun> bool each_map_pair(ERL_NIF_TERM map, Fun fun) {
+    ErlNifMapIterator iterator;
+    if (!enif_map_iterator_create(env, map, &iterator,
+                                  ERL_NIF_MAP_ITERATOR_FIRST)) {
+      return false;
     }
 
-    if (PyErr_Occurred() != NULL) {
-      raise_py_error(env);
+    auto success = true;
+
+    try {
+      ERL_NIF_TERM key, value;
+      while (success &&
+             enif_map_iterator_get_pair(env, &iterator, &key, &value)) {
+        success = fun(key, value);
+        enif_map_iterator_next(env, &iterator);
+      }
+    } catch (...) {
+      enif_map_iterator_destroy(env, &iterator);
+      throw;
     }
 
-    auto items = enif_make_list_from_array(env, terms.data(),
-                                           static_cast<unsigned int>(size));
-    return fine::encode(env,
-                        std::make_tuple(atoms::map_set, fine::Term(items)));
+    enif_map_iterator_destroy(env, &iterator);
+    return success;
   }
 
-  auto py_pythonx = PyImport_AddModule("pythonx");
-  raise_if_failed(env, py_pythonx);
+  PyObjectPtr checked(PyObjectPtr py_object) {
+    raise_if_failed(env, py_object);
+    return py_object;
+  }
+};
 
-  auto py_PID = PyObject_GetAttrString(py_pythonx, "PID");
-  raise_if_failed(env, py_PID);
-  auto py_PID_guard = PyDecRefGuard(py_PID);
+std::variant<fine::Ok<fine::Term>, fine::Error<>>
+decode_all(ErlNifEnv *env, ExObject ex_object, bool map_set, bool decimal,
+           bool atom_keys, bool arena, bool objects) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
 
-  auto is_pid = PyObject_IsInstance(py_object, py_PID);
-  raise_if_failed(env, is_pid);
-  if (is_pid) {
-    auto py_pid_bytes = PyObject_GetAttrString(py_object, "bytes");
-    raise_if_failed(env, py_pid_bytes);
-    auto py_pid_bytes_guard = PyDecRefGuard(py_pid_bytes);
+  auto tag_guard = ObjectTagGuard(
+      object_registry.is_enabled() ? ex_object.tag() : std::nullopt);
 
-    Py_ssize_t size;
-    char *pid_bytes;
-    auto result = PyBytes_AsStringAndSize(py_pid_bytes, &pid_bytes, &size);
-    raise_if_failed(env, result);
+  auto builder =
+      PyTermBuilder(env, map_set, decimal, atom_keys, arena, objects);
 
-    auto pid = ErlNifPid{};
-    std::memcpy(&pid, pid_bytes, sizeof(ErlNifPid));
+  ERL_NIF_TERM term;
+  if (!builder.build(ex_object.py_object(), term)) {
+    return fine::Error<>();
+  }
 
-    return fine::encode(env, pid);
+  return fine::Ok<fine::Term>(fine::Term(term));
+}
+
+FINE_NIF(decode_all, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+std::variant<fine::Ok<ExObject>, fine::Error<>>
+object_from_term(ErlNifEnv *env, fine::Term term) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto reader = PyTermReader(env);
+  auto py_object = reader.read(term);
+
+  if (py_object == NULL) {
+    return fine::Error<>();
   }
 
-  // None of the built-ins, return %Pythonx.Object{} as is
-  return fine::encode(env, ex_object);
+  report_memory_pressure(env, reader.binaries_size());
+
+  return fine::Ok<ExObject>(make_ex_object(env, py_object));
 }
 
-FINE_NIF(decode_once, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+FINE_NIF(object_from_term, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
 std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
                                              ErlNifBinary code) {
@@ -1144,32 +5690,19 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
   PyObjectPtr py_last_expr_code = nullptr;
   auto py_last_expr_code_guard = PyDecRefGuard();
 
-  auto py_ast = PyImport_ImportModule("ast");
-  raise_if_failed(env, py_ast);
-  auto py_ast_guard = PyDecRefGuard(py_ast);
-
-  auto py_parse = PyObject_GetAttrString(py_ast, "parse");
-  raise_if_failed(env, py_parse);
-  auto py_parse_guard = PyDecRefGuard(py_parse);
+  auto &cache = get_py_cache(env);
 
   auto py_code = PyUnicode_FromStringAndSize(
       reinterpret_cast<const char *>(code.data), code.size);
   raise_if_failed(env, py_code);
   auto py_code_guard = PyDecRefGuard(py_code);
 
-  auto py_file_string = PyUnicode_FromStringAndSize("<string>", 8);
-  raise_if_failed(env, py_file_string);
-  auto py_file_string_guard = PyDecRefGuard(py_file_string);
-
-  auto py_exec_string = PyUnicode_FromStringAndSize("exec", 4);
-  raise_if_failed(env, py_exec_string);
-  auto py_exec_string_guard = PyDecRefGuard(py_exec_string);
-
-  auto py_parse_args = PyTuple_Pack(3, py_code, py_file_string, py_exec_string);
+  auto py_parse_args = PyTuple_Pack(3, py_code, cache.string_filename,
+                                    cache.string_exec);
   raise_if_failed(env, py_parse_args);
   auto py_parse_args_guard = PyDecRefGuard(py_parse_args);
 
-  auto py_module_ast = PyObject_Call(py_parse, py_parse_args, NULL);
+  auto py_module_ast = PyObject_Call(cache.ast_parse, py_parse_args, NULL);
   raise_if_failed(env, py_module_ast);
   auto py_module_ast_guard = PyDecRefGuard(py_module_ast);
 
@@ -1190,11 +5723,7 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
     auto py_last_expr = PyList_GetItem(py_module_body, py_module_body_size - 1);
     raise_if_failed(env, py_last_expr);
 
-    auto py_Expr = PyObject_GetAttrString(py_ast, "Expr");
-    raise_if_failed(env, py_Expr);
-    auto py_Expr_guard = PyDecRefGuard(py_Expr);
-
-    auto is_Expr_instance = PyObject_IsInstance(py_last_expr, py_Expr);
+    auto is_Expr_instance = PyObject_IsInstance(py_last_expr, cache.ast_Expr);
     raise_if_failed(env, is_Expr_instance);
 
     if (is_Expr_instance) {
@@ -1211,15 +5740,12 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
       raise_if_failed(env, py_last_expr_value);
       auto py_last_expr_value_guard = PyDecRefGuard(py_last_expr_value);
 
-      auto py_Expression = PyObject_GetAttrString(py_ast, "Expression");
-      raise_if_failed(env, py_Expression);
-      auto py_Expression_guard = PyDecRefGuard(py_Expression);
-
       auto py_Expression_args = PyTuple_Pack(1, py_last_expr_value);
       raise_if_failed(env, py_Expression_args);
       auto py_Expression_args_guard = PyDecRefGuard(py_Expression_args);
 
-      auto py_expr = PyObject_Call(py_Expression, py_Expression_args, NULL);
+      auto py_expr =
+          PyObject_Call(cache.ast_Expression, py_Expression_args, NULL);
       raise_if_failed(env, py_expr);
       auto py_expr_guard = PyDecRefGuard(py_expr);
 
@@ -1232,12 +5758,8 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
                         PyObject_SetAttrString(py_expr, attr_name, attr_value));
       }
 
-      auto py_eval_string = PyUnicode_FromStringAndSize("eval", 4);
-      raise_if_failed(env, py_eval_string);
-      auto py_eval_string_guard = PyDecRefGuard(py_eval_string);
-
-      auto py_compile_args =
-          PyTuple_Pack(3, py_expr, py_file_string, py_eval_string);
+      auto py_compile_args = PyTuple_Pack(3, py_expr, cache.string_filename,
+                                          cache.string_eval);
       raise_if_failed(env, py_compile_args);
       auto py_compile_args_guard = PyDecRefGuard(py_compile_args);
 
@@ -1249,8 +5771,8 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
   }
 
   if (py_module_body_size > 0) {
-    auto py_compile_args =
-        PyTuple_Pack(3, py_module_ast, py_file_string, py_exec_string);
+    auto py_compile_args = PyTuple_Pack(3, py_module_ast, cache.string_filename,
+                                        cache.string_exec);
     raise_if_failed(env, py_compile_args);
     auto py_compile_args_guard = PyDecRefGuard(py_compile_args);
 
@@ -1266,9 +5788,23 @@ std::tuple<PyObjectPtr, PyObjectPtr> compile(ErlNifEnv *env,
 std::tuple<std::optional<ExObject>, fine::Term>
 eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
      std::vector<std::tuple<ErlNifBinary, ExObject>> globals,
-     fine::Term stdout_device, fine::Term stderr_device) {
+     fine::Term stdout_device, fine::Term stderr_device,
+     std::optional<std::string> tag, bool eager_error_lines,
+     fine::Atom traceback) {
   ensure_initialized();
 
+  auto error_options = ErrorOptions();
+  error_options.eager_lines = eager_error_lines;
+
+  if (traceback == atoms::keep) {
+    error_options.traceback = ErrorOptions::Traceback::keep;
+  } else if (traceback == atoms::summary) {
+    error_options.traceback = ErrorOptions::Traceback::summary;
+  } else {
+    error_options.traceback = ErrorOptions::Traceback::clear_frames;
+  }
+  auto error_options_guard = ErrorOptionsGuard(error_options);
+
   // Step 1: compile (or get cached result)
 
   PyObjectPtr py_body_code = nullptr;
@@ -1291,6 +5827,7 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
   }
 
   auto gil_guard = PyGILGuard();
+  auto tag_guard = ObjectTagGuard(tag);
 
   // Step 2: prepare globals
 
@@ -1333,23 +5870,14 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
   //
   // [1]: https://github.com/marimo-team/marimo/pull/811
 
-  auto py_types = PyImport_ImportModule("types");
-  raise_if_failed(env, py_types);
-  auto py_types_guard = PyDecRefGuard(py_types);
-
-  auto py_ModuleType = PyObject_GetAttrString(py_types, "ModuleType");
-  raise_if_failed(env, py_ModuleType);
-  auto py_ModuleType_guard = PyDecRefGuard(py_ModuleType);
-
-  auto py_main_module_string = PyUnicode_FromStringAndSize("__main__", 8);
-  raise_if_failed(env, py_main_module_string);
-  auto py_main_module_string_guard = PyDecRefGuard(py_main_module_string);
+  auto &cache = get_py_cache(env);
 
-  auto py_ModuleType_args = PyTuple_Pack(1, py_main_module_string);
+  auto py_ModuleType_args = PyTuple_Pack(1, cache.string_main);
   raise_if_failed(env, py_ModuleType_args);
   auto py_ModuleType_args_guard = PyDecRefGuard(py_ModuleType_args);
 
-  auto py_main_module = PyObject_Call(py_ModuleType, py_ModuleType_args, NULL);
+  auto py_main_module =
+      PyObject_Call(cache.types_ModuleType, py_ModuleType_args, NULL);
   raise_if_failed(env, py_main_module);
   auto py_main_module_guard = PyDecRefGuard(py_main_module);
 
@@ -1416,12 +5944,16 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
   raise_if_failed(env, py_globals_initial);
   auto py_globals_guard = PyDecRefGuard(py_globals_initial);
 
+  auto given_py_objects = std::set<PyObjectPtr>();
+
   for (const auto &[key, value] : globals) {
+    given_py_objects.insert(value.py_object());
+
     auto py_key = PyUnicode_FromStringAndSize(
         reinterpret_cast<const char *>(key.data), key.size);
     raise_if_failed(env, py_key);
 
-    auto result = PyDict_SetItem(py_globals, py_key, value.resource->py_object);
+    auto result = PyDict_SetItem(py_globals, py_key, value.py_object());
     Py_DecRef(py_key);
     raise_if_failed(env, result);
   }
@@ -1436,10 +5968,16 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
 
   auto result = std::optional<ExObject>();
 
+  // Memory estimate of the objects returned from this evaluation, see
+  // report_memory_pressure for more details.
+  size_t memory_size = 0;
+  auto &types = get_builtin_types(env);
+
   if (py_last_expr_code != nullptr) {
     auto py_result = PyEval_EvalCode(py_last_expr_code, py_globals, py_globals);
     raise_if_failed(env, py_result);
-    result = ExObject(fine::make_resource<PyObjectResource>(py_result));
+    memory_size += py_object_large_memory_size(types, py_result);
+    result = make_ex_object(env, py_result);
   }
 
   // Step 4: flat-decode globals
@@ -1470,12 +6008,19 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
     auto key_term = py_str_to_binary_term(env, py_key);
     key_terms.push_back(key_term);
 
+    // Objects given as globals have already been accounted for
+    if (given_py_objects.find(py_value) == given_py_objects.end()) {
+      memory_size += py_object_large_memory_size(types, py_value);
+    }
+
     // Incref before making the resource
     Py_IncRef(py_value);
-    auto ex_value = ExObject(fine::make_resource<PyObjectResource>(py_value));
+    auto ex_value = make_ex_object(env, py_value);
     value_terms.push_back(fine::encode(env, ex_value));
   }
 
+  report_memory_pressure(env, memory_size);
+
   ERL_NIF_TERM map;
   if (!enif_make_map_from_arrays(env, key_terms.data(), value_terms.data(),
                                  key_terms.size(), &map)) {
@@ -1487,32 +6032,68 @@ eval(ErlNifEnv *env, ErlNifBinary code, std::string code_md5,
 
 FINE_NIF(eval, ERL_NIF_DIRTY_JOB_CPU_BOUND);
 
-std::variant<fine::Ok<fine::Term>, fine::Error<std::string, ExError>>
-dump_object(ErlNifEnv *env, ExObject ex_object) {
+std::vector<fine::Term> error_format_lines(ErlNifEnv *env, ExObject type,
+                                           ExObject value, ExObject traceback) {
   ensure_initialized();
   auto gil_guard = PyGILGuard();
 
-  std::string pickle_module_name;
-  PyObjectPtr py_pickle;
+  return py_error_lines(env, type.py_object(), value.py_object(),
+                        traceback.py_object());
+}
 
-  py_pickle = PyImport_ImportModule("cloudpickle");
-  if (py_pickle != NULL) {
-    pickle_module_name = "cloudpickle";
-  } else {
-    // If importing fails, we ignore the error and fallback to the pickle
-    // module.
+FINE_NIF(error_format_lines, ERL_NIF_DIRTY_JOB_CPU_BOUND);
+
+// Returns a borrowed reference to cloudpickle.dumps, or NULL if
+// cloudpickle is not available.
+//
+// cloudpickle is optional and may be installed after the interpreter
+// is initialized, so we keep trying to import it until it is found.
+//
+// Requires GIL.
+PyObjectPtr get_cloudpickle_dumps(ErlNifEnv *env) {
+  static PyObjectPtr cached = NULL;
+
+  if (cached != NULL) {
+    return cached;
+  }
+
+  auto py_cloudpickle = PyImport_ImportModule("cloudpickle");
+  if (py_cloudpickle == NULL) {
     PyErr_Clear();
-    py_pickle = PyImport_ImportModule("pickle");
-    raise_if_failed(env, py_pickle);
-    pickle_module_name = "pickle";
+    return NULL;
   }
-  auto py_pickle_guard = PyDecRefGuard(py_pickle);
+  auto py_cloudpickle_guard = PyDecRefGuard(py_cloudpickle);
 
-  auto py_dumps = PyObject_GetAttrString(py_pickle, "dumps");
+  auto py_dumps = PyObject_GetAttrString(py_cloudpickle, "dumps");
   raise_if_failed(env, py_dumps);
-  auto py_dumps_guard = PyDecRefGuard(py_dumps);
 
-  auto py_dumps_args = PyTuple_Pack(1, ex_object.resource->py_object);
+  // The import may release the GIL, in which case another thread may
+  // have set the reference in the meantime
+  if (cached != NULL) {
+    Py_DecRef(py_dumps);
+    return cached;
+  }
+
+  // We keep the reference for the lifetime of the interpreter
+  cached = py_dumps;
+  return cached;
+}
+
+std::variant<fine::Ok<fine::Term>, fine::Error<std::string, ExError>>
+dump_object(ErlNifEnv *env, ExObject ex_object) {
+  ensure_initialized();
+  auto gil_guard = PyGILGuard();
+
+  auto py_cloudpickle_dumps = get_cloudpickle_dumps(env);
+
+  // If cloudpickle is not available, we fallback to the pickle module
+  auto pickle_module_name =
+      std::string(py_cloudpickle_dumps != NULL ? "cloudpickle" : "pickle");
+  auto py_dumps = py_cloudpickle_dumps != NULL
+                      ? py_cloudpickle_dumps
+                      : get_py_cache(env).pickle_dumps;
+
+  auto py_dumps_args = PyTuple_Pack(1, ex_object.py_object());
   raise_if_failed(env, py_dumps_args);
   auto py_dumps_args_guard = PyDecRefGuard(py_dumps_args);
 
@@ -1533,13 +6114,7 @@ ExObject load_object(ErlNifEnv *env, ErlNifBinary binary) {
   ensure_initialized();
   auto gil_guard = PyGILGuard();
 
-  auto py_pickle = PyImport_ImportModule("pickle");
-  raise_if_failed(env, py_pickle);
-  auto py_pickle_guard = PyDecRefGuard(py_pickle);
-
-  auto py_loads = PyObject_GetAttrString(py_pickle, "loads");
-  raise_if_failed(env, py_loads);
-  auto py_loads_guard = PyDecRefGuard(py_loads);
+  auto py_loads = get_py_cache(env).pickle_loads;
 
   auto py_bytes = PyBytes_FromStringAndSize(
       reinterpret_cast<const char *>(binary.data), binary.size);
@@ -1553,7 +6128,9 @@ ExObject load_object(ErlNifEnv *env, ErlNifBinary binary) {
   auto py_object = PyObject_Call(py_loads, py_loads_args, NULL);
   raise_if_failed(env, py_object);
 
-  return ExObject(fine::make_resource<PyObjectResource>(py_object));
+  report_memory_pressure(env, py_object_memory_size(py_object));
+
+  return make_ex_object(env, py_object);
 }
 
 FINE_NIF(load_object, ERL_NIF_DIRTY_JOB_CPU_BOUND);
@@ -1626,6 +6203,10 @@ extern "C" void pythonx_handle_io_write(const char *message,
   }
 }
 
+extern "C" void pythonx_handle_free_env(void *env) {
+  enif_free_env(reinterpret_cast<ErlNifEnv *>(env));
+}
+
 extern "C" void
 pythonx_handle_send_tagged_object(const char *pid_bytes, const char *tag,
                                   pythonx::python::PyObjectPtr *py_object,
@@ -1646,3 +6227,112 @@ pythonx_handle_send_tagged_object(const char *pid_bytes, const char *tag,
   enif_send(caller_env, &pid, env, msg);
   enif_free_env(env);
 }
+
+extern "C" int pythonx_handle_source_pull(void *channel_ptr, uint64_t size,
+                                          const char *eval_info_bytes) {
+  using Reply = pythonx::SourceChannelResource::Reply;
+
+  auto channel =
+      reinterpret_cast<pythonx::SourceChannelResource *>(channel_ptr);
+
+  auto eval_info = eval_info_from_bytes(eval_info_bytes);
+  auto caller_env = get_caller_env(eval_info);
+
+  auto lock = std::unique_lock<std::mutex>(channel->mutex);
+
+  if (channel->closed) {
+    return -1;
+  }
+
+  channel->has_reply = false;
+
+  auto msg_env = enif_alloc_env();
+  auto msg = fine::encode(
+      msg_env, std::make_tuple(pythonx::atoms::pythonx_source_pull, size));
+  auto sent = enif_send(caller_env, &channel->pid, msg_env, msg);
+  enif_free_env(msg_env);
+
+  if (!sent) {
+    // The source process is no longer alive
+    channel->closed = true;
+    return -1;
+  }
+
+  channel->condition.wait(
+      lock, [&] { return channel->has_reply || channel->closed; });
+
+  if (!channel->has_reply) {
+    return -1;
+  }
+
+  switch (channel->reply) {
+  case Reply::data:
+    return 1;
+  case Reply::done:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+extern "C" int
+pythonx_handle_source_take(void *channel_ptr,
+                           pythonx::python::PyObjectPtr py_list) {
+  using namespace pythonx::python;
+  using Reply = pythonx::SourceChannelResource::Reply;
+
+  auto channel =
+      reinterpret_cast<pythonx::SourceChannelResource *>(channel_ptr);
+
+  auto lock = std::unique_lock<std::mutex>(channel->mutex);
+
+  if (!channel->has_reply) {
+    return 0;
+  }
+
+  channel->has_reply = false;
+
+  // This is called from Python with the GIL held. Any Python error is
+  // raised once we return.
+  PyObjectPtr py_item = NULL;
+  ErlNifBinary binary;
+
+  if (enif_inspect_binary(channel->reply_env, channel->reply_term, &binary)) {
+    auto data = reinterpret_cast<const char *>(binary.data);
+    py_item = channel->reply == Reply::error
+                  ? PyUnicode_FromStringAndSize(data, binary.size)
+                  : PyBytes_FromStringAndSize(data, binary.size);
+  } else if (channel->reply == Reply::data &&
+             enif_is_list(channel->reply_env, channel->reply_term)) {
+    // Items are sent as terms and we build the Python objects here.
+    // Encoding them in the source process would require a dirty
+    // scheduler, while all of them may be taken by evaluations that
+    // wait for this and other sources. If any of the items has no
+    // built-in conversion, we return no data and the caller raises.
+    try {
+      auto reader = pythonx::PyTermReader(channel->reply_env);
+      py_item = reader.read(channel->reply_term);
+    } catch (...) {
+      // Same as above, the caller raises
+    }
+  } else if (channel->reply == Reply::data) {
+    try {
+      auto ex_object = fine::decode<pythonx::ExObject>(channel->reply_env,
+                                                       channel->reply_term);
+      py_item = ex_object.py_object();
+      Py_IncRef(py_item);
+    } catch (const std::exception &) {
+      // Ignore, the caller treats missing data as an error
+    }
+  }
+
+  enif_clear_env(channel->reply_env);
+
+  if (py_item == NULL) {
+    return 0;
+  }
+
+  PyList_Append(py_list, py_item);
+  Py_DecRef(py_item);
+  return 1;
+}
@@ -12,6 +12,8 @@ defmodule Pythonx do
 
   @install_env_name "PYTHONX_INIT_STATE"
 
+  @array_types [:u8, :u16, :u32, :u64, :s8, :s16, :s32, :s64, :f32, :f64]
+
   @type encoder :: (term(), encoder() -> Object.t())
 
   @doc ~s'''
@@ -260,6 +262,32 @@ defmodule Pythonx do
     * `:stderr_device` - IO process to send Python stderr output to.
       Defaults to the global `:standard_error`.
 
+    * `:tag` - a string used to identify objects created by this
+      evaluation in `memory_stats/1`. Items decoded from these objects
+      inherit the tag. Only relevant when object tracking is enabled.
+
+    * `:error_message` - when the evaluation raises, determines when
+      the Python traceback is formatted into the `Pythonx.Error` message.
+      With `:lazy`, formatting happens only once the message is requested,
+      so rescuing the error is cheap. With `:eager`, the lines are formatted
+      right away. Defaults to `:lazy`.
+
+    * `:traceback` - when the evaluation raises, determines what is kept
+      from the Python traceback in `Pythonx.Error`. Traceback frames
+      reference all their local variables, which can hold onto a lot of
+      memory for as long as the error is around. The supported values
+      are:
+
+        * `:clear_frames` (default) - local variables of all frames are
+          cleared, but the traceback itself is kept, so the message
+          still includes the stack trace
+
+        * `:summary` - the error message is formatted right away and
+          the traceback is dropped altogether
+
+        * `:keep` - the traceback is kept intact, which is useful when
+          inspecting frames for debugging
+
   ## Examples
 
       iex> {result, globals} =
@@ -342,7 +370,7 @@ defmodule Pythonx do
             "the :pythonx application needs to be started before calling Pythonx.eval/3"
     end
 
-    opts = Keyword.validate!(opts, [:stdout_device, :stderr_device])
+    opts = validate_eval_opts!(opts)
     validate_globals!(globals)
 
     globals =
@@ -350,12 +378,7 @@ defmodule Pythonx do
         {key, encode!(value)}
       end
 
-    stdout_device = Keyword.get_lazy(opts, :stdout_device, fn -> Process.group_leader() end)
-
-    stderr_device =
-      Keyword.get_lazy(opts, :stderr_device, fn -> Process.whereis(:standard_error) end)
-
-    do_eval(code, globals, stdout_device, stderr_device)
+    do_eval(code, globals, opts)
   end
 
   defp pythonx_started?() do
@@ -370,10 +393,52 @@ defmodule Pythonx do
     end
   end
 
-  defp do_eval(code, globals, stdout_device, stderr_device) do
+  defp validate_eval_opts!(opts) do
+    opts =
+      opts
+      |> Keyword.validate!([
+        :stdout_device,
+        :stderr_device,
+        :tag,
+        error_message: :lazy,
+        traceback: :clear_frames
+      ])
+      |> Keyword.put_new_lazy(:stdout_device, fn -> Process.group_leader() end)
+      |> Keyword.put_new_lazy(:stderr_device, fn -> Process.whereis(:standard_error) end)
+
+    if opts[:tag] != nil and not is_binary(opts[:tag]) do
+      raise ArgumentError, "expected :tag to be a string, got: #{inspect(opts[:tag])}"
+    end
+
+    if opts[:error_message] not in [:lazy, :eager] do
+      raise ArgumentError,
+            "expected :error_message to be either :lazy or :eager, got: " <>
+              inspect(opts[:error_message])
+    end
+
+    if opts[:traceback] not in [:clear_frames, :summary, :keep] do
+      raise ArgumentError,
+            "expected :traceback to be one of :clear_frames, :summary or :keep, got: " <>
+              inspect(opts[:traceback])
+    end
+
+    opts
+  end
+
+  defp do_eval(code, globals, opts) do
     code_md5 = :erlang.md5(code)
 
-    result = Pythonx.NIF.eval(code, code_md5, globals, stdout_device, stderr_device)
+    result =
+      Pythonx.NIF.eval(
+        code,
+        code_md5,
+        globals,
+        opts[:stdout_device],
+        opts[:stderr_device],
+        opts[:tag],
+        opts[:error_message] == :eager,
+        opts[:traceback]
+      )
 
     # Wait for the janitor to process all output messages received
     # during the evaluation, so that they are not perceived overly
@@ -473,6 +538,26 @@ defmodule Pythonx do
   Encoding can be extended to support custom data structures, see
   `Pythonx.Encoder`.
 
+  The second argument is either a custom encoder function, or a list
+  of options.
+
+  ## Options
+
+    * `:as` - when set to `{:array, type}`, encodes a list of numbers
+      (or a binary with packed native numbers) as a Python `array.array`
+      of the given type. The list is packed in a single pass, which is
+      considerably faster than encoding each number as a separate Python
+      object. The type is one of `:u8`, `:u16`, `:u32`, `:u64`, `:s8`,
+      `:s16`, `:s32`, `:s64`, `:f32` and `:f64`. Integers are accepted
+      for float types, while numbers out of the integer type range
+      result in an error
+
+      When set to `:bytes`, encodes the given iodata as Python `bytes`.
+      The fragments are copied directly into the `bytes` object, so
+      this is more efficient than flattening the iodata first
+
+    * `:encoder` - the encoder function, see `Pythonx.Encoder`
+
   ## Examples
 
       iex> Pythonx.encode!({1, true, "hello world"})
@@ -480,12 +565,100 @@ defmodule Pythonx do
         (1, True, b'hello world')
       >
 
+      iex> Pythonx.encode!([1.0, 2.5, 3], as: {:array, :f64})
+      #Pythonx.Object<
+        array('d', [1.0, 2.5, 3.0])
+      >
+
   """
-  @spec encode!(term(), encoder()) :: Object.t()
-  def encode!(term, encoder \\ &Pythonx.Encoder.encode/2) do
-    encoder.(term, encoder)
+  @spec encode!(term(), encoder() | keyword()) :: Object.t()
+  def encode!(term, encoder_or_opts \\ &Pythonx.Encoder.encode/2)
+
+  def encode!(term, opts) when is_list(opts) do
+    opts = Keyword.validate!(opts, [:as, encoder: &Pythonx.Encoder.encode/2])
+
+    case opts[:as] do
+      nil ->
+        encode!(term, opts[:encoder])
+
+      :bytes ->
+        Pythonx.NIF.bytes_from_iodata(term)
+
+      {:array, type} when type in @array_types ->
+        if not (is_list(term) or is_binary(term)) do
+          raise ArgumentError,
+                "expected a list of numbers or a binary to encode as " <>
+                  "{:array, #{inspect(type)}}, got: #{inspect(term)}"
+        end
+
+        Pythonx.NIF.array_from_numbers(term, type)
+
+      other ->
+        raise ArgumentError,
+              "expected :as to be :bytes or {:array, type}, where type is one of " <>
+                "#{inspect(@array_types)}, got: #{inspect(other)}"
+    end
   end
 
+  def encode!(term, encoder) when is_function(encoder, 2) do
+    # With the default encoder, we first try to build the whole Python
+    # object directly from the term, in a single NIF call. This works
+    # for data with built-in encoding, otherwise the NIF gives up on
+    # the first term that needs the protocol and we go through it.
+    if encoder == (&Pythonx.Encoder.encode/2) and natively_encodable?(term) do
+      case Pythonx.NIF.object_from_term(term) do
+        {:ok, object} -> object
+        :error -> encoder.(term, encoder)
+      end
+    else
+      encoder.(term, encoder)
+    end
+  end
+
+  # Top-level terms other than containers already map to a single NIF
+  # call, and most structs need the protocol, so we skip the attempt
+  defp natively_encodable?(term) when is_list(term) or is_tuple(term), do: true
+  defp natively_encodable?(%MapSet{}), do: true
+  defp natively_encodable?(term) when is_map(term), do: not is_struct(term)
+  defp natively_encodable?(_term), do: false
+
+  @doc """
+  Exposes the given binary to Python as a read-only `memoryview`,
+  without copying.
+
+  Binaries are encoded as Python `bytes` by default, which involves
+  copying the whole binary. For large binaries this doubles the peak
+  memory usage, so this function can be used instead, to pass the
+  binary memory to Python directly. Python libraries accepting buffers
+  (such as `numpy.frombuffer`) can then read the data without copying.
+
+  The binary is kept alive as long as the `memoryview`, or any buffer
+  derived from it, is referenced in Python.
+
+  Note that a sub-binary exposes only the relevant part of the data,
+  but keeps the whole underlying binary alive.
+
+  ## Examples
+
+      iex> view = Pythonx.memoryview("hello world")
+      iex> {result, %{}} = Pythonx.eval("bytes(view[0:5])", %{"view" => view})
+      iex> Pythonx.decode(result)
+      "hello"
+
+  """
+  @spec memoryview(binary()) :: Object.t()
+  def memoryview(binary) when is_binary(binary) do
+    Pythonx.NIF.memoryview_from_binary(binary)
+  end
+
+  # Sets can be built directly as MapSet structs, as long as the struct
+  # only has the :map field, with [] as values.
+  @map_set_struct Map.from_struct(MapSet.new([0])) == %{map: %{0 => []}}
+
+  # decimal.Decimal is decoded as the Decimal struct only when the
+  # optional :decimal package is available.
+  @decimal_struct Code.ensure_loaded?(Decimal)
+
   @doc """
   Decodes a Python object to a term.
 
@@ -497,15 +670,36 @@ defmodule Pythonx do
     * `float`
     * `str`
     * `bytes`
+    * `bytearray`
+    * `memoryview`
     * `tuple`
     * `list`
     * `dict`
     * `set`
     * `frozenset`
     * `pythonx.PID`
+    * `datetime.date`
+    * `datetime.time`
+    * `datetime.datetime`
+    * `decimal.Decimal`
 
   For all other types `Pythonx.Object` is returned.
 
+  Both `bytearray` and `memoryview` are decoded into binaries with
+  their raw contents, see `to_binary/2` for details.
+
+  Naive `datetime.datetime` objects are decoded into `NaiveDateTime`,
+  while aware ones are decoded into `DateTime`, shifted to UTC. Aware
+  `datetime.time` objects have no Elixir counterpart, so those are
+  returned as `Pythonx.Object`. `decimal.Decimal` is decoded into the
+  `Decimal` struct from the `:decimal` package, if available, and
+  returned as `Pythonx.Object` otherwise.
+
+  Note that calendar round-trips are lossy. The original time zone of
+  a `DateTime` is not restored, and since Python does not track the
+  microsecond precision, it is decoded as 6, or 0 when there are no
+  microseconds.
+
   ## Examples
 
       iex> {result, %{}} = Pythonx.eval("(1, True, 'hello world')", %{})
@@ -520,54 +714,754 @@ defmodule Pythonx do
 
   """
   @spec decode(Object.t()) :: term()
-  def decode(%Object{} = object) do
+  def decode(%Object{} = object), do: decode_with(object, %{keys: :strings, arena: false})
+
+  def decode(nil) do
+    raise ArgumentError,
+          "Pythonx.decode/1 expects a %Pythonx.Object{}, but got nil. " <>
+            "Note that Pythonx.eval/2 or the ~PY sigil result in nil, if the " <>
+            "evaluated code ends with a statement, rather than expression"
+  end
+
+  defp decode_with(object, config) when node(object.resource) == node() do
+    # We first try to build the whole term in a single NIF call. This
+    # way we avoid the overhead of multiple NIF calls, GIL acquisitions
+    # and intermediate lists. String dict keys are interned within the
+    # call, so repeated keys share a single binary (or atom). MapSet is
+    # built as the struct, as long as its internal representation
+    # matches what we expect (see @map_set_struct). Similarly, Decimal
+    # is built only if available (see @decimal_struct). For the arena mode
+    # see the :arena option in decode/2.
+    #
+    # Objects that cannot be represented that way (such as deeply
+    # nested structures, or dicts with keys mapping to the same term)
+    # are decoded incrementally, see decode_incrementally/2.
+
+    atom_keys = config.keys == :atoms!
+
+    case Pythonx.NIF.decode_all(
+           object,
+           @map_set_struct,
+           @decimal_struct,
+           atom_keys,
+           config.arena,
+           true
+         ) do
+      {:ok, term} -> term
+      :error -> decode_incrementally(object, config.keys)
+    end
+  end
+
+  defp decode_with(object, config) do
+    # For remote objects we build the whole term on the remote node
+    # and get it as the call result.
+    node = node(object.resource)
+
+    case :erpc.call(node, __MODULE__, :__decode_remote__, [object, config.keys == :atoms!]) do
+      {:ok, term} ->
+        term
+
+      :error ->
+        raise ArgumentError,
+              "cannot decode remote object, because it includes values without " <>
+                "term representation, call Pythonx.copy_remote_object/1 first"
+    end
+  end
+
+  defp decode_incrementally(object, keys) do
     # We call decode_once, which returns either an Elixir term, such
     # as a string or a container with %Object{} items for us to recur
     # over.
-    #
-    # We could make decode as a single NIF call, where objects are
-    # recursively converted to Elixir terms. The advantages of that
-    # approach are: (a) less overhead (single NIF and GIL acquisition);
-    # (b) less memory usage, since we don't build intermediate lists,
-    # just to map over them in Elixir. However, this comes with a hard
-    # limitation that all terms need to be fully built in the NIF,
-    # which means we cannot build MapSet, and even big integers are
-    # tricky to build (though possible by calling enif_binary_to_term
-    # with hand-crafted binary). On a sidenote, in the future we may
-    # want to make decoding extensible, such that user could provide
-    # a custom decoder function, and that would also not be possible
-    # under this limitation. That said, encoding also requires multiple
-    # NIF calls and Enum.map/2 is a usual occurrence, so in practice
-    # neither (a) or (b) makes the limitation worth it.
-
-    case Pythonx.NIF.decode_once(object) do
+
+    case Pythonx.NIF.decode_once(object, keys == :atoms!, @decimal_struct) do
       {:list, items} ->
-        Enum.map(items, &decode/1)
+        Enum.map(items, &decode_incrementally(&1, keys))
 
       {:tuple, items} ->
         items
-        |> Enum.map(&decode/1)
+        |> Enum.map(&decode_incrementally(&1, keys))
         |> List.to_tuple()
 
       {:map, items} ->
-        Map.new(items, fn {key, value} -> {decode(key), decode(value)} end)
+        Map.new(items, fn {key, value} ->
+          {decode_key(key, keys), decode_incrementally(value, keys)}
+        end)
 
       {:map_set, items} ->
-        MapSet.new(items, &decode/1)
+        MapSet.new(items, &decode_incrementally(&1, keys))
 
-      {:integer, string} ->
-        String.to_integer(string)
+      {:struct, module, fields} ->
+        fields = Enum.map(fields, fn {key, value} -> {key, decode_incrementally(value, keys)} end)
+        struct(module, fields)
 
       term ->
         term
     end
   end
 
-  def decode(nil) do
+  # With atom keys, str keys are already converted by decode_once
+  defp decode_key(key, _keys) when is_atom(key), do: key
+  defp decode_key(key, keys), do: decode_incrementally(key, keys)
+
+  @doc """
+  Decodes a Python object to a term, with options.
+
+  See `decode/1` for the default conversion.
+
+  ## Options
+
+    * `:as` - when set to `{type, format}`, decodes a sequence of numbers,
+      such as `list`, `tuple`, `array.array` or a one-dimensional numpy
+      array, into packed native numbers of the given type. The type is
+      one of `:u8`, `:u16`, `:u32`, `:u64`, `:s8`, `:s16`, `:s32`,
+      `:s64`, `:f32` and `:f64`. The format is either `:binary`, to get
+      a binary with the packed numbers, or `:list`, to get a list.
+
+      Objects exposing a contiguous buffer with items of matching type
+      are converted directly, see `to_binary/2`. Otherwise, the items
+      are converted one by one, in a single pass, and numbers out of
+      the integer type range result in an error.
+
+    * `:layout` - when set to `:columnar`, decodes a sequence of records
+      (dicts), such as `list[dict]`, into a map of columns. The map has
+      one entry per key, with a list of the corresponding values from
+      all records. Records missing a key have `nil` in that column. The
+      records are transposed on the Python side in a single pass, so
+      each key is decoded only once. When combined with `:as`, every
+      column is decoded accordingly, in which case every record must
+      include all the keys, since `nil` is not a valid number. The
+      result can be passed directly to `Explorer.DataFrame.new/2`.
+
+    * `:keys` - how to decode string dict keys, either `:strings` or
+      `:atoms!`. With `:atoms!`, keys are decoded as existing atoms,
+      and an error is raised if any such atom does not exist. In both
+      cases repeated keys share a single term, which substantially
+      reduces memory usage for collections of records. Defaults to
+      `:strings`
+
+    * `:arena` - when `true`, medium-sized strings and bytes (up to 4 KiB)
+      are copied into a few shared buffers and decoded as sub-binaries
+      of those. By default, such binaries point directly to the Python
+      object memory, which keeps every object alive individually. The
+      arena mode is beneficial when decoding many strings, such as
+      `list[str]`, since it requires far fewer allocations and Python
+      objects can be freed right away. On the other hand, a shared
+      buffer is kept in memory as long as any of its sub-binaries is
+      referenced. Strings up to 64 bytes are always copied. Defaults to
+      `false`
+
+  ## Examples
+
+      iex> {result, %{}} = Pythonx.eval("[1.0, 2.5, 3]", %{})
+      iex> Pythonx.decode(result, as: {:f64, :list})
+      [1.0, 2.5, 3.0]
+
+      iex> {result, %{}} = Pythonx.eval("import array; array.array('h', [1, -1])", %{})
+      iex> Pythonx.decode(result, as: {:s16, :binary})
+      <<1::signed-native-16, -1::signed-native-16>>
+
+      iex> {result, %{}} = Pythonx.eval("[{'x': 1, 'y': 2.0}, {'x': 3}]", %{})
+      iex> Pythonx.decode(result, layout: :columnar)
+      %{"x" => [1, 3], "y" => [2.0, nil]}
+
+      iex> {result, %{}} = Pythonx.eval("[{'x': 1}, {'x': 2}]", %{})
+      iex> Pythonx.decode(result, keys: :atoms!)
+      [%{x: 1}, %{x: 2}]
+
+  """
+  @spec decode(Object.t(), keyword()) :: term()
+  def decode(%Object{} = object, opts) when is_list(opts) do
+    opts = Keyword.validate!(opts, [:as, :layout, keys: :strings, arena: false])
+
+    keys = opts[:keys]
+
+    if keys not in [:strings, :atoms!] do
+      raise ArgumentError, "expected :keys to be :strings or :atoms!, got: #{inspect(keys)}"
+    end
+
+    config = %{keys: keys, arena: opts[:arena]}
+
+    case opts[:layout] do
+      nil ->
+        decode_as(object, opts[:as], config)
+
+      :columnar ->
+        columns = Pythonx.NIF.records_to_columns(object)
+
+        if opts[:as] do
+          {:map, items} = Pythonx.NIF.decode_once(columns, keys == :atoms!, @decimal_struct)
+
+          Map.new(items, fn {key, column} ->
+            key = decode_key(key, keys)
+            {key, decode_column_as(column, key, opts[:as], config)}
+          end)
+        else
+          decode_with(columns, config)
+        end
+
+      other ->
+        raise ArgumentError, "expected :layout to be :columnar, got: #{inspect(other)}"
+    end
+  end
+
+  defp decode_column_as(column, key, as, config) do
+    decode_as(column, as, config)
+  rescue
+    error in [ArgumentError, Pythonx.Error] ->
+      reraise ArgumentError,
+              "cannot decode column #{inspect(key)}, #{Exception.message(error)}\n\n" <>
+                "Note that records missing the key have nil in the column, so with " <>
+                ":as every record must include all the keys",
+              __STACKTRACE__
+  end
+
+  defp decode_as(object, nil, config), do: decode_with(object, config)
+
+  defp decode_as(object, {type, format}, _config)
+       when type in @array_types and format in [:binary, :list] do
+    binary = Pythonx.NIF.array_to_binary(object, type)
+
+    case format do
+      :binary -> binary
+      :list -> unpack_numbers(binary, type)
+    end
+  end
+
+  defp decode_as(_object, other, _config) do
     raise ArgumentError,
-          "Pythonx.decode/1 expects a %Pythonx.Object{}, but got nil. " <>
-            "Note that Pythonx.eval/2 or the ~PY sigil result in nil, if the " <>
-            "evaluated code ends with a statement, rather than expression"
+          "expected :as to be {type, :binary | :list}, where type is one of " <>
+            "#{inspect(@array_types)}, got: #{inspect(other)}"
+  end
+
+  defp unpack_numbers(binary, :u8), do: for(<<x::unsigned-native-8 <- binary>>, do: x)
+  defp unpack_numbers(binary, :u16), do: for(<<x::unsigned-native-16 <- binary>>, do: x)
+  defp unpack_numbers(binary, :u32), do: for(<<x::unsigned-native-32 <- binary>>, do: x)
+  defp unpack_numbers(binary, :u64), do: for(<<x::unsigned-native-64 <- binary>>, do: x)
+  defp unpack_numbers(binary, :s8), do: for(<<x::signed-native-8 <- binary>>, do: x)
+  defp unpack_numbers(binary, :s16), do: for(<<x::signed-native-16 <- binary>>, do: x)
+  defp unpack_numbers(binary, :s32), do: for(<<x::signed-native-32 <- binary>>, do: x)
+  defp unpack_numbers(binary, :s64), do: for(<<x::signed-native-64 <- binary>>, do: x)
+  defp unpack_numbers(binary, :f32), do: for(<<x::float-native-32 <- binary>>, do: x)
+  defp unpack_numbers(binary, :f64), do: for(<<x::float-native-64 <- binary>>, do: x)
+
+  @doc false
+  def __decode_remote__(object, atom_keys) do
+    # Objects without term representation cannot be embedded, since
+    # they would not be kept alive by the caller node
+    Pythonx.NIF.decode_all(object, @map_set_struct, @decimal_struct, atom_keys, false, false)
+  end
+
+  @doc """
+  Returns a stream over items of the given Python iterable.
+
+  The items are pulled lazily from a Python iterator, so the whole
+  collection is never materialized. This works with any iterable,
+  including generators, as well as large lists and other collections.
+
+  Items are fetched in chunks, where each chunk is pulled in a single
+  NIF call, under one GIL acquisition, and decoded in one go.
+
+  When the stream is halted early, the iterator reference is released.
+  Note that a generator is its own iterator, so it stays alive as long
+  as the given object is referenced and its pending `finally` clauses
+  do not run at that point. If you need the cleanup to happen once the
+  stream halts, call the generator `close()` method explicitly.
+
+  ## Options
+
+    * `:chunk_size` - the maximum number of items fetched at once.
+      Note that a chunk is emitted only once that many items are
+      produced, or the iterator is exhausted, so for slow producers
+      (such as token generators) you may want to use a lower value.
+      Defaults to `64`
+
+    * `:decode` - whether to decode the items, see `decode/1`. When
+      `false`, the items are emitted as `Pythonx.Object`. Defaults to
+      `true`
+
+  ## Examples
+
+      iex> {result, %{}} = Pythonx.eval("(x * x for x in range(5))", %{})
+      iex> result |> Pythonx.stream() |> Enum.take(3)
+      [0, 1, 4]
+
+  """
+  @spec stream(Object.t(), keyword()) :: Enumerable.t()
+  def stream(%Object{} = object, opts \\ []) do
+    opts = Keyword.validate!(opts, chunk_size: 64, decode: true)
+
+    chunk_size = opts[:chunk_size]
+
+    if not (is_integer(chunk_size) and chunk_size > 0) do
+      raise ArgumentError,
+            "expected :chunk_size to be a positive integer, got: #{inspect(chunk_size)}"
+    end
+
+    Stream.resource(
+      fn -> {Pythonx.NIF.object_get_iter(object), false} end,
+      fn
+        {iter, true} ->
+          {:halt, {iter, true}}
+
+        {iter, false} ->
+          {chunk, done} = Pythonx.NIF.iter_next_chunk(iter, chunk_size)
+          items = decode_chunk(chunk, opts[:decode])
+          Pythonx.release(chunk)
+          {items, {iter, done}}
+      end,
+      fn {iter, _done} -> Pythonx.release(iter) end
+    )
+  end
+
+  defp decode_chunk(chunk, true), do: decode(chunk)
+
+  defp decode_chunk(chunk, false) do
+    {:list, items} = Pythonx.NIF.decode_once(chunk, false, @decimal_struct)
+    items
+  end
+
+  @doc ~S"""
+  Returns a Python file-like reader over the given iodata or a stream
+  of iodata.
+
+  The reader is an `io.RawIOBase` object, so it can be wrapped with
+  `io.BufferedReader` or `io.TextIOWrapper`, and passed to any Python
+  code expecting a binary file. Data is pulled from Elixir lazily, so
+  large inputs are never materialized as a whole. While Python waits
+  for more data, the GIL is released.
+
+  The data is produced by a separate process, which terminates once
+  the data is exhausted, the reader is garbage collected, or the
+  calling process terminates. Reading from the reader after that
+  raises an error.
+
+  Note that the reader can only be read by code running within
+  `eval/3`.
+
+  ## Examples
+
+      iex> reader = Pythonx.reader(Stream.map(1..3, &"line #{&1}
+"))
+      iex> {result, %{}} =
+      ...>   Pythonx.eval(
+      ...>     """
+      ...>     import io
+      ...>     [line.strip() for line in io.TextIOWrapper(io.BufferedReader(reader))]
+      ...>     """,
+      ...>     %{"reader" => reader}
+      ...>   )
+      iex> Pythonx.decode(result)
+      ["line 1", "line 2", "line 3"]
+
+  """
+  @spec reader(iodata() | Enumerable.t(iodata())) :: Object.t()
+  def reader(data) do
+    Pythonx.Source.reader(data)
+  end
+
+  @doc """
+  Returns a Python iterator over items of the given enumerable.
+
+  Items are pulled from Elixir lazily and encoded in chunks, so the
+  enumerable is never materialized as a whole. While Python waits for
+  more items, the GIL is released.
+
+  Items are converted to Python objects by the consuming Python code,
+  so any number of iterators can be consumed concurrently, regardless
+  of the number of dirty schedulers. For this reason, only items with
+  built-in conversion are supported: numbers, strings, atoms, lists,
+  tuples, maps, ranges, `Pythonx.Object`, `MapSet`, `Decimal`, calendar
+  types and structs registered with `register_struct/2`. Other items,
+  such as structs with a custom `Pythonx.Encoder` implementation, raise
+  a `TypeError` in Python. Encode those upfront with `encode!/2` and
+  iterate over the resulting objects instead.
+
+  See `reader/1` for the lifetime of the data source.
+
+  ## Options
+
+    * `:chunk_size` - the maximum number of items pulled at once.
+      Defaults to `64`
+
+  ## Examples
+
+      iex> iterator = Pythonx.iterator(Stream.map(1..5, &(&1 * &1)))
+      iex> {result, %{}} = Pythonx.eval("sum(iterator)", %{"iterator" => iterator})
+      iex> Pythonx.decode(result)
+      55
+
+  """
+  @spec iterator(Enumerable.t(), keyword()) :: Object.t()
+  def iterator(enumerable, opts \\ []) do
+    opts = Keyword.validate!(opts, chunk_size: 64)
+
+    chunk_size = opts[:chunk_size]
+
+    if not (is_integer(chunk_size) and chunk_size > 0) do
+      raise ArgumentError,
+            "expected :chunk_size to be a positive integer, got: #{inspect(chunk_size)}"
+    end
+
+    Pythonx.Source.iterator(enumerable, chunk_size)
+  end
+
+  @doc ~S"""
+  Registers a Python class to represent the given struct.
+
+  The class must be a dataclass, a namedtuple, or a class with
+  `__slots__`, accepting its fields as positional constructor arguments.
+  Every class field must be a struct field, while struct fields without
+  a class counterpart are left out.
+
+  Once registered, the struct is encoded as an instance of the class,
+  given it derives `Pythonx.Encoder`:
+
+      defmodule Person do
+        @derive Pythonx.Encoder
+        defstruct [:name, :age]
+      end
+
+  The class and its field names are cached natively, so instances are
+  created without building intermediate dicts, and a list of structs
+  is created with a single call. Conversely, instances of the class
+  (but not its subclasses) are decoded back to the struct.
+
+  Registering the struct again replaces the previous class.
+
+  ## Examples
+
+      {person_class, %{}} =
+        Pythonx.eval(
+          """
+          from dataclasses import dataclass
+
+          @dataclass
+          class Person:
+            name: bytes
+            age: int
+
+          Person
+          """,
+          %{}
+        )
+
+      Pythonx.register_struct(Person, person_class)
+
+      {result, %{}} =
+        Pythonx.eval(
+          "[person.age for person in people]",
+          %{"people" => [%Person{name: "Alice", age: 30}]}
+        )
+
+      Pythonx.decode(result)
+      #=> [30]
+
+  """
+  @spec register_struct(module(), Object.t()) :: :ok
+  def register_struct(module, %Object{} = class) do
+    Pythonx.StructClass.register(module, class)
+  end
+
+  @doc """
+  Converts a Python object supporting the buffer protocol into a binary.
+
+  This works with `bytes`, `bytearray`, `memoryview`, `array.array`,
+  `mmap.mmap`, numpy arrays and any other object exposing a buffer.
+  The binary holds the raw buffer contents.
+
+  `bytes`, as well as memoryviews over `bytes`, are immutable, so
+  those are exposed as a binary without copying, and the Python object
+  is kept alive as long as the binary is referenced.
+
+  Other buffers can be modified from Python, while Elixir binaries are
+  expected to be immutable, so those are copied by default. This also
+  applies to read-only buffers, since they may be views over writable
+  memory, such as `memoryview.toreadonly()` of a `bytearray`. Buffers
+  that are not contiguous are always copied.
+
+  The copy is made while holding the GIL, so Python code running in
+  other threads cannot modify the buffer in the middle of the copy.
+  However, native code that runs without the GIL, such as numpy
+  operations in other threads, still can, in which case the binary may
+  include partially updated contents.
+
+  ## Options
+
+    * `:share_writable` - when `true`, contiguous buffers are exposed
+      without copying, regardless of the object. Only use this if you
+      are sure the buffer is not going to be modified for as long as
+      the binary is in use. Also note that some objects, such as
+      `bytearray`, cannot be resized while the binary is alive.
+      Defaults to `false`
+
+  ## Examples
+
+      iex> {result, %{}} = Pythonx.eval("memoryview(b'hello')", %{})
+      iex> Pythonx.to_binary(result)
+      "hello"
+
+      iex> {result, %{}} = Pythonx.eval("import array; array.array('B', [1, 2, 3])", %{})
+      iex> Pythonx.to_binary(result)
+      <<1, 2, 3>>
+
+  """
+  @spec to_binary(Object.t(), keyword()) :: binary()
+  def to_binary(%Object{} = object, opts \\ []) do
+    opts = Keyword.validate!(opts, share_writable: false)
+    Pythonx.NIF.object_to_binary(object, opts[:share_writable])
+  end
+
+  @doc """
+  Converts a Python array into an `Nx.Tensor`.
+
+  Requires the `:nx` dependency and the `numpy` Python package.
+
+  This works with numpy arrays, as well as any object supporting
+  DLPack (such as PyTorch and JAX tensors on CPU), the numpy array
+  interface or the buffer protocol. The dtype and shape are carried
+  over and the tensor data is transferred as a single buffer (see
+  `to_binary/2`), without converting individual elements.
+
+  The opposite conversion happens when encoding an `Nx.Tensor` via
+  `encode!/2`, in which case the numpy array is created directly on
+  top of the tensor binary.
+
+  ## Options
+
+    * `:share_writable` - same as in `to_binary/2`. Note that numpy
+      arrays are usually writable, so they are copied by default
+
+  ## Examples
+
+      iex> {result, %{}} = Pythonx.eval("import numpy; numpy.eye(2, dtype='int32')", %{})
+      iex> tensor = Pythonx.to_tensor(result)
+      iex> {Nx.type(tensor), Nx.to_list(tensor)}
+      {{:s, 32}, [[1, 0], [0, 1]]}
+
+  """
+  @spec to_tensor(Object.t(), keyword()) :: Nx.Tensor.t()
+  def to_tensor(%Object{} = object, opts \\ []) do
+    if not Code.ensure_loaded?(Pythonx.Tensor) do
+      raise ArgumentError,
+            "Pythonx.to_tensor/2 requires the :nx dependency, make sure to add it to your deps"
+    end
+
+    Pythonx.Tensor.from_array(object, opts)
+  end
+
+  @doc """
+  Converts a Python dataframe into an `Explorer.DataFrame`.
+
+  Requires the `:explorer` dependency and the `pyarrow` Python package.
+
+  This works with any object implementing the Arrow PyCapsule stream
+  interface (`__arrow_c_stream__`), such as polars, pandas and pyarrow
+  dataframes. The data is transferred in the Arrow IPC stream format,
+  which stores the column buffers as is, without converting individual
+  values.
+
+  The opposite conversion happens when encoding an `Explorer.DataFrame`
+  via `encode!/2`, in which case a polars dataframe is created.
+
+  See `to_dataframe_stream/1` for converting the dataframe in batches.
+  """
+  @spec to_dataframe(Object.t()) :: Explorer.DataFrame.t()
+  def to_dataframe(%Object{} = object) do
+    ensure_data_frame_support!(:to_dataframe, 1)
+    Pythonx.DataFrame.from_python(object)
+  end
+
+  @doc """
+  Returns a stream of `Explorer.DataFrame`s, one per Arrow record batch.
+
+  This is similar to `to_dataframe/1`, except that the data is converted
+  lazily, one batch at a time, as the stream is consumed. The given
+  object may also be a `pyarrow.RecordBatchReader`, in which case
+  batches are only produced on the Python side as needed.
+
+  The stream can be traversed only once.
+  """
+  @spec to_dataframe_stream(Object.t()) :: Enumerable.t(Explorer.DataFrame.t())
+  def to_dataframe_stream(%Object{} = object) do
+    ensure_data_frame_support!(:to_dataframe_stream, 1)
+    Pythonx.DataFrame.stream_from_python(object)
+  end
+
+  defp ensure_data_frame_support!(name, arity) do
+    if not Code.ensure_loaded?(Pythonx.DataFrame) do
+      raise ArgumentError,
+            "Pythonx.#{name}/#{arity} requires the :explorer dependency, " <>
+              "make sure to add it to your deps"
+    end
+  end
+
+  @doc """
+  Releases the given Python object right away.
+
+  By default, Python objects are released only once the corresponding
+  `Pythonx.Object` structs are garbage collected, which may happen
+  much later. This function decrements the object refcount immediately,
+  so that memory held by large intermediate objects can be reclaimed
+  deterministically.
+
+  Any subsequent use of the object raises an error. Releasing an object
+  multiple times is a no-op.
+
+  Objects encoded from `nil`, booleans, small integers and atoms are
+  shared, so releasing those is a no-op as well.
+
+  ## Examples
+
+      iex> {result, %{}} = Pythonx.eval("[1, 2, 3]", %{})
+      iex> Pythonx.release(result)
+      :ok
+
+  """
+  @spec release(Object.t()) :: :ok
+  def release(%Object{} = object) when node(object.resource) == node() do
+    Pythonx.NIF.object_release(object)
+  end
+
+  def release(%Object{} = object) do
+    :erpc.call(node(object.resource), Pythonx.NIF, :object_release, [object])
+  end
+
+  @doc """
+  Runs the given function and releases all Python objects created
+  in the meantime, once it returns.
+
+  This applies to all objects created by the calling process, such
+  as evaluation results and globals, encoded terms and decoded items.
+  Objects created by other processes are not affected. Scopes can be
+  nested, in which case the objects are released when the innermost
+  scope ends.
+
+  Make sure to decode the relevant results within the function, since
+  any objects returned from the function are released as well. If you
+  want to keep a specific object around, create it outside of the
+  scope.
+
+  ## Examples
+
+      iex> Pythonx.with_scope(fn ->
+      ...>   {result, %{}} = Pythonx.eval("sum(range(10))", %{})
+      ...>   Pythonx.decode(result)
+      ...> end)
+      45
+
+  """
+  @spec with_scope((-> result)) :: result when result: term()
+  def with_scope(fun) when is_function(fun, 0) do
+    # If the process terminates abruptly, the Janitor releases the
+    # scope objects.
+    Pythonx.Janitor.monitor_scopes(self())
+
+    Pythonx.NIF.scope_begin()
+
+    try do
+      fun.()
+    after
+      Pythonx.NIF.scope_end()
+    end
+  end
+
+  @doc """
+  Ties the lifetime of the given Python object to `pid`.
+
+  The object is released once the given process terminates, regardless
+  of whether the `Pythonx.Object` struct is still referenced elsewhere.
+  Also see `release/1`.
+  """
+  @spec release_on_exit(Object.t(), pid()) :: :ok
+  def release_on_exit(object, pid \\ self())
+
+  def release_on_exit(%Object{} = object, pid) when node(object.resource) == node() do
+    Pythonx.Janitor.release_on_exit(pid, object)
+  end
+
+  def release_on_exit(%Object{} = object, pid) do
+    :erpc.call(node(object.resource), Pythonx.Janitor, :release_on_exit, [pid, object])
+  end
+
+  @doc """
+  Returns statistics about live Python objects referenced from Elixir.
+
+  This requires object tracking to be enabled, which is disabled by
+  default, since it adds overhead to every object that crosses the
+  boundary. To enable it, set the following configuration:
+
+  ```elixir
+  config :pythonx, :object_tracking, true
+  ```
+
+  Only objects created after tracking is enabled are taken into account.
+  Sizes are estimated the same way as for memory pressure, see the
+  "Memory management" section in the README.
+
+  Returns a map with the following keys:
+
+    * `:objects` - the number of live objects
+
+    * `:bytes` - the estimated memory size of the live objects
+
+    * `:by_type` - a map with `:objects` and `:bytes` per Python type
+
+    * `:by_tag` - a map with `:objects` and `:bytes` per tag given to
+      `eval/3`, objects without a tag are listed under `nil`
+
+    * `:long_lived` - a list of objects alive for longer than the
+      `:long_lived_after` threshold, oldest first. Each entry is a map
+      with `:type`, `:bytes`, `:tag` and `:age` (in milliseconds)
+
+  ## Options
+
+    * `:long_lived_after` - the age in milliseconds after which objects
+      are listed under `:long_lived`. Defaults to `300_000` (5 minutes)
+
+  """
+  @spec memory_stats(keyword()) :: %{
+          objects: non_neg_integer(),
+          bytes: non_neg_integer(),
+          by_type: %{String.t() => %{objects: non_neg_integer(), bytes: non_neg_integer()}},
+          by_tag: %{
+            (String.t() | nil) => %{objects: non_neg_integer(), bytes: non_neg_integer()}
+          },
+          long_lived: [
+            %{
+              type: String.t(),
+              bytes: non_neg_integer(),
+              tag: String.t() | nil,
+              age: non_neg_integer()
+            }
+          ]
+        }
+  def memory_stats(opts \\ []) do
+    opts = Keyword.validate!(opts, long_lived_after: 300_000)
+
+    case Pythonx.NIF.object_tracking_stats(opts[:long_lived_after]) do
+      nil ->
+        raise RuntimeError,
+              "object tracking is not enabled, set `config :pythonx, :object_tracking, true` " <>
+                "to use Pythonx.memory_stats/1"
+
+      {{objects, bytes}, by_type, by_tag, long_lived} ->
+        long_lived =
+          for {type, bytes, tag, age} <- long_lived do
+            %{type: type, bytes: bytes, tag: tag, age: age}
+          end
+
+        %{
+          objects: objects,
+          bytes: bytes,
+          by_type: stats_map(by_type),
+          by_tag: stats_map(by_tag),
+          long_lived: Enum.sort_by(long_lived, & &1.age, :desc)
+        }
+    end
+  end
+
+  defp stats_map(entries) do
+    Map.new(entries, fn {key, {objects, bytes}} -> {key, %{objects: objects, bytes: bytes}} end)
   end
 
   @doc """
@@ -683,16 +1577,11 @@ defmodule Pythonx do
   @spec remote_eval(node(), String.t(), %{optional(String.t()) => term()}, keyword()) ::
           {Object.t() | nil, %{optional(String.t()) => Object.t()}}
   def remote_eval(node, code, globals, opts \\ []) do
-    opts = Keyword.validate!(opts, [:stdout_device, :stderr_device])
+    opts = validate_eval_opts!(opts)
     validate_globals!(globals)
 
-    stdout_device = Keyword.get_lazy(opts, :stdout_device, fn -> Process.group_leader() end)
-
-    stderr_device =
-      Keyword.get_lazy(opts, :stderr_device, fn -> Process.whereis(:standard_error) end)
-
     message_ref = :erlang.make_ref()
-    remote_args = [self(), message_ref, code, globals, stdout_device, stderr_device]
+    remote_args = [self(), message_ref, code, globals, opts]
     child = Node.spawn(node, __MODULE__, :__remote_eval__, remote_args)
     monitor_ref = Process.monitor(child)
 
@@ -722,7 +1611,14 @@ defmodule Pythonx do
   end
 
   @doc false
+  # Called by nodes running an older version of Pythonx
   def __remote_eval__(parent, message_ref, code, globals, stdout_device, stderr_device) do
+    opts = validate_eval_opts!(stdout_device: stdout_device, stderr_device: stderr_device)
+    __remote_eval__(parent, message_ref, code, globals, opts)
+  end
+
+  @doc false
+  def __remote_eval__(parent, message_ref, code, globals, opts) do
     monitor_ref = Process.monitor(parent)
 
     result =
@@ -732,7 +1628,7 @@ defmodule Pythonx do
             {key, encode!(value, &encode_with_copy_remote/2)}
           end
 
-        result = do_eval(code, globals, stdout_device, stderr_device)
+        result = do_eval(code, globals, opts)
 
         {:ok, result}
       rescue
@@ -769,11 +1665,12 @@ defmodule Pythonx do
     end
   end
 
-  defp track_object(%Pythonx.Error{type: type, value: value, traceback: traceback}) do
-    %Pythonx.Error{
-      type: track_object(type),
-      value: track_object(value),
-      traceback: track_object(traceback)
+  defp track_object(%Pythonx.Error{type: type, value: value, traceback: traceback} = error) do
+    %{
+      error
+      | type: track_object(type),
+        value: track_object(value),
+        traceback: track_object(traceback)
     }
   end
 end
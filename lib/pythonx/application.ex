@@ -7,6 +7,10 @@ defmodule Pythonx.Application do
   def start(_type, _args) do
     enable_sigchld()
 
+    if Application.get_env(:pythonx, :object_tracking, false) do
+      Pythonx.NIF.object_tracking_set(true)
+    end
+
     children = [
       Pythonx.Janitor,
       Pythonx.ObjectTracker
@@ -0,0 +1,177 @@
+if Code.ensure_loaded?(Explorer.DataFrame) do
+  defmodule Pythonx.DataFrame do
+    @moduledoc false
+
+    # Conversion between Explorer dataframes and Python dataframes.
+    #
+    # Explorer exposes Arrow data only in the IPC stream format, so
+    # that is what we exchange. The IPC stream is a plain concatenation
+    # of Arrow buffers, which pyarrow maps without copying, so on either
+    # side the only copy is done by Explorer when dumping or loading.
+    #
+    # On the Python side, we accept any object implementing the Arrow
+    # PyCapsule interface (__arrow_c_stream__), which includes pyarrow,
+    # polars and pandas (2.2+) dataframes.
+
+    @doc """
+    Encodes the given dataframe as a polars dataframe.
+    """
+    @spec to_python(Explorer.DataFrame.t()) :: Pythonx.Object.t()
+    def to_python(%Explorer.DataFrame{} = df) do
+      ipc = Explorer.DataFrame.dump_ipc_stream!(df)
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          try:
+            import polars
+          except ModuleNotFoundError:
+            polars = None
+
+          try:
+            import pyarrow
+          except ModuleNotFoundError:
+            pyarrow = None
+
+          if polars is None:
+            result = None
+          elif pyarrow is None:
+            import io
+            result = polars.read_ipc_stream(io.BytesIO(ipc))
+          else:
+            # Record batches reference the memoryview buffer directly
+            reader = pyarrow.ipc.open_stream(pyarrow.py_buffer(ipc))
+            result = polars.from_arrow(reader.read_all(), rechunk=False)
+
+          result
+          """,
+          %{"ipc" => Pythonx.memoryview(ipc)}
+        )
+
+      case Pythonx.decode(result) do
+        %Pythonx.Object{} ->
+          result
+
+        nil ->
+          raise Protocol.UndefinedError,
+            protocol: Pythonx.Encoder,
+            value: df,
+            description:
+              "cannot encode Explorer.DataFrame, because the polars Python package is not installed"
+      end
+    end
+
+    @doc """
+    Converts a Python dataframe into an Explorer dataframe.
+    """
+    @spec from_python(Pythonx.Object.t()) :: Explorer.DataFrame.t()
+    def from_python(%Pythonx.Object{} = object) do
+      reader = open_reader(object)
+      ipc = read_ipc_stream(reader, false)
+      Explorer.DataFrame.load_ipc_stream!(ipc)
+    end
+
+    @doc """
+    Returns a stream of Explorer dataframes, one per record batch.
+    """
+    @spec stream_from_python(Pythonx.Object.t()) :: Enumerable.t(Explorer.DataFrame.t())
+    def stream_from_python(%Pythonx.Object{} = object) do
+      Stream.resource(
+        fn -> open_reader(object) end,
+        fn reader ->
+          case read_ipc_stream(reader, true) do
+            nil -> {:halt, reader}
+            ipc -> {[Explorer.DataFrame.load_ipc_stream!(ipc)], reader}
+          end
+        end,
+        fn reader -> Pythonx.release(reader) end
+      )
+    end
+
+    defp open_reader(object) do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          try:
+            import pyarrow
+          except ModuleNotFoundError:
+            pyarrow = None
+
+          if pyarrow is None:
+            result = None
+          elif isinstance(object, pyarrow.RecordBatchReader):
+            result = object
+          elif isinstance(object, pyarrow.Table):
+            result = object.to_reader()
+          elif hasattr(object, "__arrow_c_stream__"):
+            result = pyarrow.RecordBatchReader.from_stream(object)
+          elif hasattr(object, "to_arrow"):
+            result = object.to_arrow().to_reader()
+          else:
+            result = pyarrow.Table.from_pandas(object).to_reader()
+
+          result
+          """,
+          %{"object" => object}
+        )
+
+      if Pythonx.decode(result) == nil do
+        raise ArgumentError,
+              "cannot convert the object to Explorer.DataFrame, because the pyarrow " <>
+                "Python package is not installed"
+      end
+
+      result
+    end
+
+    # Writes batches from the reader into an IPC stream and returns it
+    # as a binary. When next_batch is true, only a single batch is read
+    # and nil is returned once the reader is exhausted.
+    defp read_ipc_stream(reader, next_batch) do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import pyarrow
+
+          if next_batch:
+            try:
+              batches = [reader.read_next_batch()]
+            except StopIteration:
+              batches = None
+          else:
+            batches = reader
+
+          if batches is None:
+            result = None
+          else:
+            sink = pyarrow.BufferOutputStream()
+
+            with pyarrow.ipc.new_stream(sink, reader.schema) as writer:
+              for batch in batches:
+                writer.write_batch(batch)
+
+            result = sink.getvalue()
+
+          result
+          """,
+          %{"reader" => reader, "next_batch" => next_batch}
+        )
+
+      case Pythonx.decode(result) do
+        nil ->
+          nil
+
+        # The buffer is owned exclusively by us and never modified, so
+        # the binary can share its memory
+        %Pythonx.Object{} = buffer ->
+          Pythonx.to_binary(buffer, share_writable: true)
+      end
+    end
+  end
+
+  defimpl Pythonx.Encoder, for: Explorer.DataFrame do
+    def encode(df, _encoder) do
+      Pythonx.DataFrame.to_python(df)
+    end
+  end
+end
@@ -36,22 +36,22 @@ defprotocol Pythonx.Encoder do
   When dealing with more complex data structures, you will want to
   return an object from a Python package. In that case, it is a good
   idea to raise a clear error if the package is not installed. For
-  example, here is one possible implementation for `Explorer.DataFrame`:
+  example, here is one possible implementation for `Geo.Point`:
 
-      defimpl Pythonx.Encoder, for: Explorer.DataFrame do
-        def encode(df, _encoder) do
+      defimpl Pythonx.Encoder, for: Geo.Point do
+        def encode(%Geo.Point{coordinates: {x, y}} = point, _encoder) do
           {result, %{}} =
             Pythonx.eval(
               """
               try:
-                import polars
-                result = polars.read_ipc(ipc)
+                import shapely
+                result = shapely.Point(x, y)
               except ModuleNotFoundError:
                 result = None
 
               result
               """,
-              %{"ipc" => Explorer.DataFrame.dump_ipc!(df)}
+              %{"x" => x, "y" => y}
             )
 
           case Pythonx.decode(result) do
@@ -61,13 +61,69 @@ defprotocol Pythonx.Encoder do
             nil ->
               raise Protocol.UndefinedError,
                 protocol: @protocol,
-                value: df,
+                value: point,
                 description:
-                  "cannot encode Explorer.DataFrame, because the polars Python package is not installed"
+                  "cannot encode Geo.Point, because the shapely Python package is not installed"
           end
         end
       end
 
+  ## Encoding many structs at once
+
+  Encoding every struct with a separate `Pythonx.eval/2` call is
+  expensive when there are many of them. To address this, the
+  implementation may additionally define `encode_many/2`, which gets
+  a list of structs and must return a Python list with the encoded
+  items, in the same order. Whenever a list is encoded, all of its
+  items of that struct type are encoded with a single call:
+
+      defimpl Pythonx.Encoder, for: Complex do
+        def encode(complex, encoder) do
+          # ...
+        end
+
+        def encode_many(complexes, _encoder) do
+          {result, %{}} =
+            Pythonx.eval(
+              """
+              [complex(re, im) for re, im in zip(res, ims)]
+              """,
+              %{"res" => Enum.map(complexes, & &1.re), "ims" => Enum.map(complexes, & &1.im)}
+            )
+
+          result
+        end
+      end
+
+  Note that `encode_many/2` is only used by the default encoder.
+
+  ## Python classes for structs
+
+  Alternatively, a struct can be encoded as an instance of a Python
+  dataclass, namedtuple or a class with `__slots__`, without a custom
+  implementation. To do that, derive the protocol:
+
+      defmodule Person do
+        @derive Pythonx.Encoder
+        defstruct [:name, :age]
+      end
+
+  and register the class with `Pythonx.register_struct/2`. Instances
+  are constructed natively, in batches, and are decoded back to the
+  struct.
+
+  Pythonx already implements the protocol for `Nx.Tensor` and
+  `Explorer.DataFrame`, when the corresponding packages are available.
+  Those are encoded as numpy arrays and polars dataframes respectively.
+
+  `Date`, `Time`, `NaiveDateTime` and `DateTime` are encoded as the
+  corresponding `datetime` module objects. `DateTime` gets the
+  `zoneinfo.ZoneInfo` time zone of the same name, or a fixed UTC offset
+  when the zone is not available in Python, for example when there is
+  no system time zone database and `tzdata` is not installed. Python
+  does not track microsecond precision, so it is lost. `Decimal` is
+  encoded as `decimal.Decimal`.
+
   '''
 
   @doc """
@@ -77,6 +133,26 @@ defprotocol Pythonx.Encoder do
   def encode(term, encoder)
 end
 
+defimpl Pythonx.Encoder, for: Any do
+  defmacro __deriving__(module, _struct, _opts) do
+    quote do
+      defimpl Pythonx.Encoder, for: unquote(module) do
+        def encode(struct, encoder) do
+          Pythonx.StructClass.encode(struct, encoder)
+        end
+
+        def encode_many(structs, encoder) do
+          Pythonx.StructClass.encode_many(structs, encoder)
+        end
+      end
+    end
+  end
+
+  def encode(term, _encoder) do
+    raise Protocol.UndefinedError, protocol: @protocol, value: term
+  end
+end
+
 defimpl Pythonx.Encoder, for: Pythonx.Object do
   def encode(object, _encoder) when node(object.resource) != node() do
     raise Protocol.UndefinedError,
@@ -105,9 +181,9 @@ defimpl Pythonx.Encoder, for: Atom do
   end
 
   def encode(term, _encoder) do
-    term
-    |> Atom.to_string()
-    |> Pythonx.NIF.unicode_from_string()
+    # Atom strings are interned and cached natively, so encoding the
+    # same atom repeatedly does not allocate
+    Pythonx.NIF.unicode_from_atom(term)
   end
 end
 
@@ -126,11 +202,11 @@ defimpl Pythonx.Encoder, for: Integer do
   end
 
   def encode(term, _encoder) do
-    # Technically we could do an object call on Python int.from_bytes,
-    # however given that this is a rare path (integers over 64 bits)
-    # and that Python C API has a specific function to create integer
-    # from string, we pick this most straightforward option.
-    Pythonx.NIF.long_from_string(Integer.to_string(term, 36), 36)
+    # Integers over 64 bits are converted natively via their binary
+    # magnitude, which takes linear time, as opposed to going through
+    # a string representation
+    {:ok, object} = Pythonx.NIF.object_from_term(term)
+    object
   end
 end
 
@@ -176,19 +252,107 @@ end
 
 defimpl Pythonx.Encoder, for: List do
   def encode(term, encoder) do
-    # Note that to compute length we need to traverse the list, but
-    # otherwise we cannot preallocate the Python list and we would
-    # need to use append (which could result in many reallocations).
-    size = length(term)
+    # Structs implementing encode_many/2 are encoded in batches. We do
+    # this only for the default encoder, since a custom encoder may
+    # handle those structs differently.
+    {size, batches} =
+      if encoder == (&Pythonx.Encoder.encode/2) do
+        group_batches(term)
+      else
+        {length(term), %{}}
+      end
+
+    case Map.to_list(batches) do
+      [{impl, {^size, _items}}] when size > 0 ->
+        # All items are of the same type, so we return the list as is,
+        # as long as it has the expected shape
+        object = impl.encode_many(term, encoder)
+        unpack_many(object, impl, size)
+        object
+
+      batches ->
+        values = encode_batches(batches, encoder)
+
+        # Note that to compute length we need to traverse the list, but
+        # otherwise we cannot preallocate the Python list and we would
+        # need to use append (which could result in many reallocations).
+        list = Pythonx.NIF.list_new(size)
+
+        Enum.with_index(term, fn item, index ->
+          value = Map.get_lazy(values, index, fn -> encoder.(item, encoder) end)
+          Pythonx.NIF.list_set_item(list, index, value)
+        end)
+
+        list
+    end
+  end
 
-    list = Pythonx.NIF.list_new(size)
+  # Returns the list length and a map with indexed items for every
+  # encode_many/2 implementation.
+  defp group_batches(term) do
+    {size, batches, _impls} =
+      Enum.reduce(term, {0, %{}, %{}}, fn item, {index, batches, impls} ->
+        {impl, impls} = batch_impl(item, impls)
+
+        batches =
+          if impl do
+            Map.update(batches, impl, {1, [{index, item}]}, fn {count, items} ->
+              {count + 1, [{index, item} | items]}
+            end)
+          else
+            batches
+          end
 
-    Enum.with_index(term, fn item, index ->
-      value = encoder.(item, encoder)
-      Pythonx.NIF.list_set_item(list, index, value)
-    end)
+        {index + 1, batches, impls}
+      end)
 
-    list
+    {size, batches}
+  end
+
+  defp batch_impl(%module{} = struct, impls) do
+    case impls do
+      %{^module => impl} ->
+        {impl, impls}
+
+      %{} ->
+        impl = Pythonx.Encoder.impl_for(struct)
+
+        impl =
+          if impl != nil and Code.ensure_loaded?(impl) and
+               function_exported?(impl, :encode_many, 2) do
+            impl
+          end
+
+        {impl, Map.put(impls, module, impl)}
+    end
+  end
+
+  defp batch_impl(_item, impls), do: {nil, impls}
+
+  defp encode_batches(batches, encoder) do
+    for {impl, {count, indexed_items}} <- batches,
+        {{index, _item}, value} <- encode_batch(impl, count, indexed_items, encoder),
+        into: %{},
+        do: {index, value}
+  end
+
+  defp encode_batch(impl, count, indexed_items, encoder) do
+    indexed_items = Enum.reverse(indexed_items)
+    items = Enum.map(indexed_items, &elem(&1, 1))
+    object = impl.encode_many(items, encoder)
+    Enum.zip(indexed_items, unpack_many(object, impl, count))
+  end
+
+  defp unpack_many(object, impl, count) do
+    case Pythonx.NIF.decode_once(object, false, false) do
+      {:list, values} when length(values) == count ->
+        values
+
+      _other ->
+        raise ArgumentError,
+              "expected #{inspect(impl)}.encode_many/2 to return a Python list " <>
+                "with #{count} items, got: #{inspect(object)}"
+    end
   end
 end
 
@@ -210,3 +374,90 @@ defimpl Pythonx.Encoder, for: PID do
     Pythonx.NIF.pid_new(term)
   end
 end
+
+defimpl Pythonx.Encoder, for: Range do
+  @max_int64 2 ** 63 - 1
+  @min_int64 Kernel.-(2 ** 63)
+
+  def encode(first..last//step, _encoder) do
+    # Python ranges exclude the stop value
+    stop = if step > 0, do: last + 1, else: last - 1
+
+    if Enum.all?([first, stop, step], &(@min_int64 <= &1 and &1 <= @max_int64)) do
+      Pythonx.NIF.range_new(first, stop, step)
+    else
+      {result, %{}} =
+        Pythonx.eval("range(start, stop, step)", %{
+          "start" => first,
+          "stop" => stop,
+          "step" => step
+        })
+
+      result
+    end
+  end
+end
+
+defimpl Pythonx.Encoder, for: Date do
+  def encode(date, _encoder) do
+    %{year: year, month: month, day: day} = Date.convert!(date, Calendar.ISO)
+    Pythonx.NIF.date_new(year, month, day)
+  end
+end
+
+defimpl Pythonx.Encoder, for: Time do
+  def encode(time, _encoder) do
+    %{hour: hour, minute: minute, second: second, microsecond: {microsecond, _}} =
+      Time.convert!(time, Calendar.ISO)
+
+    Pythonx.NIF.time_new(hour, minute, second, microsecond)
+  end
+end
+
+defimpl Pythonx.Encoder, for: NaiveDateTime do
+  def encode(datetime, _encoder) do
+    datetime = NaiveDateTime.convert!(datetime, Calendar.ISO)
+    {microsecond, _} = datetime.microsecond
+
+    Pythonx.NIF.datetime_new(
+      datetime.year,
+      datetime.month,
+      datetime.day,
+      datetime.hour,
+      datetime.minute,
+      datetime.second,
+      microsecond,
+      nil,
+      nil
+    )
+  end
+end
+
+defimpl Pythonx.Encoder, for: DateTime do
+  def encode(datetime, _encoder) do
+    datetime = DateTime.convert!(datetime, Calendar.ISO)
+    {microsecond, _} = datetime.microsecond
+
+    Pythonx.NIF.datetime_new(
+      datetime.year,
+      datetime.month,
+      datetime.day,
+      datetime.hour,
+      datetime.minute,
+      datetime.second,
+      microsecond,
+      datetime.utc_offset + datetime.std_offset,
+      datetime.time_zone
+    )
+  end
+end
+
+if Code.ensure_loaded?(Decimal) do
+  defimpl Pythonx.Encoder, for: Decimal do
+    def encode(decimal, _encoder) do
+      decimal
+      |> Decimal.to_string(:scientific)
+      |> Pythonx.NIF.decimal_new()
+    end
+  end
+end
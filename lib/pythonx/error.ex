@@ -1,12 +1,16 @@
 defmodule Pythonx.Error do
   @moduledoc """
   An exception raised when Python raises an exception.
+
+  Formatting the Python traceback has a cost, so by default `:lines`
+  is `nil` and the traceback is formatted only when the message is
+  requested. See the `:error_message` option in `Pythonx.eval/3`.
   """
 
   defexception [:lines, :type, :value, :traceback]
 
   @type t :: %__MODULE__{
-          lines: [String.t()],
+          lines: [String.t()] | nil,
           type: Pythonx.Object.t(),
           value: Pythonx.Object.t(),
           traceback: Pythonx.Object.t()
@@ -15,10 +19,31 @@ defmodule Pythonx.Error do
   @impl true
   def message(error) do
     lines =
-      Enum.map(error.lines, fn line ->
+      Enum.map(error.lines || format_lines(error), fn line ->
         ["        ", line]
       end)
 
     IO.iodata_to_binary(["Python exception raised\n\n", lines])
   end
+
+  defp format_lines(error) do
+    py_format_lines(error)
+  rescue
+    exception ->
+      # Formatting fails if the exception objects have already been
+      # released, in which case we give the reason instead
+      ["(the Python traceback could not be formatted: #{Exception.message(exception)})\n"]
+  end
+
+  defp py_format_lines(error) when node(error.type.resource) == node() do
+    Pythonx.NIF.error_format_lines(error.type, error.value, error.traceback)
+  end
+
+  defp py_format_lines(error) do
+    :erpc.call(node(error.type.resource), Pythonx.NIF, :error_format_lines, [
+      error.type,
+      error.value,
+      error.traceback
+    ])
+  end
 end
@@ -20,9 +20,33 @@ defmodule Pythonx.Janitor do
     GenServer.call(@name, :ping)
   end
 
+  @doc """
+  Releases the given object once `pid` terminates.
+  """
+  @spec release_on_exit(pid(), Pythonx.Object.t()) :: :ok
+  def release_on_exit(pid, object) do
+    GenServer.cast(@name, {:release_on_exit, pid, object})
+  end
+
+  @doc """
+  Ensures scopes opened by `pid` are released once it terminates.
+  """
+  @spec monitor_scopes(pid()) :: :ok
+  def monitor_scopes(pid) do
+    GenServer.cast(@name, {:monitor, pid})
+  end
+
   @impl true
   def init({}) do
-    {:ok, {}}
+    threshold = Application.get_env(:pythonx, :memory_pressure_threshold, 64 * 1024 * 1024)
+
+    {:ok,
+     %{
+       memory_pressure_threshold: threshold,
+       memory_pressure: %{},
+       owned_objects: %{},
+       monitors: %{}
+     }}
   end
 
   @impl true
@@ -30,6 +54,17 @@ defmodule Pythonx.Janitor do
     {:reply, :pong, state}
   end
 
+  @impl true
+  def handle_cast({:release_on_exit, pid, object}, state) do
+    state = ensure_monitor(state, pid)
+    owned_objects = Map.update(state.owned_objects, pid, [object], &[object | &1])
+    {:noreply, %{state | owned_objects: owned_objects}}
+  end
+
+  def handle_cast({:monitor, pid}, state) do
+    {:noreply, ensure_monitor(state, pid)}
+  end
+
   @impl true
   def handle_info({:decref, ptr}, state) do
     # After %Pythonx.Object{} is garbage collected, the C++ code
@@ -41,6 +76,15 @@ defmodule Pythonx.Janitor do
     {:noreply, state}
   end
 
+  def handle_info({:decref_many, ptrs}, state) do
+    # Same as above, but for a group of objects, such as container
+    # items returned by decode_once. For more details see HandleTable
+    # in the C++ code.
+    Pythonx.NIF.janitor_decref_many(ptrs)
+
+    {:noreply, state}
+  end
+
   def handle_info({:output, output, device}, state) do
     # We send the IO request and continue without waiting for the IO
     # reply.
@@ -51,4 +95,60 @@ defmodule Pythonx.Janitor do
   def handle_info({:io_reply, _reply_as, _reply}, state) do
     {:noreply, state}
   end
+
+  def handle_info({:memory_pressure, _pid, _size}, state)
+      when state.memory_pressure_threshold == :infinity do
+    {:noreply, state}
+  end
+
+  def handle_info({:memory_pressure, pid, size}, state) do
+    # Python objects are allocated outside of the BEAM memory, so a
+    # process may hold onto many of them without its heap growing
+    # enough to trigger garbage collection. The C++ code reports the
+    # estimated size of Python objects created by each process and
+    # once it goes past the threshold, we force garbage collection,
+    # so that the objects that are no longer referenced get released.
+    # For more details see report_memory_pressure in the C++ code.
+
+    state = ensure_monitor(state, pid)
+    total = Map.get(state.memory_pressure, pid, 0) + size
+
+    total =
+      if total >= state.memory_pressure_threshold do
+        :erlang.garbage_collect(pid, async: :memory_pressure)
+        0
+      else
+        total
+      end
+
+    {:noreply, %{state | memory_pressure: Map.put(state.memory_pressure, pid, total)}}
+  end
+
+  def handle_info({:garbage_collect, :memory_pressure, _result}, state) do
+    {:noreply, state}
+  end
+
+  def handle_info({:DOWN, _ref, :process, pid, _reason}, state) do
+    {objects, owned_objects} = Map.pop(state.owned_objects, pid, [])
+
+    for object <- objects do
+      Pythonx.NIF.object_release(object)
+    end
+
+    Pythonx.NIF.janitor_release_scopes(pid)
+
+    state = %{
+      state
+      | memory_pressure: Map.delete(state.memory_pressure, pid),
+        owned_objects: owned_objects,
+        monitors: Map.delete(state.monitors, pid)
+    }
+
+    {:noreply, state}
+  end
+
+  defp ensure_monitor(state, pid) do
+    monitors = Map.put_new_lazy(state.monitors, pid, fn -> Process.monitor(pid) end)
+    %{state | monitors: monitors}
+  end
 end
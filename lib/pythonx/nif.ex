@@ -14,15 +14,34 @@ defmodule Pythonx.NIF do
 
   def init(_python_dl_path, _python_home_path, _python_executable_path, _sys_paths), do: err!()
   def janitor_decref(_ptr), do: err!()
+  def janitor_decref_many(_ptrs), do: err!()
+  def janitor_release_scopes(_pid), do: err!()
+  def object_release(_object), do: err!()
+  def scope_begin(), do: err!()
+  def scope_end(), do: err!()
+  def object_tracking_set(_enabled), do: err!()
+  def object_tracking_stats(_long_lived_after), do: err!()
   def none_new(), do: err!()
   def false_new(), do: err!()
   def true_new(), do: err!()
   def long_from_int64(_integer), do: err!()
-  def long_from_string(_string, _base), do: err!()
   def float_new(_float), do: err!()
   def bytes_from_binary(_binary), do: err!()
+  def bytes_from_iodata(_iodata), do: err!()
+  def memoryview_from_binary(_binary), do: err!()
   def unicode_from_string(_string), do: err!()
+  def unicode_from_atom(_atom), do: err!()
   def unicode_to_string(_object), do: err!()
+  def object_to_binary(_object, _share_writable), do: err!()
+  def array_from_numbers(_term, _type), do: err!()
+  def array_to_binary(_object, _type), do: err!()
+  def records_to_columns(_object), do: err!()
+  def object_get_iter(_object), do: err!()
+  def iter_next_chunk(_iter, _chunk_size), do: err!()
+  def source_new(_pid, _kind, _release_notifier), do: err!()
+  def source_reply(_channel, _reply, _payload), do: err!()
+  def source_close(_channel), do: err!()
+  def range_new(_start, _stop, _step), do: err!()
   def dict_new(), do: err!()
   def dict_set_item(_object, _key, _value), do: err!()
   def tuple_new(_size), do: err!()
@@ -33,8 +52,42 @@ defmodule Pythonx.NIF do
   def set_add(_object, _key), do: err!()
   def pid_new(_pid), do: err!()
   def object_repr(_object), do: err!()
-  def decode_once(_object), do: err!()
-  def eval(_code, _code_md5, _globals, _stdout_device, _stderr_device), do: err!()
+  def decode_once(_object, _atom_keys, _decimal), do: err!()
+  def date_new(_year, _month, _day), do: err!()
+  def time_new(_hour, _minute, _second, _microsecond), do: err!()
+
+  def datetime_new(
+        _year,
+        _month,
+        _day,
+        _hour,
+        _minute,
+        _second,
+        _microsecond,
+        _utc_offset,
+        _time_zone
+      ),
+      do: err!()
+
+  def decimal_new(_string), do: err!()
+  def struct_class_register(_module, _class, _defaults), do: err!()
+  def struct_new(_module, _args), do: err!()
+  def struct_new_many(_module, _rows), do: err!()
+  def decode_all(_object, _map_set, _decimal, _atom_keys, _arena, _objects), do: err!()
+  def object_from_term(_term), do: err!()
+  def eval(
+        _code,
+        _code_md5,
+        _globals,
+        _stdout_device,
+        _stderr_device,
+        _tag,
+        _eager_error_lines,
+        _traceback
+      ),
+      do: err!()
+
+  def error_format_lines(_type, _value, _traceback), do: err!()
 
   def dump_object(_object), do: err!()
   def load_object(_object), do: err!()
@@ -6,7 +6,7 @@ defmodule Pythonx.Object do
   Elixir code.
   """
 
-  defstruct [:resource, :remote_info]
+  defstruct [:resource, :handle, :remote_info]
 
   @type t :: %__MODULE__{}
 end
@@ -0,0 +1,182 @@
+defmodule Pythonx.Source do
+  @moduledoc false
+
+  # Elixir data exposed to Python as lazy readers and iterators.
+  #
+  # Each source is backed by a process, which produces data on demand.
+  # Whenever the Python object needs more data, it sends a pull request
+  # to the process and blocks (with the GIL released) until the process
+  # replies via Pythonx.NIF.source_reply/3. This way only a single chunk
+  # is kept in memory at a time.
+  #
+  # Items are sent as plain terms and converted to Python objects by
+  # the consuming thread. The process never encodes anything itself,
+  # since that requires a dirty scheduler, while all of them may be
+  # taken by evaluations waiting for sources, which would deadlock.
+  # Consequently, items without built-in conversion are not supported.
+  #
+  # The process terminates once the data is exhausted, the owner process
+  # terminates, or the Python object is garbage collected. In all cases
+  # the channel is closed, so that Python never blocks indefinitely.
+
+  @doc """
+  Returns a Python reader over the given iodata or enumerable of iodata.
+  """
+  @spec reader(iodata() | Enumerable.t()) :: Pythonx.Object.t()
+  def reader(data) when is_binary(data) or is_list(data) do
+    start(:reader, {:iodata, data})
+  end
+
+  def reader(enumerable) do
+    start(:reader, {:binaries, start_reduce(enumerable)})
+  end
+
+  @doc """
+  Returns a Python iterator over items of the given enumerable.
+  """
+  @spec iterator(Enumerable.t(), pos_integer()) :: Pythonx.Object.t()
+  def iterator(enumerable, chunk_size) do
+    start(:iterator, {:items, start_reduce(enumerable), chunk_size})
+  end
+
+  defp start(kind, producer) do
+    owner = self()
+    pid = spawn(fn -> init(owner, producer) end)
+
+    try do
+      notifier = Pythonx.NIF.create_gc_notifier(pid, :pythonx_source_released)
+      {channel, object} = Pythonx.NIF.source_new(pid, kind, notifier)
+      send(pid, {:channel, channel})
+      object
+    catch
+      kind, reason ->
+        Process.exit(pid, :kill)
+        :erlang.raise(kind, reason, __STACKTRACE__)
+    end
+  end
+
+  defp init(owner, producer) do
+    ref = Process.monitor(owner)
+
+    receive do
+      {:channel, channel} ->
+        loop(channel, ref, producer)
+
+      {:DOWN, ^ref, :process, _pid, _reason} ->
+        halt(producer)
+    end
+  end
+
+  defp loop(channel, ref, producer) do
+    receive do
+      # The requested size is only a hint, binaries are passed as a
+      # whole, since that does not involve copying
+      {:pythonx_source_pull, _size} ->
+        case produce(producer) do
+          {:data, payload, producer} ->
+            Pythonx.NIF.source_reply(channel, :data, payload)
+            loop(channel, ref, producer)
+
+          :done ->
+            Pythonx.NIF.source_reply(channel, :done, nil)
+            Pythonx.NIF.source_close(channel)
+
+          {:error, message} ->
+            Pythonx.NIF.source_reply(channel, :error, message)
+            Pythonx.NIF.source_close(channel)
+        end
+
+      :pythonx_source_released ->
+        halt(producer)
+        Pythonx.NIF.source_close(channel)
+
+      {:DOWN, ^ref, :process, _pid, _reason} ->
+        halt(producer)
+        Pythonx.NIF.source_close(channel)
+    end
+  end
+
+  defp produce(producer) do
+    try do
+      do_produce(producer)
+    catch
+      kind, reason ->
+        {:error, Exception.format_banner(kind, reason, __STACKTRACE__)}
+    end
+  end
+
+  defp do_produce({:iodata, iodata}) do
+    case next_iodata(iodata) do
+      {binary, rest} -> {:data, binary, {:iodata, rest}}
+      :done -> :done
+    end
+  end
+
+  defp do_produce({:binaries, cont}) do
+    case take_items(cont, 1, []) do
+      {[], _cont} -> :done
+      {[item], cont} -> {:data, IO.iodata_to_binary(item), {:binaries, cont}}
+    end
+  end
+
+  defp do_produce({:items, cont, chunk_size}) do
+    case take_items(cont, chunk_size, []) do
+      {[], _cont} -> :done
+      {items, cont} -> {:data, items, {:items, cont, chunk_size}}
+    end
+  end
+
+  defp halt({:iodata, _iodata}), do: :ok
+  defp halt({:binaries, cont}), do: halt_reduce(cont)
+  defp halt({:items, cont, _chunk_size}), do: halt_reduce(cont)
+
+  # Returns the next binary from the given iodata together with the
+  # remaining iodata. We never flatten the whole iodata, only adjacent
+  # bytes are gathered into a binary.
+  defp next_iodata(""), do: :done
+  defp next_iodata(binary) when is_binary(binary), do: {binary, []}
+  defp next_iodata([]), do: :done
+
+  defp next_iodata([byte | _] = iodata) when is_integer(byte) do
+    {bytes, rest} = take_bytes(iodata, [])
+    {:erlang.list_to_binary(bytes), rest}
+  end
+
+  defp next_iodata([head | tail]) do
+    case next_iodata(head) do
+      {binary, rest} -> {binary, [rest | tail]}
+      :done -> next_iodata(tail)
+    end
+  end
+
+  defp next_iodata(other) do
+    raise ArgumentError, "expected iodata, got: #{inspect(other)}"
+  end
+
+  defp take_bytes([byte | tail], acc) when is_integer(byte), do: take_bytes(tail, [byte | acc])
+  defp take_bytes(rest, acc), do: {Enum.reverse(acc), rest}
+
+  # Enumerables are consumed via a suspended reduction, so we can take
+  # a chunk of items at a time.
+
+  defp start_reduce(enumerable) do
+    &Enumerable.reduce(enumerable, &1, fn item, acc -> {:suspend, [item | acc]} end)
+  end
+
+  defp take_items(:done, _count, acc), do: {Enum.reverse(acc), :done}
+  defp take_items(cont, 0, acc), do: {Enum.reverse(acc), cont}
+
+  defp take_items(cont, count, acc) do
+    case cont.({:cont, acc}) do
+      {:suspended, acc, cont} -> take_items(cont, count - 1, acc)
+      {_done_or_halted, acc} -> {Enum.reverse(acc), :done}
+    end
+  end
+
+  defp halt_reduce(:done), do: :ok
+
+  defp halt_reduce(cont) do
+    cont.({:halt, []})
+    :ok
+  end
+end
@@ -0,0 +1,65 @@
+defmodule Pythonx.StructClass do
+  @moduledoc false
+
+  # Structs encoded as instances of registered Python classes.
+  #
+  # The class, together with interned field names, is kept in a NIF
+  # registry, which is also used when decoding instances back to the
+  # struct. On the Elixir side we only need the order of constructor
+  # arguments, which we keep in :persistent_term, since it is written
+  # once and read on every encoding.
+
+  @doc """
+  Registers the given Python class for the struct.
+  """
+  @spec register(module(), Pythonx.Object.t()) :: :ok
+  def register(module, %Pythonx.Object{} = class) when is_atom(module) do
+    if not function_exported?(module, :__struct__, 0) do
+      raise ArgumentError, "expected a struct module, got: #{inspect(module)}"
+    end
+
+    defaults = module.__struct__() |> Map.from_struct() |> Map.to_list()
+    fields = Pythonx.NIF.struct_class_register(module, class, defaults)
+    :persistent_term.put({__MODULE__, module}, fields)
+    :ok
+  end
+
+  @doc """
+  Encodes the struct as an instance of the registered class.
+  """
+  @spec encode(struct(), Pythonx.encoder()) :: Pythonx.Object.t()
+  def encode(%module{} = struct, encoder) do
+    fields = fields!(module)
+    args = Pythonx.encode!(args(struct, fields), encoder)
+    Pythonx.NIF.struct_new(module, args)
+  end
+
+  @doc """
+  Encodes a list of structs of the same type, with a single call
+  constructing all the instances.
+  """
+  @spec encode_many([struct()], Pythonx.encoder()) :: Pythonx.Object.t()
+  def encode_many([%module{} | _] = structs, encoder) do
+    fields = fields!(module)
+    rows = Pythonx.encode!(Enum.map(structs, &args(&1, fields)), encoder)
+    Pythonx.NIF.struct_new_many(module, rows)
+  end
+
+  defp args(struct, fields) do
+    fields
+    |> Enum.map(&Map.fetch!(struct, &1))
+    |> List.to_tuple()
+  end
+
+  defp fields!(module) do
+    case :persistent_term.get({__MODULE__, module}, nil) do
+      nil ->
+        raise ArgumentError,
+              "no Python class registered for #{inspect(module)}, " <>
+                "see Pythonx.register_struct/2"
+
+      fields ->
+        fields
+    end
+  end
+end
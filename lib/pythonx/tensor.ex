@@ -0,0 +1,141 @@
+if Code.ensure_loaded?(Nx) do
+  defmodule Pythonx.Tensor do
+    @moduledoc false
+
+    # Conversion between Nx tensors and numpy arrays.
+    #
+    # In both directions we pass the raw tensor data as a buffer, so
+    # dtype and shape are exchanged separately. When encoding, the
+    # binary is exposed to numpy as a read-only memoryview, without
+    # copying. When decoding, numpy arrays are writable, so the buffer
+    # is copied into the binary, unless :share_writable is given (see
+    # Pythonx.to_binary/2).
+
+    @types [
+      {{:u, 8}, "uint8"},
+      {{:u, 16}, "uint16"},
+      {{:u, 32}, "uint32"},
+      {{:u, 64}, "uint64"},
+      {{:s, 8}, "int8"},
+      {{:s, 16}, "int16"},
+      {{:s, 32}, "int32"},
+      {{:s, 64}, "int64"},
+      {{:f, 16}, "float16"},
+      {{:f, 32}, "float32"},
+      {{:f, 64}, "float64"},
+      {{:c, 64}, "complex64"},
+      {{:c, 128}, "complex128"}
+    ]
+
+    @doc """
+    Encodes the given tensor as a numpy array.
+    """
+    @spec to_array(Nx.Tensor.t()) :: Pythonx.Object.t()
+    def to_array(%Nx.Tensor{} = tensor) do
+      dtype = dtype!(tensor.type)
+
+      # For the binary backend this returns the underlying binary
+      # without copying.
+      binary = Nx.to_binary(tensor)
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          try:
+            import numpy
+            result = numpy.frombuffer(data, dtype=dtype).reshape(shape)
+          except ModuleNotFoundError:
+            result = None
+
+          result
+          """,
+          %{"data" => Pythonx.memoryview(binary), "dtype" => dtype, "shape" => tensor.shape}
+        )
+
+      case Pythonx.decode(result) do
+        %Pythonx.Object{} ->
+          result
+
+        nil ->
+          raise Protocol.UndefinedError,
+            protocol: Pythonx.Encoder,
+            value: tensor,
+            description:
+              "cannot encode Nx.Tensor, because the numpy Python package is not installed"
+      end
+    end
+
+    @doc """
+    Converts a numpy array, or any object convertible to one, into
+    a tensor.
+    """
+    @spec from_array(Pythonx.Object.t(), keyword()) :: Nx.Tensor.t()
+    def from_array(%Pythonx.Object{} = object, opts) do
+      # Objects implementing DLPack (such as PyTorch or JAX tensors)
+      # are imported via numpy.from_dlpack, which shares memory with
+      # the source. Other objects go through numpy.asarray, which also
+      # avoids copying for objects exposing __array_interface__ or the
+      # buffer protocol.
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          try:
+            import numpy
+          except ModuleNotFoundError:
+            numpy = None
+
+          if numpy is None:
+            result = None
+          else:
+            if not isinstance(object, numpy.ndarray) and hasattr(object, "__dlpack__"):
+              array = numpy.from_dlpack(object)
+            else:
+              array = numpy.asarray(object)
+
+            array = numpy.ascontiguousarray(array)
+            result = (array, array.dtype.name, array.shape)
+
+          result
+          """,
+          %{"object" => object}
+        )
+
+      case Pythonx.decode(result) do
+        {array, dtype, shape} ->
+          type = type!(dtype)
+          binary = Pythonx.to_binary(array, opts)
+
+          binary
+          |> Nx.from_binary(type)
+          |> Nx.reshape(shape)
+
+        nil ->
+          raise ArgumentError,
+                "cannot convert the object to Nx.Tensor, because the numpy Python " <>
+                  "package is not installed"
+      end
+    end
+
+    for {type, dtype} <- @types do
+      defp dtype!(unquote(type)), do: unquote(dtype)
+      defp type!(unquote(dtype)), do: unquote(type)
+    end
+
+    defp dtype!(type) do
+      raise ArgumentError, "cannot convert tensor of type #{inspect(type)} to a numpy array"
+    end
+
+    # numpy booleans are stored as bytes with 0 and 1 values
+    defp type!("bool"), do: {:u, 8}
+
+    defp type!(dtype) do
+      raise ArgumentError, "cannot convert numpy array of dtype #{dtype} to a tensor"
+    end
+  end
+
+  defimpl Pythonx.Encoder, for: Nx.Tensor do
+    def encode(tensor, _encoder) do
+      Pythonx.Tensor.to_array(tensor)
+    end
+  end
+end
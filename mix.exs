@@ -17,6 +17,7 @@ defmodule Pythonx.MixProject do
       name: "Pythonx",
       description: @description,
       start_permanent: Mix.env() == :prod,
+      elixirc_paths: elixirc_paths(Mix.env()),
       deps: deps(),
       compilers: [:elixir_make] ++ Mix.compilers(),
       docs: docs(),
@@ -37,9 +38,15 @@ defmodule Pythonx.MixProject do
     ]
   end
 
+  defp elixirc_paths(:test), do: ["lib", "test/support"]
+  defp elixirc_paths(_env), do: ["lib"]
+
   defp deps do
     [
       {:flame, "~> 0.5", optional: true},
+      {:explorer, "~> 0.10", optional: true},
+      {:nx, "~> 0.9", optional: true},
+      {:decimal, "~> 2.0", optional: true},
       {:fine, "~> 0.1.2", runtime: false},
       {:elixir_make, "~> 0.9", runtime: false},
       {:cc_precompiler, "~> 0.1", runtime: false},
@@ -0,0 +1,32 @@
+defmodule Pythonx.SourceTest do
+  # Changes the number of online dirty schedulers, which affects all
+  # tests, so we run synchronously
+  use ExUnit.Case, async: false
+
+  setup do
+    online = :erlang.system_info(:dirty_cpu_schedulers_online)
+    :erlang.system_flag(:dirty_cpu_schedulers_online, 1)
+    on_exit(fn -> :erlang.system_flag(:dirty_cpu_schedulers_online, online) end)
+  end
+
+  test "consumes iterators with a single dirty scheduler" do
+    items = [1, %{"a" => [2]}, ~D[2024-01-02], MapSet.new([3]), Pythonx.encode!(4)]
+
+    {result, %{}} =
+      Pythonx.eval(
+        "[str(item) for item in iterator]",
+        %{"iterator" => Pythonx.iterator(Stream.concat(items, items), chunk_size: 1)}
+      )
+
+    expected = ["1", "{'a': [2]}", "2024-01-02", "{3}", "4"]
+    assert Pythonx.decode(result) == expected ++ expected
+  end
+
+  test "reports unsupported items with a single dirty scheduler" do
+    iterator = Pythonx.iterator([URI.parse("https://example.com")])
+
+    assert_raise Pythonx.Error, ~r/TypeError/, fn ->
+      Pythonx.eval("next(iterator)", %{"iterator" => iterator})
+    end
+  end
+end
@@ -11,75 +11,1025 @@ defmodule PythonxTest do
       assert repr(Pythonx.encode!(:hello)) == "'hello'"
     end
 
+    test "reuses objects for atoms and singletons" do
+      for term <- [nil, true, false, -5, 0, 256, :status] do
+        assert Pythonx.encode!(term).resource == Pythonx.encode!(term).resource
+      end
+
+      assert Pythonx.encode!(257).resource != Pythonx.encode!(257).resource
+
+      # Atom strings are interned, both when encoded one by one and in bulk
+      {result, %{}} =
+        Pythonx.eval(
+          "a is b and b is c[0] and c[0] is list(d)[0]",
+          %{"a" => :status, "b" => :status, "c" => [:status], "d" => %{status: 1}}
+        )
+
+      assert Pythonx.decode(result) == true
+    end
+
     test "integer" do
       assert repr(Pythonx.encode!(10)) == "10"
       assert repr(Pythonx.encode!(-10)) == "-10"
 
       # Large numbers (over 64 bits)
       assert repr(Pythonx.encode!(2 ** 100)) == "1267650600228229401496703205376"
+      assert repr(Pythonx.encode!(-(2 ** 100))) == "-1267650600228229401496703205376"
+
+      for number <- [2 ** 64, -(2 ** 64), 2 ** 63, -(2 ** 63) - 1, 3 ** 5000, -(3 ** 5000)] do
+        {result, %{}} = Pythonx.eval("str(x)", %{"x" => number})
+        assert Pythonx.decode(result) == Integer.to_string(number)
+      end
+    end
+
+    test "float" do
+      assert repr(Pythonx.encode!(10.5)) == "10.5"
+      assert repr(Pythonx.encode!(-10.5)) == "-10.5"
+    end
+
+    test "string" do
+      assert repr(Pythonx.encode!("hello")) == "b'hello'"
+
+      assert repr(Pythonx.encode!("🦊 in a 📦")) ==
+               ~S"b'\xf0\x9f\xa6\x8a in a \xf0\x9f\x93\xa6'"
+
+      binary = :binary.copy("abc", 1024 * 1024)
+      {result, %{}} = Pythonx.eval("(len(x), x[-3:])", %{"x" => binary})
+      assert Pythonx.decode(result) == {3 * 1024 * 1024, "abc"}
+    end
+
+    test "binary" do
+      assert repr(Pythonx.encode!(<<65, 255>>)) == ~S"b'A\xff'"
+
+      assert_raise Protocol.UndefinedError, fn ->
+        Pythonx.encode!(<<1::4>>)
+      end
+    end
+
+    test "list" do
+      assert repr(Pythonx.encode!([])) == "[]"
+      assert repr(Pythonx.encode!([1, 2.0, "hello"])) == "[1, 2.0, b'hello']"
+    end
+
+    test "tuple" do
+      assert repr(Pythonx.encode!({})) == "()"
+      assert repr(Pythonx.encode!({1})) == "(1,)"
+      assert repr(Pythonx.encode!({1, 2.0, "hello"})) == "(1, 2.0, b'hello')"
+    end
+
+    test "map" do
+      assert repr(Pythonx.encode!(%{"hello" => 1})) == "{b'hello': 1}"
+      assert repr(Pythonx.encode!(%{2 => nil})) == "{2: None}"
+    end
+
+    test "mapset" do
+      assert repr(Pythonx.encode!(MapSet.new([1]))) == "{1}"
+    end
+
+    test "pid" do
+      assert repr(Pythonx.encode!(IEx.Helpers.pid(0, 1, 2))) == "<pythonx.PID>"
+    end
+
+    test "identity for Pythonx.Object" do
+      object = Pythonx.encode!(1)
+      assert Pythonx.encode!(object) == object
+    end
+
+    test "nested containers" do
+      term = [%{"a" => {1, :b}}, [nil, true], ~c"ab", 2 ** 100, -(2 ** 70)]
+
+      assert repr(Pythonx.encode!(term)) ==
+               "[{b'a': (1, 'b')}, [None, True], [97, 98], " <>
+                 "1267650600228229401496703205376, -1180591620717411303424]"
+    end
+
+    test "containers with structs" do
+      assert repr(Pythonx.encode!([Pythonx.encode!(1), MapSet.new([2])])) == "[1, {2}]"
+    end
+
+    test "containers with structs that require the protocol" do
+      assert repr(Pythonx.encode!(%{"x" => [1..3, :binary.copy("a", 100_000)]})) ==
+               "{b'x': [range(1, 4), b'#{String.duplicate("a", 100_000)}']}"
+    end
+
+    test "custom encoder" do
+      # Contrived example where we encode tuples as lists.
+
+      encoder = fn
+        tuple, encoder when is_tuple(tuple) ->
+          Pythonx.Encoder.encode(Tuple.to_list(tuple), encoder)
+
+        other, encoder ->
+          Pythonx.Encoder.encode(other, encoder)
+      end
+
+      assert repr(Pythonx.encode!({1, 2}, encoder)) == "[1, 2]"
+    end
+  end
+
+  describe "memoryview/1" do
+    test "exposes the binary as a read-only memoryview" do
+      binary = :binary.copy("abc", 1000)
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          (view.readonly, view.format, len(view), bytes(view[0:3]))
+          """,
+          %{"view" => Pythonx.memoryview(binary)}
+        )
+
+      assert Pythonx.decode(result) == {true, "B", 3000, "abc"}
+    end
+
+    test "keeps the binary alive while referenced from Python" do
+      {_result, %{"view" => view}} =
+        Pythonx.eval(
+          """
+          view = view[1:]
+          """,
+          %{"view" => Pythonx.memoryview(:binary.copy("x", 100) <> "y")}
+        )
+
+      :erlang.garbage_collect()
+
+      {result, %{}} = Pythonx.eval("bytes(view[-2:])", %{"view" => view})
+      assert Pythonx.decode(result) == "xy"
+    end
+
+    test "supports sub-binaries" do
+      <<_::binary-size(10), sub::binary-size(5), _::binary>> = :binary.copy("0123456789", 10)
+
+      {result, %{}} = Pythonx.eval("bytes(view)", %{"view" => Pythonx.memoryview(sub)})
+      assert Pythonx.decode(result) == "01234"
+    end
+
+    test "does not give write access via the underlying object" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import ctypes
+
+          try:
+            ctypes.c_char.from_buffer(view.obj)
+            writable = True
+          except TypeError:
+            writable = False
+
+          (writable, memoryview(view.obj).readonly)
+          """,
+          %{"view" => Pythonx.memoryview(:binary.copy("abc", 100))}
+        )
+
+      assert Pythonx.decode(result) == {false, true}
+    end
+
+    test "supports empty binaries" do
+      {result, %{}} =
+        Pythonx.eval(
+          "(len(view), bytes(view), view.readonly)",
+          %{"view" => Pythonx.memoryview(<<>>)}
+        )
+
+      assert Pythonx.decode(result) == {0, "", true}
+    end
+  end
+
+  describe "to_binary/2" do
+    test "converts read-only buffers" do
+      {result, %{}} = Pythonx.eval("memoryview(b'hello world')[6:]", %{})
+      assert Pythonx.to_binary(result) == "world"
+    end
+
+    test "copies writable buffers by default" do
+      {result, %{"data" => data}} =
+        Pythonx.eval(
+          """
+          data = bytearray(b"hello")
+          data
+          """,
+          %{}
+        )
+
+      binary = Pythonx.to_binary(result)
+      assert binary == "hello"
+
+      Pythonx.eval("data[0] = ord('j')", %{"data" => data})
+      assert binary == "hello"
+    end
+
+    test "copies read-only views of mutable buffers" do
+      {result, %{"data" => data}} =
+        Pythonx.eval(
+          """
+          data = bytearray(b"hello")
+          memoryview(data).toreadonly()
+          """,
+          %{}
+        )
+
+      binary = Pythonx.to_binary(result)
+      assert binary == "hello"
+
+      Pythonx.eval("data[0] = ord('j')", %{"data" => data})
+      assert binary == "hello"
+    end
+
+    test "shares writable buffers with :share_writable" do
+      {result, %{}} = Pythonx.eval("import array; array.array('i', [1, 2, 3])", %{})
+
+      assert Pythonx.to_binary(result, share_writable: true) ==
+               <<1::native-32, 2::native-32, 3::native-32>>
+    end
+
+    test "copies non-contiguous buffers" do
+      {result, %{}} = Pythonx.eval("memoryview(b'abcdef')[::2]", %{})
+      assert Pythonx.to_binary(result) == "ace"
+
+      {result, %{}} = Pythonx.eval("memoryview(b'abcdef')[::-1]", %{})
+      assert Pythonx.to_binary(result) == "fedcba"
+
+      {result, %{}} = Pythonx.eval("memoryview(bytes(4 * 1024 * 1024))[1::2]", %{})
+      assert Pythonx.to_binary(result) == <<0::size(2 * 1024 * 1024)-unit(8)>>
+    end
+
+    test "copies large writable buffers" do
+      {result, %{}} = Pythonx.eval("bytearray(b'ab' * 1024 * 1024)", %{})
+      assert Pythonx.to_binary(result) == :binary.copy("ab", 1024 * 1024)
+    end
+
+    test "raises for objects without buffer protocol support" do
+      {result, %{}} = Pythonx.eval("1", %{})
+
+      assert_raise Pythonx.Error, ~r/TypeError/, fn ->
+        Pythonx.to_binary(result)
+      end
+    end
+  end
+
+  describe "encode!/1 with encode_many/2" do
+    alias Pythonx.Test.Point
+
+    test "encodes lists of structs in a single batch" do
+      points = for i <- 1..3, do: %Point{x: i, y: -i}
+
+      assert Pythonx.decode(Pythonx.encode!(points)) ==
+               [{"many", 1, -1}, {"many", 2, -2}, {"many", 3, -3}]
+    end
+
+    test "encodes structs in mixed lists in a batch, preserving order" do
+      term = [%Point{x: 1, y: 2}, :a, [%Point{x: 3, y: 4}], %Point{x: 5, y: 6}]
+
+      assert Pythonx.decode(Pythonx.encode!(term)) ==
+               [{"many", 1, 2}, "a", [{"many", 3, 4}], {"many", 5, 6}]
+    end
+
+    test "encodes single structs with encode/2" do
+      assert Pythonx.decode(Pythonx.encode!(%Point{x: 1, y: 2})) == {"one", 1, 2}
+    end
+
+    test "uses encode/2 with a custom encoder" do
+      custom_encoder = fn term, encoder -> Pythonx.Encoder.encode(term, encoder) end
+
+      assert Pythonx.decode(Pythonx.encode!([%Point{x: 1, y: 2}], custom_encoder)) ==
+               [{"one", 1, 2}]
+    end
+
+    test "raises when encode_many/2 returns a different number of items" do
+      items = [%Pythonx.Test.BadBatch{value: 1}, %Pythonx.Test.BadBatch{value: 2}]
+
+      # Both when the whole list is a batch and when it is mixed
+      for term <- [items, [:a | items]] do
+        assert_raise ArgumentError, ~r/encode_many\/2 to return a Python list with 2 items/, fn ->
+          Pythonx.encode!(term)
+        end
+      end
+    end
+  end
+
+  describe "packed numbers" do
+    test "encodes lists as typed arrays" do
+      assert repr(Pythonx.encode!([1.0, 2.5, 3], as: {:array, :f64})) ==
+               "array('d', [1.0, 2.5, 3.0])"
+
+      assert repr(Pythonx.encode!([0, -128, 127], as: {:array, :s8})) ==
+               "array('b', [0, -128, 127])"
+
+      assert repr(Pythonx.encode!([0, 18_446_744_073_709_551_615], as: {:array, :u64})) ==
+               "array('Q', [0, 18446744073709551615])"
+
+      assert repr(Pythonx.encode!([], as: {:array, :u16})) == "array('H')"
+    end
+
+    test "encodes packed binaries as typed arrays" do
+      binary = <<1::signed-native-32, -1::signed-native-32>>
+      assert repr(Pythonx.encode!(binary, as: {:array, :s32})) == "array('i', [1, -1])"
+
+      assert_raise ArgumentError, ~r/expected binary size to be a multiple of 4/, fn ->
+        Pythonx.encode!(<<1, 2, 3>>, as: {:array, :f32})
+      end
+    end
+
+    test "raises when encoding values outside of the type range" do
+      assert_raise ArgumentError, "item at index 1 is not a valid :u8 value", fn ->
+        Pythonx.encode!([1, 256], as: {:array, :u8})
+      end
+
+      assert_raise ArgumentError, "item at index 0 is not a valid :s64 value", fn ->
+        Pythonx.encode!([1.0], as: {:array, :s64})
+      end
+
+      assert_raise ArgumentError, ~r/expected :as to be :bytes or {:array, type}/, fn ->
+        Pythonx.encode!([1], as: {:array, :f16})
+      end
+    end
+
+    test "decodes typed buffers" do
+      {result, %{}} = Pythonx.eval("import array; array.array('d', [1.0, 2.5])", %{})
+
+      assert Pythonx.decode(result, as: {:f64, :binary}) ==
+               <<1.0::float-native-64, 2.5::float-native-64>>
+
+      assert Pythonx.decode(result, as: {:f64, :list}) == [1.0, 2.5]
+
+      # Mismatched item types are converted
+      assert Pythonx.decode(result, as: {:f32, :list}) == [1.0, 2.5]
+    end
+
+    test "decodes sequences of numbers" do
+      assert Pythonx.decode(eval_result("[1.0, 2.5, 3]"), as: {:f64, :list}) == [1.0, 2.5, 3.0]
+      assert Pythonx.decode(eval_result("(1, -2, 3)"), as: {:s16, :list}) == [1, -2, 3]
+      assert Pythonx.decode(eval_result("range(3)"), as: {:u8, :binary}) == <<0, 1, 2>>
+      assert Pythonx.decode(eval_result("[2**64 - 1]"), as: {:u64, :list}) == [2 ** 64 - 1]
+      assert Pythonx.decode(eval_result("[]"), as: {:f32, :binary}) == ""
+    end
+
+    test "round trips through encode and decode" do
+      list = Enum.map(1..1000, &(&1 / 4))
+      object = Pythonx.encode!(list, as: {:array, :f64})
+      assert Pythonx.decode(object, as: {:f64, :list}) == list
+    end
+
+    test "raises when decoding values outside of the type range" do
+      assert_raise ArgumentError, "item at index 2 is not a valid :u8 value", fn ->
+        Pythonx.decode(eval_result("[1, 2, -1]"), as: {:u8, :list})
+      end
+
+      assert_raise ArgumentError, "item at index 0 is not a valid :s64 value", fn ->
+        Pythonx.decode(eval_result("[2**64]"), as: {:s64, :list})
+      end
+
+      assert_raise Pythonx.Error, ~r/TypeError/, fn ->
+        Pythonx.decode(eval_result("[1.5]"), as: {:s64, :list})
+      end
+    end
+  end
+
+  describe "encode!/2 with as: :bytes" do
+    test "encodes iodata" do
+      assert repr(Pythonx.encode!(["hello", ?\s, [~c"wor", "l" | "d"]], as: :bytes)) ==
+               "b'hello world'"
+
+      assert repr(Pythonx.encode!("hello", as: :bytes)) == "b'hello'"
+      assert repr(Pythonx.encode!([[], ""], as: :bytes)) == "b''"
+    end
+
+    test "encodes large iodata" do
+      chunk = :binary.copy("a", 1024)
+      iodata = List.duplicate([chunk, ?b], 2048)
+
+      {result, %{}} =
+        Pythonx.eval("(len(data), data.count(b'b'))", %{
+          "data" => Pythonx.encode!(iodata, as: :bytes)
+        })
+
+      assert Pythonx.decode(result) == {2048 * 1025, 2048}
+    end
+
+    test "raises on invalid iodata" do
+      for term <- [[256], [1 | 2], :atom, <<1::1>>] do
+        assert_raise ArgumentError, "expected iodata", fn ->
+          Pythonx.encode!(term, as: :bytes)
+        end
+      end
+    end
+  end
+
+  describe "decode/2 with layout: :columnar" do
+    test "transposes records into columns" do
+      result = eval_result("[{'x': 1, 'y': 'a'}, {'x': 2, 'y': 'b'}, {'x': 3, 'y': None}]")
+
+      assert Pythonx.decode(result, layout: :columnar) == %{
+               "x" => [1, 2, 3],
+               "y" => ["a", "b", nil]
+             }
+    end
+
+    test "fills missing keys with nil" do
+      result = eval_result("[{'x': 1}, {'y': 2}, {'x': 3}]")
+
+      assert Pythonx.decode(result, layout: :columnar) == %{
+               "x" => [1, nil, 3],
+               "y" => [nil, 2, nil]
+             }
+    end
+
+    test "accepts any iterable of dicts" do
+      assert Pythonx.decode(eval_result("()"), layout: :columnar) == %{}
+
+      result = eval_result("({'x': i} for i in range(3))")
+      assert Pythonx.decode(result, layout: :columnar) == %{"x" => [0, 1, 2]}
+    end
+
+    test "raises on missing keys with :as" do
+      result = eval_result("[{'x': 1, 'y': 0.5}, {'x': 2}]")
+
+      assert_raise ArgumentError, ~r/cannot decode column "y".*NoneType/s, fn ->
+        Pythonx.decode(result, layout: :columnar, as: {:f64, :list})
+      end
+    end
+
+    test "decodes columns with :as" do
+      result = eval_result("[{'x': 1, 'y': 0.5}, {'x': 2, 'y': 1.5}]")
+
+      assert Pythonx.decode(result, layout: :columnar, as: {:f64, :binary}) == %{
+               "x" => <<1.0::float-native-64, 2.0::float-native-64>>,
+               "y" => <<0.5::float-native-64, 1.5::float-native-64>>
+             }
+    end
+
+    test "raises for items other than dicts" do
+      assert_raise ArgumentError,
+                   "expected a sequence of dicts, but item at index 1 is not a dict",
+                   fn ->
+                     Pythonx.decode(eval_result("[{}, 1]"), layout: :columnar)
+                   end
+    end
+  end
+
+  describe "decode/2 with :keys" do
+    test "shares repeated string keys" do
+      result = Pythonx.decode(eval_result("[{'name': i, 'value': i} for i in range(100)]"))
+
+      assert length(result) == 100
+      assert :erts_debug.size(result) < :erts_debug.flat_size(result)
+    end
+
+    test "decodes string keys as existing atoms with :atoms!" do
+      result = eval_result("[{'name': 1, 2: 'x'}, {'name': 2, b'name': 3}]")
+
+      assert Pythonx.decode(result, keys: :atoms!) == [
+               %{:name => 1, 2 => "x"},
+               %{:name => 2, "name" => 3}
+             ]
+    end
+
+    test "decodes only string keys as atoms when decoding incrementally" do
+      # Deep nesting makes decoding fall back to the incremental path
+      result =
+        eval_result("""
+        value = []
+        for _ in range(300):
+          value = [value]
+        {'name': 1, b'name': 2, 'value': value}
+        """)
+
+      assert %{:name => 1, "name" => 2, :value => value} =
+               Pythonx.decode(result, keys: :atoms!)
+
+      assert value == Enum.reduce(1..300, [], fn _, acc -> [acc] end)
+    end
+
+    test "raises when the atom does not exist" do
+      result = eval_result("{'pythonx_test_nonexistent_atom_key': 1}")
+
+      assert_raise ArgumentError,
+                   ~s/cannot decode dict key "pythonx_test_nonexistent_atom_key" as an atom, / <>
+                     "because it does not exist",
+                   fn -> Pythonx.decode(result, keys: :atoms!) end
+    end
+
+    test "applies to columnar layout" do
+      result = eval_result("[{'name': 1}, {'name': 2}]")
+      assert Pythonx.decode(result, layout: :columnar, keys: :atoms!) == %{name: [1, 2]}
+    end
+  end
+
+  describe "decode/2 with :arena" do
+    test "decodes medium-sized strings as sub-binaries of shared buffers" do
+      result = eval_result("[str(i) * 100 for i in range(100)] + ['short', 'x' * 10000]")
+
+      assert [first | _] = strings = Pythonx.decode(result, arena: true)
+
+      assert strings ==
+               Enum.map(0..99, &String.duplicate(Integer.to_string(&1), 100)) ++
+                 ["short", String.duplicate("x", 10000)]
+
+      assert :binary.referenced_byte_size(first) > byte_size(first)
+    end
+
+    test "handles bytes and dict keys" do
+      key = String.duplicate("k", 100)
+      result = eval_result("{'#{key}': b'v' * 200}")
+
+      assert Pythonx.decode(result, arena: true) == %{key => String.duplicate("v", 200)}
+    end
+  end
+
+  describe "stream/2" do
+    test "streams items of an iterable" do
+      assert eval_result("[1, 'a', (2, 3)]") |> Pythonx.stream() |> Enum.to_list() ==
+               [1, "a", {2, 3}]
+
+      assert eval_result("range(1000)") |> Pythonx.stream(chunk_size: 7) |> Enum.sum() ==
+               499_500
+
+      assert eval_result("[]") |> Pythonx.stream() |> Enum.to_list() == []
+    end
+
+    test "pulls items lazily" do
+      {result, %{"pulled" => pulled}} =
+        Pythonx.eval(
+          """
+          pulled = []
+
+          def gen():
+            for i in range(1000):
+              pulled.append(i)
+              yield i
+
+          gen()
+          """,
+          %{}
+        )
+
+      assert result |> Pythonx.stream(chunk_size: 2) |> Enum.take(3) == [0, 1, 2]
+      assert Pythonx.decode(pulled) == [0, 1, 2, 3]
+    end
+
+    test "returns objects with decode: false" do
+      stream = Pythonx.stream(eval_result("[complex(1), 1]"), decode: false)
+
+      assert [object1, object2] = Enum.to_list(stream)
+      assert repr(object1) == "(1+0j)"
+      assert repr(object2) == "1"
+    end
+
+    test "raises errors from the iterator" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          def gen():
+            yield 1
+            raise RuntimeError("oops")
+
+          gen()
+          """,
+          %{}
+        )
+
+      assert_raise Pythonx.Error, ~r/RuntimeError: oops/, fn ->
+        result |> Pythonx.stream(chunk_size: 1) |> Enum.to_list()
+      end
+    end
+  end
+
+  describe "reader/1 and iterator/2" do
+    test "reads iodata" do
+      for data <- ["hello world", ["hel", ?l, ?o, [" ", ["wor"] | "ld"]], []] do
+        {result, %{}} = Pythonx.eval("reader.read()", %{"reader" => Pythonx.reader(data)})
+        assert Pythonx.decode(result) == IO.iodata_to_binary(data)
+      end
+    end
+
+    test "reads a stream of iodata in chunks" do
+      stream = Stream.map(1..3, &["line ", Integer.to_string(&1), ?\n])
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import io
+          [line for line in io.BufferedReader(reader)]
+          """,
+          %{"reader" => Pythonx.reader(stream)}
+        )
+
+      assert Pythonx.decode(result) == ["line 1\n", "line 2\n", "line 3\n"]
+    end
+
+    test "iterates over a stream lazily" do
+      parent = self()
+
+      stream =
+        Stream.map(1..10, fn x ->
+          send(parent, {:pulled, x})
+          x
+        end)
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          (next(iterator), next(iterator))
+          """,
+          %{"iterator" => Pythonx.iterator(stream, chunk_size: 3)}
+        )
+
+      assert Pythonx.decode(result) == {1, 2}
+      assert_receive {:pulled, 3}
+      refute_receive {:pulled, 4}
+    end
+
+    test "converts items natively" do
+      items = [{1, "1"}, 1..3, MapSet.new([:a]), ~D[2024-01-02], Pythonx.encode!(1.5)]
+
+      {result, %{}} =
+        Pythonx.eval(
+          "[type(item).__name__ for item in iterator]",
+          %{"iterator" => Pythonx.iterator(items, chunk_size: 2)}
+        )
+
+      assert Pythonx.decode(result) == ["tuple", "range", "set", "date", "float"]
+    end
+
+    test "raises on items without built-in conversion" do
+      iterator = Pythonx.iterator([1, URI.parse("https://example.com")])
+
+      assert_raise Pythonx.Error, ~r/TypeError: the Elixir iterator produced items/, fn ->
+        Pythonx.eval("list(iterator)", %{"iterator" => iterator})
+      end
+    end
+
+    test "consumes more iterators concurrently than there are dirty schedulers" do
+      count = :erlang.system_info(:dirty_cpu_schedulers) + 2
+
+      sums =
+        1..count
+        |> Task.async_stream(
+          fn i ->
+            stream =
+              Stream.map(1..3, fn x ->
+                Process.sleep(10)
+                x * i
+              end)
+
+            {result, %{}} =
+              Pythonx.eval("sum(iterator)", %{
+                "iterator" => Pythonx.iterator(stream, chunk_size: 1)
+              })
+
+            Pythonx.decode(result)
+          end,
+          max_concurrency: count,
+          timeout: 10_000
+        )
+        |> Enum.map(fn {:ok, sum} -> sum end)
+
+      assert sums == Enum.map(1..count, &(6 * &1))
+    end
+
+    test "raises errors from the stream" do
+      stream =
+        Stream.map(1..3, fn
+          3 -> raise "oops"
+          x -> x
+        end)
+
+      assert_raise Pythonx.Error, ~r/RuntimeError: \*\* \(RuntimeError\) oops/, fn ->
+        Pythonx.eval("list(iterator)", %{"iterator" => Pythonx.iterator(stream)})
+      end
+    end
+
+    test "encodes ranges" do
+      assert repr(Pythonx.encode!(1..10//3)) == "range(1, 11, 3)"
+      assert repr(Pythonx.encode!(5..1//-2)) == "range(5, 0, -2)"
+
+      {result, %{}} = Pythonx.eval("list(range)", %{"range" => 3..1//1})
+      assert Pythonx.decode(result) == []
+
+      {result, %{}} = Pythonx.eval("range[-1]", %{"range" => 0..(2 ** 70)})
+      assert Pythonx.decode(result) == 2 ** 70
+    end
+  end
+
+  describe "Nx.Tensor" do
+    test "encodes as numpy array" do
+      tensor = Nx.iota({2, 3}, type: :f32)
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          (array.dtype.name, array.shape, array.flags.writeable, array.tolist())
+          """,
+          %{"array" => tensor}
+        )
+
+      assert Pythonx.decode(result) ==
+               {"float32", {2, 3}, false, [[0.0, 1.0, 2.0], [3.0, 4.0, 5.0]]}
+    end
+
+    test "encodes scalars" do
+      {result, %{}} =
+        Pythonx.eval("(array.dtype.name, array.shape)", %{"array" => Nx.tensor(1, type: :u16)})
+
+      assert Pythonx.decode(result) == {"uint16", {}}
+    end
+
+    test "raises on unsupported types" do
+      assert_raise ArgumentError, ~r/cannot convert tensor of type \{:bf, 16\}/, fn ->
+        Pythonx.encode!(Nx.tensor([1.0], type: :bf16))
+      end
+    end
+
+    test "round-trips via to_tensor/2" do
+      for type <- [:u8, :s64, :f16, :f64, :c64] do
+        tensor = Nx.iota({2, 2, 2}, type: type)
+        assert tensor |> Pythonx.encode!() |> Pythonx.to_tensor() == tensor
+      end
+    end
+
+    test "converts non-contiguous arrays" do
+      {result, %{}} = Pythonx.eval("import numpy; numpy.arange(6).reshape(2, 3).T", %{})
+
+      assert Pythonx.to_tensor(result) == Nx.tensor([[0, 3], [1, 4], [2, 5]], type: :s64)
+    end
+
+    test "converts boolean arrays" do
+      {result, %{}} = Pythonx.eval("import numpy; numpy.array([True, False])", %{})
+
+      assert Pythonx.to_tensor(result) == Nx.tensor([1, 0], type: :u8)
+    end
+
+    test "converts objects convertible to arrays" do
+      {result, %{}} = Pythonx.eval("[[1.0, 2.0], [3.0, 4.0]]", %{})
+
+      assert Pythonx.to_tensor(result) == Nx.tensor([[1.0, 2.0], [3.0, 4.0]], type: :f64)
+    end
+  end
+
+  describe "Explorer.DataFrame" do
+    test "encodes as polars dataframe" do
+      df = Explorer.DataFrame.new(x: [1, 2, 3], y: ["a", "b", "c"])
+
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          (type(df).__module__.split(".")[0], df.columns, df["x"].to_list(), df["y"].to_list())
+          """,
+          %{"df" => df}
+        )
+
+      assert Pythonx.decode(result) == {"polars", ["x", "y"], [1, 2, 3], ["a", "b", "c"]}
+    end
+
+    test "round-trips via to_dataframe/1" do
+      df = Explorer.DataFrame.new(x: [1.0, nil, 3.0], y: [true, false, true])
+
+      result = df |> Pythonx.encode!() |> Pythonx.to_dataframe()
+
+      assert Explorer.DataFrame.to_columns(result) == Explorer.DataFrame.to_columns(df)
+    end
+
+    test "converts pyarrow tables" do
+      {result, %{}} =
+        Pythonx.eval("import pyarrow; pyarrow.table({'x': [1, 2], 'y': ['a', 'b']})", %{})
+
+      assert result |> Pythonx.to_dataframe() |> Explorer.DataFrame.to_columns() ==
+               %{"x" => [1, 2], "y" => ["a", "b"]}
+    end
+
+    test "streams record batches with to_dataframe_stream/1" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import pyarrow
+
+          table = pyarrow.table({"x": list(range(10))})
+          pyarrow.RecordBatchReader.from_batches(table.schema, table.to_batches(max_chunksize=4))
+          """,
+          %{}
+        )
+
+      assert result
+             |> Pythonx.to_dataframe_stream()
+             |> Enum.map(&Explorer.DataFrame.to_columns(&1)["x"]) ==
+               [[0, 1, 2, 3], [4, 5, 6, 7], [8, 9]]
     end
+  end
 
-    test "float" do
-      assert repr(Pythonx.encode!(10.5)) == "10.5"
-      assert repr(Pythonx.encode!(-10.5)) == "-10.5"
+  describe "calendar types and Decimal" do
+    test "encodes calendar types" do
+      assert repr(Pythonx.encode!(~D[2024-01-15])) == "datetime.date(2024, 1, 15)"
+      assert repr(Pythonx.encode!(~T[12:30:45.123456])) == "datetime.time(12, 30, 45, 123456)"
+
+      assert repr(Pythonx.encode!(~N[2024-01-15 12:30:45])) ==
+               "datetime.datetime(2024, 1, 15, 12, 30, 45)"
+
+      assert repr(Pythonx.encode!(~U[2024-01-15 12:30:45Z])) ==
+               "datetime.datetime(2024, 1, 15, 12, 30, 45, tzinfo=datetime.timezone.utc)"
+
+      datetime = %{~U[2024-01-15 12:30:45Z] | utc_offset: 3600, std_offset: 3600}
+
+      {result, %{}} = Pythonx.eval("dt.utcoffset().total_seconds()", %{"dt" => datetime})
+      assert Pythonx.decode(result) == 7200.0
     end
 
-    test "string" do
-      assert repr(Pythonx.encode!("hello")) == "b'hello'"
+    test "encodes datetime time zones with zoneinfo" do
+      datetime = %DateTime{
+        ~U[2024-01-15 12:30:45Z]
+        | time_zone: "Europe/Warsaw",
+          zone_abbr: "CET",
+          utc_offset: 3600
+      }
 
-      assert repr(Pythonx.encode!("🦊 in a 📦")) ==
-               ~S"b'\xf0\x9f\xa6\x8a in a \xf0\x9f\x93\xa6'"
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import zoneinfo
+
+          try:
+            zoneinfo.ZoneInfo("Europe/Warsaw")
+            expected = "Europe/Warsaw"
+          except zoneinfo.ZoneInfoNotFoundError:
+            expected = "UTC+01:00"
+
+          (str(dt.tzinfo) == expected, dt.hour, dt.utcoffset().total_seconds())
+          """,
+          %{"dt" => datetime}
+        )
+
+      assert Pythonx.decode(result) == {true, 12, 3600.0}
+
+      # Unknown zones fall back to a fixed offset
+      datetime = %{datetime | time_zone: "Unknown/Zone"}
+      {result, %{}} = Pythonx.eval("str(dt.tzinfo)", %{"dt" => datetime})
+      assert Pythonx.decode(result) == "UTC+01:00"
+
+      assert Pythonx.decode(Pythonx.encode!(datetime)) == ~U[2024-01-15 11:30:45Z]
     end
 
-    test "binary" do
-      assert repr(Pythonx.encode!(<<65, 255>>)) == ~S"b'A\xff'"
+    test "encodes decimals" do
+      assert repr(Pythonx.encode!(Decimal.new("1.23"))) == "Decimal('1.23')"
+      assert repr(Pythonx.encode!(Decimal.new("-1.5E+30"))) == "Decimal('-1.5E+30')"
+      assert repr(Pythonx.encode!(Decimal.new("-Infinity"))) == "Decimal('-Infinity')"
+      assert repr(Pythonx.encode!(Decimal.new("NaN"))) == "Decimal('NaN')"
+    end
 
-      assert_raise Protocol.UndefinedError, fn ->
-        Pythonx.encode!(<<1::4>>)
+    test "round-trips values" do
+      values = [
+        ~D[2024-01-15],
+        ~T[12:30:45],
+        ~T[12:30:45.123456],
+        ~N[2024-01-15 12:30:45.000001],
+        ~U[2024-01-15 12:30:45Z],
+        Decimal.new("1.23"),
+        Decimal.new("-0.5"),
+        Decimal.new("123456789012345678901234567890E-10"),
+        Decimal.new("Infinity")
+      ]
+
+      for value <- values do
+        assert Pythonx.decode(Pythonx.encode!(value)) == value
       end
+
+      # Lists go through the bulk conversion
+      assert Pythonx.decode(Pythonx.encode!(values)) == values
+      assert Pythonx.decode(Pythonx.encode!(values), arena: true) == values
+      assert Pythonx.stream(Pythonx.encode!(values)) |> Enum.to_list() == values
     end
 
-    test "list" do
-      assert repr(Pythonx.encode!([])) == "[]"
-      assert repr(Pythonx.encode!([1, 2.0, "hello"])) == "[1, 2.0, b'hello']"
+    test "decodes aware datetimes in UTC" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import datetime
+          tz = datetime.timezone(datetime.timedelta(hours=2))
+          datetime.datetime(2024, 1, 15, 12, 0, tzinfo=tz)
+          """,
+          %{}
+        )
+
+      assert Pythonx.decode(result) == ~U[2024-01-15 10:00:00Z]
     end
 
-    test "tuple" do
-      assert repr(Pythonx.encode!({})) == "()"
-      assert repr(Pythonx.encode!({1})) == "(1,)"
-      assert repr(Pythonx.encode!({1, 2.0, "hello"})) == "(1, 2.0, b'hello')"
+    test "returns aware times as objects" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          import datetime
+          datetime.time(12, 0, tzinfo=datetime.timezone.utc)
+          """,
+          %{}
+        )
+
+      assert %Pythonx.Object{} = Pythonx.decode(result)
     end
 
-    test "map" do
-      assert repr(Pythonx.encode!(%{"hello" => 1})) == "{b'hello': 1}"
-      assert repr(Pythonx.encode!(%{2 => nil})) == "{2: None}"
+    test "returns decimals as objects when Decimal is not available" do
+      object = Pythonx.encode!(Decimal.new("1.23"))
+
+      assert {:ok, [%Pythonx.Object{} = item]} =
+               Pythonx.NIF.decode_all(Pythonx.encode!([object]), true, false, false, false, true)
+
+      assert repr(item) == "Decimal('1.23')"
+      assert %Pythonx.Object{} = Pythonx.NIF.decode_once(object, false, false)
     end
+  end
 
-    test "mapset" do
-      assert repr(Pythonx.encode!(MapSet.new([1]))) == "{1}"
+  describe "register_struct/2" do
+    alias Pythonx.Test.Person
+
+    test "encodes and decodes dataclass instances" do
+      register_person("""
+      from dataclasses import dataclass
+
+      @dataclass
+      class Person:
+        name: bytes
+        age: int
+      """)
+
+      person = %Person{name: "Alice", age: 30}
+      object = Pythonx.encode!(person)
+
+      assert repr(object) == "Person(name=b'Alice', age=30)"
+      assert Pythonx.decode(object) == person
+
+      # Struct fields missing in the class get their defaults
+      assert Pythonx.decode(Pythonx.encode!(%{person | tags: [:admin]})) == person
+
+      # Incremental decoding
+      assert {:struct, Person, [name: name, age: age]} =
+               Pythonx.NIF.decode_once(object, false, true)
+      assert Pythonx.decode(name) == "Alice"
+      assert Pythonx.decode(age) == 30
     end
 
-    test "pid" do
-      assert repr(Pythonx.encode!(IEx.Helpers.pid(0, 1, 2))) == "<pythonx.PID>"
+    test "encodes and decodes namedtuple instances in batches" do
+      register_person("""
+      from collections import namedtuple
+      Person = namedtuple("Person", ["name", "age"])
+      """)
+
+      people = for age <- 1..3, do: %Person{name: "Bob", age: age}
+      custom_encoder = fn term, encoder -> Pythonx.Encoder.encode(term, encoder) end
+
+      assert Pythonx.decode(Pythonx.encode!(people)) == people
+      assert Pythonx.decode(Pythonx.encode!(people, custom_encoder)) == people
+      assert Pythonx.decode(Pythonx.encode!([1, people])) == [1, people]
+
+      {result, %{}} =
+        Pythonx.eval("[person.age for person in people]", %{"people" => people})
+
+      assert Pythonx.decode(result) == [1, 2, 3]
+
+      assert Pythonx.decode(Pythonx.encode!(people), arena: true) == people
+      assert Pythonx.stream(Pythonx.encode!(people)) |> Enum.to_list() == people
     end
 
-    test "identity for Pythonx.Object" do
-      object = Pythonx.encode!(1)
-      assert Pythonx.encode!(object) == object
+    test "encodes instances of classes with __slots__" do
+      register_person("""
+      class Person:
+        __slots__ = ("age", "name")
+
+        def __init__(self, age, name):
+          self.age = age
+          self.name = name
+      """)
+
+      {result, %{}} =
+        Pythonx.eval(
+          "(person.name, person.age)",
+          %{"person" => %Person{name: "Carol", age: 40}}
+        )
+
+      assert Pythonx.decode(result) == {"Carol", 40}
     end
 
-    test "custom encoder" do
-      # Contrived example where we encode tuples as lists.
+    test "raises on class fields missing in the struct" do
+      assert_raise ArgumentError, ~r/the struct has no field :email/, fn ->
+        register_person("""
+        from dataclasses import dataclass
 
-      encoder = fn
-        tuple, encoder when is_tuple(tuple) ->
-          Pythonx.Encoder.encode(Tuple.to_list(tuple), encoder)
+        @dataclass
+        class Person:
+          name: bytes
+          email: bytes
+        """)
+      end
+    end
 
-        other, encoder ->
-          Pythonx.Encoder.encode(other, encoder)
+    test "raises on unsupported classes" do
+      assert_raise Pythonx.Error, ~r/expected a dataclass, a namedtuple/, fn ->
+        register_person("""
+        class Person:
+          pass
+        """)
       end
+    end
 
-      assert repr(Pythonx.encode!({1, 2}, encoder)) == "[1, 2]"
+    defp register_person(code) do
+      {class, %{}} = Pythonx.eval(code <> "Person\n", %{})
+      Pythonx.register_struct(Person, class)
     end
   end
 
@@ -99,6 +1049,14 @@ defmodule PythonxTest do
 
       # Large numbers (over 64 bits)
       assert Pythonx.decode(eval_result("2 ** 100")) == 1_267_650_600_228_229_401_496_703_205_376
+      assert Pythonx.decode(eval_result("-2 ** 100")) == -(2 ** 100)
+      assert Pythonx.decode(eval_result("2 ** 64")) == 2 ** 64
+      assert Pythonx.decode(eval_result("-2 ** 63 - 1")) == -(2 ** 63) - 1
+      assert Pythonx.decode(eval_result("-3 ** 5000")) == -(3 ** 5000)
+
+      # Incremental decoding
+      assert {:list, [item]} = Pythonx.NIF.decode_once(eval_result("[-2 ** 100]"), false, true)
+      assert Pythonx.NIF.decode_once(item, false, true) == -(2 ** 100)
     end
 
     test "float" do
@@ -115,6 +1073,14 @@ defmodule PythonxTest do
       assert Pythonx.decode(eval_result(~S"b'A\xff'")) == <<65, 255>>
     end
 
+    test "bytearray" do
+      assert Pythonx.decode(eval_result(~S"bytearray(b'A\xff')")) == <<65, 255>>
+    end
+
+    test "memoryview" do
+      assert Pythonx.decode(eval_result(~S"memoryview(b'A\xff')")) == <<65, 255>>
+    end
+
     test "list" do
       assert Pythonx.decode(eval_result("[]")) == []
       assert Pythonx.decode(eval_result("[1, 2.0, 'hello']")) == [1, 2.0, "hello"]
@@ -145,6 +1111,44 @@ defmodule PythonxTest do
     test "identity for other objects" do
       assert repr(Pythonx.decode(eval_result("complex(1)"))) == "(1+0j)"
     end
+
+    test "nested containers" do
+      result = eval_result("[{'a': (1, None)}, [True, 2 ** 100, -2 ** 70], {1}, 1.5]")
+
+      assert Pythonx.decode(result) ==
+               [
+                 %{"a" => {1, nil}},
+                 [true, 2 ** 100, -(2 ** 70)],
+                 MapSet.new([1]),
+                 1.5
+               ]
+    end
+
+    test "other objects in containers" do
+      assert [object, "x", "y"] =
+               Pythonx.decode(eval_result("[complex(1), b'x', bytearray(b'y')]"))
+
+      assert repr(object) == "(1+0j)"
+    end
+
+    test "keys mapping to the same term" do
+      assert Pythonx.decode(eval_result("{'a': 1, b'a': 2}")) == %{"a" => 2}
+    end
+
+    test "deeply nested containers" do
+      {result, %{}} =
+        Pythonx.eval(
+          """
+          x = []
+          for _ in range(1000):
+            x = [x]
+          x
+          """,
+          %{}
+        )
+
+      assert Pythonx.decode(result) == Enum.reduce(1..1000, [], fn _, acc -> [acc] end)
+    end
   end
 
   describe "eval/2" do
@@ -319,6 +1323,329 @@ defmodule PythonxTest do
         )
       end
     end
+
+    test "formats the error message lazily by default" do
+      error =
+        assert_raise Pythonx.Error, fn ->
+          Pythonx.eval("raise ValueError('oops')", %{})
+        end
+
+      assert error.lines == nil
+      assert Exception.message(error) =~ "ValueError: oops"
+    end
+
+    test "formats the error message eagerly when requested" do
+      error =
+        assert_raise Pythonx.Error, fn ->
+          Pythonx.eval("raise ValueError('oops')", %{}, error_message: :eager)
+        end
+
+      assert [_ | _] = error.lines
+      assert Exception.message(error) =~ "ValueError: oops"
+    end
+
+    @traceback_code """
+    def fail():
+      data = [0] * 1000
+      raise ValueError("oops")
+
+    fail()
+    """
+
+    @frame_locals_code """
+    frames = []
+    while traceback is not None:
+      frames.append(traceback.tb_frame)
+      traceback = traceback.tb_next
+    dict(frames[-1].f_locals)
+    """
+
+    test "clears traceback frame locals by default" do
+      error = assert_raise Pythonx.Error, fn -> Pythonx.eval(@traceback_code, %{}) end
+
+      {result, _globals} = Pythonx.eval(@frame_locals_code, %{"traceback" => error.traceback})
+      assert Pythonx.decode(result) == %{}
+
+      assert Exception.message(error) =~ "in fail"
+    end
+
+    test "keeps traceback frames with traceback: :keep" do
+      error =
+        assert_raise Pythonx.Error, fn ->
+          Pythonx.eval(@traceback_code, %{}, traceback: :keep)
+        end
+
+      {result, _globals} = Pythonx.eval(@frame_locals_code, %{"traceback" => error.traceback})
+      assert %{"data" => data} = Pythonx.decode(result)
+      assert length(data) == 1000
+    end
+
+    test "drops the traceback with traceback: :summary" do
+      error =
+        assert_raise Pythonx.Error, fn ->
+          Pythonx.eval(@traceback_code, %{}, traceback: :summary)
+        end
+
+      assert Pythonx.decode(error.traceback) == nil
+      assert [_ | _] = error.lines
+      assert Exception.message(error) =~ "in fail"
+    end
+
+    test "message falls back when the exception objects are released" do
+      error = assert_raise Pythonx.Error, fn -> Pythonx.eval(@traceback_code, %{}) end
+
+      Pythonx.release(error.type)
+      Pythonx.release(error.value)
+      Pythonx.release(error.traceback)
+
+      assert Exception.message(error) =~ "Python exception raised"
+      assert Exception.message(error) =~ "the Python object has already been released"
+    end
+
+    test "forces garbage collection when large objects are created" do
+      pid = self()
+      :erlang.trace(pid, true, [:garbage_collection])
+
+      # The default memory pressure threshold is 64MB
+      {_result, %{"data" => _data}} = Pythonx.eval("data = bytes(80 * 1024 * 1024)", %{})
+
+      assert_receive {:trace, ^pid, :gc_major_start, _info}
+      :erlang.trace(pid, false, [:garbage_collection])
+    end
+
+    test "forces garbage collection when large objects without buffer are created" do
+      pid = self()
+      :erlang.trace(pid, true, [:garbage_collection])
+
+      # Dataframes and tensors report the size of their data, similarly
+      # to this object
+      {_result, %{"data" => _data}} =
+        Pythonx.eval(
+          """
+          class Data:
+            nbytes = 80 * 1024 * 1024
+
+          data = Data()
+          """,
+          %{}
+        )
+
+      assert_receive {:trace, ^pid, :gc_major_start, _info}
+      :erlang.trace(pid, false, [:garbage_collection])
+    end
+  end
+
+  describe "release/1" do
+    test "raises on subsequent use" do
+      {result, %{}} = Pythonx.eval("[1, 2, 3]", %{})
+
+      assert Pythonx.release(result) == :ok
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(result)
+      end
+
+      # Releasing again is a no-op
+      assert Pythonx.release(result) == :ok
+    end
+
+    test "is a no-op for shared objects" do
+      for term <- [nil, true, false, 1, :hello] do
+        object = Pythonx.encode!(term)
+        assert Pythonx.release(object) == :ok
+        assert Pythonx.decode(object) == Pythonx.decode(Pythonx.encode!(term))
+      end
+    end
+
+    test "decrements the refcount right away" do
+      {object, %{}} =
+        Pythonx.eval(
+          """
+          import os
+
+          os.environ["RELEASE_TEST_OBJECT_DELETED"] = "false"
+
+          class TestObject:
+            def __del__(self):
+              os.environ["RELEASE_TEST_OBJECT_DELETED"] = "true"
+
+          TestObject()
+          """,
+          %{}
+        )
+
+      Pythonx.release(object)
+
+      result = eval_result("import os; os.environ['RELEASE_TEST_OBJECT_DELETED']")
+      assert Pythonx.decode(result) == "true"
+    end
+  end
+
+  describe "decode/1 container items" do
+    test "share a resource and can be released individually" do
+      {result, %{}} = Pythonx.eval("[[1], [2], [3]]", %{})
+
+      assert {:list, [first, second, third]} = Pythonx.NIF.decode_once(result, false, true)
+      assert first.resource == second.resource
+      assert second.resource == third.resource
+
+      Pythonx.release(second)
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(second)
+      end
+
+      assert Pythonx.decode(first) == [1]
+      assert Pythonx.decode(third) == [3]
+    end
+
+    test "handles of released items are not reused by other objects" do
+      {result, %{}} = Pythonx.eval("[1]", %{})
+      assert {:list, [item]} = Pythonx.NIF.decode_once(result, false, true)
+
+      Pythonx.release(item)
+
+      # Decoding another container may reuse the freed slot
+      {result, %{}} = Pythonx.eval("[2]", %{})
+      assert {:list, [_other]} = Pythonx.NIF.decode_once(result, false, true)
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(item)
+      end
+    end
+
+    test "handles are only resolved through the owning group" do
+      {result, %{}} = Pythonx.eval("[1]", %{})
+      assert {:list, [item]} = Pythonx.NIF.decode_once(result, false, true)
+
+      {result, %{}} = Pythonx.eval("[2]", %{})
+      assert {:list, [other]} = Pythonx.NIF.decode_once(result, false, true)
+
+      forged = %{item | resource: other.resource}
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(forged)
+      end
+
+      # Releasing through another group does not affect the item
+      Pythonx.release(forged)
+      assert Pythonx.decode(item) == 1
+    end
+  end
+
+  describe "memory_stats/1" do
+    setup do
+      enabled? = Pythonx.NIF.object_tracking_stats(0) != nil
+      Pythonx.NIF.object_tracking_set(true)
+      on_exit(fn -> Pythonx.NIF.object_tracking_set(enabled?) end)
+      :ok
+    end
+
+    test "reports live objects by type and tag" do
+      tag = "memory_stats_test_#{System.unique_integer([:positive])}"
+
+      {result, %{"x" => x}} =
+        Pythonx.eval(
+          """
+          x = b"a" * 100_000
+          [1, 2, 3]
+          """,
+          %{},
+          tag: tag
+        )
+
+      stats = Pythonx.memory_stats()
+      assert %{objects: 2, bytes: bytes} = stats.by_tag[tag]
+      assert bytes >= 100_000
+      assert %{objects: objects} = stats.by_type["bytes"]
+      assert objects >= 1
+
+      # Decoded items inherit the tag
+      assert {:list, items} = Pythonx.NIF.decode_once(result, false, true)
+      assert %{objects: 5} = Pythonx.memory_stats().by_tag[tag]
+
+      Pythonx.release(x)
+      Enum.each(items, &Pythonx.release/1)
+      Pythonx.release(result)
+
+      assert Pythonx.memory_stats().by_tag[tag] == nil
+    end
+
+    test "lists long-lived objects" do
+      tag = "memory_stats_test_#{System.unique_integer([:positive])}"
+
+      {result, %{}} = Pythonx.eval("[1, 2, 3]", %{}, tag: tag)
+
+      long_lived = Pythonx.memory_stats(long_lived_after: 0).long_lived
+      assert [%{type: "list", tag: ^tag}] = Enum.filter(long_lived, &(&1.tag == tag))
+
+      Pythonx.release(result)
+    end
+  end
+
+  describe "with_scope/1" do
+    test "releases objects created within the scope" do
+      {outer, %{}} = Pythonx.eval("[1, 2, 3]", %{})
+
+      {inner, items} =
+        Pythonx.with_scope(fn ->
+          {inner, %{}} = Pythonx.eval("[4, 5, 6]", %{})
+          {inner, Pythonx.decode(inner)}
+        end)
+
+      assert items == [4, 5, 6]
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(inner)
+      end
+
+      assert Pythonx.decode(outer) == [1, 2, 3]
+    end
+
+    test "releases objects when the function raises" do
+      pid = self()
+
+      assert_raise RuntimeError, fn ->
+        Pythonx.with_scope(fn ->
+          send(pid, {:object, Pythonx.encode!([1, 2, 3])})
+          raise "oops"
+        end)
+      end
+
+      assert_received {:object, object}
+
+      assert_raise ArgumentError, ~r/the Python object has already been released/, fn ->
+        Pythonx.decode(object)
+      end
+    end
+
+    test "supports nested scopes" do
+      Pythonx.with_scope(fn ->
+        outer = Pythonx.encode!([1])
+        inner = Pythonx.with_scope(fn -> Pythonx.encode!([2]) end)
+
+        assert_raise ArgumentError, fn -> Pythonx.decode(inner) end
+        assert Pythonx.decode(outer) == [1]
+      end)
+    end
+  end
+
+  describe "release_on_exit/2" do
+    test "releases the object once the process terminates" do
+      object = Pythonx.encode!([1, 2, 3])
+      pid = spawn(fn -> Process.sleep(:infinity) end)
+
+      assert Pythonx.release_on_exit(object, pid) == :ok
+      assert Pythonx.decode(object) == [1, 2, 3]
+
+      ref = Process.monitor(pid)
+      Process.exit(pid, :kill)
+      assert_receive {:DOWN, ^ref, _, _, _}
+
+      # The Janitor handles the exit asynchronously, so we poll until
+      # the object is released
+      assert released_eventually?(object)
+    end
   end
 
   describe "sigil_PY/2" do
@@ -659,6 +1986,17 @@ defmodule PythonxTest do
              """
     end
 
+    test "decode/1 decodes remote objects" do
+      {result, %{}} = Pythonx.remote_eval(@peer1, "[1, 'a', {2}]", %{})
+      assert Pythonx.decode(result) == [1, "a", MapSet.new([2])]
+
+      {result, %{}} = Pythonx.remote_eval(@peer1, "[complex(1)]", %{})
+
+      assert_raise ArgumentError, ~r/cannot decode remote object/, fn ->
+        Pythonx.decode(result)
+      end
+    end
+
     test "copy_remote_object/1 uses cloudpickle if available" do
       # The built-in pickle module does not support lambdas, but cloudpickle does.
       {square_it, %{}} = Pythonx.remote_eval(@peer1, "lambda x: x * x", %{})
@@ -719,4 +2057,19 @@ defmodule PythonxTest do
     assert {result, %{}} = Pythonx.eval(code, %{})
     result
   end
+
+  defp released_eventually?(object, attempts \\ 100) do
+    try do
+      Pythonx.decode(object)
+    rescue
+      ArgumentError -> true
+    else
+      _ when attempts > 1 ->
+        Process.sleep(10)
+        released_eventually?(object, attempts - 1)
+
+      _ ->
+        false
+    end
+  end
 end
@@ -0,0 +1,18 @@
+defmodule Pythonx.Test.BadBatch do
+  @moduledoc false
+
+  # A struct with encode_many/2 returning fewer items than given, used
+  # to test that batch results are validated.
+
+  defstruct [:value]
+end
+
+defimpl Pythonx.Encoder, for: Pythonx.Test.BadBatch do
+  def encode(term, encoder) do
+    encoder.(term.value, encoder)
+  end
+
+  def encode_many(_terms, encoder) do
+    Pythonx.encode!([], encoder)
+  end
+end
@@ -0,0 +1,8 @@
+defmodule Pythonx.Test.Person do
+  @moduledoc false
+
+  # A struct used to test encoding with a registered Python class.
+
+  @derive Pythonx.Encoder
+  defstruct [:name, :age, tags: []]
+end
@@ -0,0 +1,28 @@
+defmodule Pythonx.Test.Point do
+  @moduledoc false
+
+  # A struct used to test custom Pythonx.Encoder implementations.
+  # The encoded tuples are tagged with the callback that produced
+  # them, so tests can tell whether the items were batched.
+
+  defstruct [:x, :y]
+end
+
+defimpl Pythonx.Encoder, for: Pythonx.Test.Point do
+  def encode(point, _encoder) do
+    {result, %{}} = Pythonx.eval("('one', x, y)", %{"x" => point.x, "y" => point.y})
+    result
+  end
+
+  def encode_many(points, _encoder) do
+    {result, %{}} =
+      Pythonx.eval(
+        """
+        [("many", x, y) for x, y in zip(xs, ys)]
+        """,
+        %{"xs" => Enum.map(points, & &1.x), "ys" => Enum.map(points, & &1.y)}
+      )
+
+    result
+  end
+end
@@ -7,7 +7,9 @@ version = "0.0.0"
 requires-python = "==3.#{python_minor}.*"
 dependencies = [
   "numpy==2.1.2",
-  "cloudpickle==3.1.2"
+  "cloudpickle==3.1.2",
+  "polars==1.17.1",
+  "pyarrow==18.1.0"
 ]
 """)
 